@@ -10,15 +10,27 @@
 // INCLUDES
 
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#if defined (__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "gc.h"
+#include "gc-profile.h"
+#include "gc-record.h"
+#include "gc-trace.h"
 #include "safeio.h"
 // ==============================================================================
 
@@ -27,28 +39,8 @@
 // ==============================================================================
 // TYPES AND STRUCTURES
 
-/** The header for each allocated object. */
-typedef struct header {
-
-  /** Pointer to the next header in the list. */
-  struct header* next;
-
-  /** Pointer to the previous header in the list. */
-  struct header* prev;
-
-  /** The usable size of the block (exclusive of the header itself). */
-  size_t         size;
-
-  /** Is the block allocated or free? */
-  bool           allocated;
-
-  /** Whether the block has been visited during reachability analysis. */
-  bool           marked;
-
-  /** A map of the layout of pointers in the object. */
-  gc_layout_s*   layout;
-
-} header_s;
+/** The header for each allocated object; see `gc.h`. */
+typedef gc_header_s header_s;
 
 /** A link in a linked stack of pointers, used during heap traversal. */
 typedef struct ptr_link {
@@ -60,6 +52,326 @@ typedef struct ptr_link {
   void* ptr;
 
 } ptr_link_s;
+
+/**
+ * A weak reference object.  Its `target` is not traced, and is cleared once
+ * the target is found to be unreachable.
+ */
+struct gc_weak_ref {
+
+  /** The referenced object, or `NULL` if it has been collected. */
+  void* target;
+
+};
+
+/**
+ * The header of a region chunk, a contiguous run of objects allocated by
+ * pointer bumping while a region is open.
+ */
+typedef struct region_chunk {
+
+  /** The size of the chunk, in bytes, including this header. */
+  size_t   size;
+
+  /** The end of the last object allocated in the chunk. */
+  intptr_t cursor;
+
+} region_chunk_s;
+
+/** The state of the promotion of escaping objects when a region closes. */
+typedef struct evacuation {
+
+  /** The objects whose pointers remain to be handled. */
+  ptr_link_s* scan;
+
+  /** The number of region objects copied into the heap. */
+  size_t      promoted;
+
+} evacuation_s;
+
+/**
+ * The header of a heap image file.  It is followed by the block offsets of the
+ * roots, and then, at `data_offset`, by the heap data itself, laid out exactly
+ * as it is to appear in memory when mapped at `base`.
+ */
+typedef struct image_header {
+
+  /** Identifies the file as a heap image (`IMAGE_MAGIC`). */
+  char     magic[8];
+
+  /** The size of an object header, which must match this build's. */
+  uint32_t header_size;
+
+  /** The page size for which the image was laid out. */
+  uint32_t page_size;
+
+  /** The address at which the heap data can be mapped without relocation. */
+  uint64_t base;
+
+  /** The offset, within the file, of the heap data; a multiple of pages. */
+  uint64_t data_offset;
+
+  /** The size of the heap data to map; a multiple of pages. */
+  uint64_t map_size;
+
+  /** The size of the heap data actually occupied by blocks. */
+  uint64_t used_size;
+
+  /** The number of layouts, stored consecutively at `layouts_offset`. */
+  uint64_t num_layouts;
+  uint64_t layouts_offset;
+
+  /** The number of objects, and the offsets of the first and last headers. */
+  uint64_t num_objects;
+  uint64_t first_offset;
+  uint64_t last_offset;
+
+  /** The number of roots that follow this header. */
+  uint64_t num_roots;
+
+} image_header_s;
+
+/** The state of the checking and relocation of a heap image being loaded. */
+typedef struct image_load {
+
+  /** The image's header. */
+  const image_header_s* image;
+
+  /** Where the data was mapped, and the end of the blocks within it. */
+  intptr_t              load_addr;
+  intptr_t              end;
+
+  /**
+   * How far the data was moved from where it was laid out, and the same for
+   * compressed references, which must now be measured from this heap's start.
+   */
+  intptr_t              delta;
+  intptr_t              ref_delta;
+
+  /** The image's layouts, as mapped. */
+  gc_layout_s*          layouts;
+
+  /** One bit for each double word of the data, set where an object starts. */
+  unsigned char*        starts;
+
+} image_load_s;
+
+/** A single key/value slot of an ephemeron table. */
+typedef struct ephemeron_entry {
+
+  /** The weakly held key; `NULL` if empty, `TOMBSTONE` if removed. */
+  void* key;
+
+  /** The value, kept alive only as long as the key is. */
+  void* value;
+
+} ephemeron_entry_s;
+
+/**
+ * An open-addressed hash table whose entries are _ephemerons_:  a value is
+ * reachable through the table only if its key is reachable by other means.
+ */
+struct gc_ephemeron_table {
+
+  /** The number of slots; always a power of two. */
+  size_t            capacity;
+
+  /** The number of live entries. */
+  size_t            count;
+
+  /** The number of non-empty slots (live entries plus tombstones). */
+  size_t            used;
+
+  /** The slots themselves. */
+  ephemeron_entry_s entries[];
+
+};
+
+/**
+ * The metadata at the start of an Immix block:  `IMMIX_BLOCK_SIZE` bytes,
+ * aligned to that size, and divided into lines of `IMMIX_LINE_SIZE` bytes.
+ * Objects are bump-allocated into holes, runs of free lines; a line is free
+ * unless it was marked by the last collection (or has since been claimed for
+ * allocation).  The metadata occupies the block's first lines.
+ */
+typedef struct immix_block {
+
+  /** The next block in the heap. */
+  struct immix_block* next;
+
+  /**
+   * A header, allocated but on no list, that covers the whole block, so that
+   * a walk from one block of the heap to the next steps over it.
+   */
+  header_s            header;
+
+  /** The number of lines found free by the last collection. */
+  size_t              free_lines;
+
+  /** The epoch in which each line was last marked or claimed. */
+  unsigned char       line_marks[];
+
+} immix_block_s;
+
+/** A position from which to search for holes among the Immix blocks. */
+typedef struct immix_scan {
+
+  /** The block being searched; `NULL` once past the last one. */
+  immix_block_s* block;
+
+  /** The next line of that block to search. */
+  size_t         line;
+
+} immix_scan_s;
+
+/**
+ * A scan of an object's pointer fields, by `mark()`, pushing each field that
+ * points to an unmarked object of the heap onto the root set stack.
+ */
+typedef void (*mark_scan_f) (gc_heap_t* heap, void* obj, const size_t* offsets,
+			     unsigned int num_ptrs);
+
+/**
+ * A heap, with all of the state of its allocator and collector.  Its objects
+ * live in a contiguous region of its own, from which they are allocated with
+ * pointer bumping, and to which they are freed onto a free list.  An Immix
+ * heap carves blocks from that region, too, and allocates most objects into
+ * the holes within them.
+ */
+struct gc_heap {
+
+  /**
+   * The allocation buffer, whose cursor and limit `gc_heap_new()` uses
+   * directly.  Must come first.
+   */
+  gc_alloc_buffer_s buffer;
+
+  /** The start and true end of the allocation buffer; `0` if there is none. */
+  intptr_t          buffer_start;
+  intptr_t          buffer_end;
+
+  /** The address of the next available byte in the heap region. */
+  intptr_t          free_addr;
+
+  /** The beginning of the heap. */
+  intptr_t          start_addr;
+
+  /** The end of the heap. */
+  intptr_t          end_addr;
+
+  /**
+   * The lowest address used by region chunks, which are carved downward from
+   * the end of the heap; `end_addr` if there are none.
+   */
+  intptr_t          region_floor;
+
+  /** Whether a region is open, and so `gc_new()` allocates into it. */
+  bool              region_active;
+
+  /**
+   * The objects outside the open region known to point into it, each marked
+   * as remembered so that it is remembered only once.
+   */
+  ptr_link_s*       region_remembered;
+
+  /** How the heap organizes its objects. */
+  gc_heap_policy_t  policy;
+
+  /** The space in which objects are allocated outside of regions. */
+  unsigned char     object_space;
+
+  /**
+   * The epoch of the current, or else the last, collection's marks.  It
+   * starts at `1`, as if there had been a collection, so that the first one
+   * has an epoch of `2`.
+   */
+  unsigned char     mark_epoch;
+
+  /**
+   * The epoch of the last collection, whose line marks are current; lines
+   * claimed for allocation since are marked with it, too.  It is never `0`,
+   * so that the lines of a new block are free.
+   */
+  unsigned char     line_epoch;
+
+  /** The Immix blocks, in the order carved, and the last of them. */
+  immix_block_s*    block_list_head;
+  immix_block_s*    block_list_tail;
+
+  /**
+   * Where to resume searching for holes:  for the allocation buffer, and for
+   * the medium-sized objects that overflow it.
+   */
+  immix_scan_s      buffer_scan;
+  immix_scan_s      overflow_scan;
+
+  /** The hole into which medium-sized objects overflow. */
+  intptr_t          overflow_cursor;
+  intptr_t          overflow_limit;
+
+  /** The number of this heap, for traces; the default heap is `0`. */
+  uint32_t          id;
+
+  /** The number of collections performed. */
+  uint64_t          collection_count;
+
+  /** The bytes, including headers, of the heap objects that survived the last sweep. */
+  size_t            live_bytes;
+
+  /** The head of the free list. */
+  header_s*         free_list_head;
+
+  /** The head of the allocated list. */
+  header_s*         allocated_list_head;
+
+  /** The head of the root set stack. */
+  ptr_link_s*       root_set_head;
+
+  /** The weak references found live during the current collection. */
+  ptr_link_s*       weak_list_head;
+
+  /** The ephemeron tables found live during the current collection. */
+  ptr_link_s*       ephemeron_list_head;
+
+  /** The objects with finalizers that have not (yet) been found unreachable. */
+  ptr_link_s*       finalizable_list_head;
+
+  /** The unreachable objects awaiting finalization. */
+  ptr_link_s*       finalize_queue_head;
+
+  /**
+   * The batches of objects being finalized right now.  Each link's `ptr` is
+   * the head of a batch, itself a linked stack of the objects.
+   */
+  ptr_link_s*       finalizing_list_head;
+
+  /** Guards `finalize_queue_head` and `finalizing_list_head`. */
+  pthread_mutex_t   finalize_lock;
+
+  /** Signalled when objects are queued for finalization, or on shutdown. */
+  pthread_cond_t    finalize_ready;
+
+  /** The background finalizer thread, if running. */
+  pthread_t         finalizer_thread;
+  bool              finalizer_thread_running;
+  bool              finalizer_thread_stopping;
+
+  /**
+   * One byte for each page of the heap, set once the page is written after a
+   * collection; `NULL` unless dirty pages are being tracked.
+   */
+  unsigned char*    dirty_map;
+
+  /**
+   * The end of the pages write-protected by the last collection, so that
+   * writes to them are noticed; `0` if there has been no such collection.
+   */
+  intptr_t          dirty_limit;
+
+  /** The next heap in the list of all heaps. */
+  struct gc_heap*   next_heap;
+
+};
 // ==============================================================================
 
 
@@ -89,79 +401,245 @@ typedef struct ptr_link {
 
 /** Given a pointer to a block, obtain a `header_s*` pointer to its header. */
 #define BLOCK_TO_HEADER(bp) ((header_s*)((intptr_t)bp - sizeof(header_s)))
+
+/** The kinds of object, which determine how `mark()` traces them. */
+#define KIND_OBJECT    0
+#define KIND_WEAK      1
+#define KIND_EPHEMERON 2
+
+/** The key of an ephemeron entry that has been removed. */
+#define TOMBSTONE ((void*)1)
+
+/** The smallest number of slots in an ephemeron table. */
+#define MIN_EPHEMERON_CAPACITY 8
+
+/** The spaces in which a block may be allocated. */
+#define SPACE_HEAP   0
+#define SPACE_REGION 1
+#define SPACE_IMMIX  2
+
+/** The kind of the header that covers an Immix block. */
+#define KIND_BLOCK 3
+
+/** The number of distinct mark epochs, which run from 1. */
+#define MAX_EPOCH 255
+
+/** Whether the block with a given header was marked by a heap's current collection. */
+#define IS_MARKED(heap, hp) ((hp)->marked == (heap)->mark_epoch)
+
+/** The size (and alignment) of an Immix block, and the size of its lines. */
+#define IMMIX_BLOCK_SIZE KB(32)
+#define IMMIX_LINE_SIZE  128
+#define IMMIX_LINES      (IMMIX_BLOCK_SIZE / IMMIX_LINE_SIZE)
+
+/** The first line of an Immix block after its metadata. */
+#define IMMIX_FIRST_LINE \
+  ((sizeof(immix_block_s) + IMMIX_LINES + IMMIX_LINE_SIZE - 1) / IMMIX_LINE_SIZE)
+
+/** Given an address within an Immix block, obtain the block. */
+#define IMMIX_BLOCK_OF(addr) \
+  ((immix_block_s*)((intptr_t)(addr) & ~(intptr_t)(IMMIX_BLOCK_SIZE - 1)))
+
+/** The default size of a region chunk. */
+#define REGION_CHUNK_SIZE MB(1)
+
+/**
+ * Given the address of the end of one block, obtain the address at which the
+ * next header must go so that its block is double-word aligned.
+ */
+#define HEADER_POSITION(addr) \
+  ((addr) + (intptr_t)((sizeof(header_s) + DBL_WORD_SIZE - ((addr) % DBL_WORD_SIZE)) % DBL_WORD_SIZE))
+
+/** The size of an allocation buffer carved from the bump frontier. */
+#define BUFFER_SIZE KB(32)
+
+/** The largest span of an object allocated from an allocation buffer. */
+#define BUFFER_MAX_SPAN GC_BUFFER_MAX_SPAN
+
+/**
+ * The smallest unused space at the end of an allocation buffer that is made a
+ * free block; anything less is left to the buffer's last object.
+ */
+#define MIN_FREE_SPAN 128
+
+/**
+ * The address at which the heap region is requested, so that it is the same
+ * from run to run, and heap images saved by one run can be mapped by the next
+ * without relocation.
+ */
+#define HEAP_BASE_HINT ((void*)0x200000000000)
+
+/** Identifies a heap image file. */
+#define IMAGE_MAGIC "GCIMAGE1"
+
+/** Round a size up to a multiple of the page size. */
+#define PAGE_ROUND_UP(size) (((size) + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE)
+
+/** The number of objects the finalizer thread finalizes per batch. */
+#define FINALIZER_BATCH_SIZE 64
+
+/**
+ * The fewest pointer fields for which `mark()` uses the vectorized scan; for
+ * fewer, choosing and setting it up costs more than it saves.
+ */
+#define MARK_SCAN_WIDE 16
 // ==============================================================================
 
 
 // ==============================================================================
 // GLOBALS
 
-/** The address of the next available byte in the heap region. */
-static intptr_t free_addr  = 0;
+/** The heap used by the global API until a thread switches to another. */
+static gc_heap_t default_heap = {
+  .buffer         = { 0, 0, SPACE_HEAP },
+  .mark_epoch     = 1,
+  .line_epoch     = 1,
+  .finalize_lock  = PTHREAD_MUTEX_INITIALIZER,
+  .finalize_ready = PTHREAD_COND_INITIALIZER
+};
 
-/** The beginning of the heap. */
-static intptr_t start_addr = 0;
+/** The heap on which the calling thread's `gc_*()` calls operate. */
+__thread gc_heap_t* gc_current_heap = &default_heap;
+
+/**
+ * Every heap, the default heap last, and the number of the next one created.
+ * The list is changed only under the lock, but `dirty_fault()` walks it without
+ * one; see `dirty_quiesce()`.
+ */
+static gc_heap_t*      heap_list_head = &default_heap;
+static uint32_t        heap_next_id   = 1;
+static pthread_mutex_t heap_list_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/** The end of the heap. */
-static intptr_t end_addr   = 0;
+/**
+ * The layouts of weak references and ephemeron tables.  Neither has any traced
+ * pointers; `mark()` handles their contents specially, based on the kind.
+ */
+static const gc_layout_s weak_layout      = { sizeof(struct gc_weak_ref), 0, NULL, NULL };
+static const gc_layout_s ephemeron_layout = { 0, 0, NULL, NULL };
 
-/** The head of the free list. */
-static header_s* free_list_head = NULL;
+/** The scan of pointer fields best suited to this CPU; chosen on first use. */
+static mark_scan_f mark_scan = NULL;
 
-/** The head of the allocated list. */
-static header_s* allocated_list_head = NULL;
+/**
+ * The size of a page, once dirty pages are first tracked, and the `SIGSEGV`
+ * action in place before then, to which faults outside of every tracked heap
+ * are passed.
+ */
+static size_t           dirty_page_size        = 0;
+static struct sigaction dirty_previous_action;
 
-/** The head of the root set stack. */
-static ptr_link_s* root_set_head = NULL;
+/** The number of threads in `dirty_fault()`, walking the heap list. */
+static int              dirty_readers          = 0;
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Push a pointer onto root set stack.
+ * Push a pointer onto a linked stack of pointers.
  *
- * \param ptr The pointer to be pushed.
+ * \param stack A pointer to the head of the stack.
+ * \param ptr   The pointer to be pushed.
  */
-void rs_push (void* ptr) {
+void link_push (ptr_link_s** stack, void* ptr) {
 
   // Make a new link.
   ptr_link_s* link = malloc(sizeof(ptr_link_s));
   if (link == NULL) {
-    ERROR("rs_push(): Failed to allocate link");
+    ERROR("link_push(): Failed to allocate link");
   }
 
   // Have it store the pointer and insert it at the front.
-  link->ptr    = ptr;
-  link->next   = root_set_head;
-  root_set_head = link;
+  link->ptr  = ptr;
+  link->next = *stack;
+  *stack     = link;
   
-} // rs_push ()
+} // link_push ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Pop a pointer from the root set stack.
+ * Pop a pointer from a linked stack of pointers.
  *
+ * \param stack A pointer to the head of the stack.
  * \return The top pointer being removed, if the stack is non-empty;
  *         <code>NULL</code>, otherwise.
  */
-void* rs_pop () {
+void* link_pop (ptr_link_s** stack) {
 
   // Grab the pointer from the link...if there is one.
-  if (root_set_head == NULL) {
+  if (*stack == NULL) {
     return NULL;
   }
-  void* ptr = root_set_head->ptr;
+  void* ptr = (*stack)->ptr;
 
   // Remove and free the link.
-  ptr_link_s* old_head = root_set_head;
-  root_set_head = root_set_head->next;
+  ptr_link_s* old_head = *stack;
+  *stack = old_head->next;
   free(old_head);
 
   return ptr;
   
+} // link_pop ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Remove a pointer from a linked stack of pointers, wherever it is.
+ *
+ * \param stack A pointer to the top of the stack.
+ * \param ptr   The pointer to be removed.
+ * \return <code>true</code> if the pointer was found and removed;
+ *         <code>false</code>, otherwise.
+ */
+bool link_remove (ptr_link_s** stack, void* ptr) {
+
+  for (ptr_link_s** entry = stack; *entry != NULL; entry = &(*entry)->next) {
+    if ((*entry)->ptr == ptr) {
+      ptr_link_s* link = *entry;
+      *entry = link->next;
+      free(link);
+      return true;
+    }
+  }
+
+  return false;
+  
+} // link_remove ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Push a pointer onto root set stack.
+ *
+ * \param ptr The pointer to be pushed.
+ */
+void rs_push (void* ptr) {
+
+  link_push(&gc_current_heap->root_set_head, ptr);
+  
+} // rs_push ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Pop a pointer from the root set stack.
+ *
+ * \return The top pointer being removed, if the stack is non-empty;
+ *         <code>NULL</code>, otherwise.
+ */
+void* rs_pop () {
+
+  return link_pop(&gc_current_heap->root_set_head);
+  
 } // rs_pop ()
 // ==============================================================================
 
@@ -178,6 +656,9 @@ void* rs_pop () {
 void gc_root_set_insert (void* ptr) {
 
   rs_push(ptr);
+  if (gc_recording) {
+    record_root(ptr);
+  }
   
 } // root_set_insert ()
 // ==============================================================================
@@ -186,420 +667,3708 @@ void gc_root_set_insert (void* ptr) {
 
 // ==============================================================================
 /**
- * The initialization method.  If this is the first use of the heap, initialize it.
+ * Determine whether an address lies within a heap.
+ *
+ * \param heap The heap.
+ * \param ptr  The address.
+ * \return `true` if `ptr` is in the heap; `false`, otherwise.
  */
-void gc_init () {
+bool heap_contains (gc_heap_t* heap, void* ptr) {
 
-  // Only do anything if there is no heap region (i.e., first time called).
-  if (start_addr == 0) {
+  return (intptr_t)ptr > heap->start_addr && (intptr_t)ptr < heap->end_addr;
 
-    DEBUG("Trying to initialize");
-    
-    // Allocate virtual address space in which the heap will reside. Make it
-    // un-shared and not backed by any file (_anonymous_ space).  A failure to
-    // map this space is fatal.
-    void* heap = mmap(NULL,
-		      HEAP_SIZE,
-		      PROT_READ | PROT_WRITE,
-		      MAP_PRIVATE | MAP_ANONYMOUS,
-		      -1,
-		      0);
-    if (heap == MAP_FAILED) {
-      ERROR("Could not mmap() heap region");
-    }
+} // heap_contains ()
+// ==============================================================================
 
-    // Hold onto the boundaries of the heap as a whole.
-    start_addr = (intptr_t)heap;
-    end_addr   = start_addr + HEAP_SIZE;
-    free_addr  = start_addr;
 
-    // DEBUG: Emit a message to indicate that this allocator is being called.
-    DEBUG("bf-alloc initialized");
 
-  }
+// ==============================================================================
+/**
+ * Determine whether an address lies within a heap's open region.
+ *
+ * \param heap The heap.
+ * \param ptr  The address.
+ * \return `true` if a region is open and `ptr` is in one of its chunks; `false`,
+ *         otherwise.
+ */
+bool region_contains (gc_heap_t* heap, void* ptr) {
 
-} // gc_init ()
+  return (heap->region_active &&
+	  (intptr_t)ptr >= heap->region_floor && (intptr_t)ptr < heap->end_addr);
+
+} // region_contains ()
 // ==============================================================================
 
 
+
 // ==============================================================================
-// COPY-AND-PASTE YOUR PROJECT-4 malloc() HERE.
-//
-//   Note that you may have to adapt small things.  For example, the `init()`
-//   function is now `gc_init()` (above); the header is a little bit different
-//   from the Project-4 one; my `allocated_list_head` may be a slightly
-//   different name than the one you used.  Check the details.
-//
 /**
- * Allocate and return `size` bytes of heap space.  Specifically, search the
- * free list, choosing the _best fit_.  If no such block is available, expand
- * into the heap region via _pointer bumping_.
+ * Read one of an object's pointer fields, expanding it if it is a compressed
+ * reference.
  *
- * \param size The number of bytes to allocate.
- * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ * \param heap   The heap that holds the object.
+ * \param obj    The object.
+ * \param offset The field's offset, as given by the object's layout.
+ * \return The pointer.
  */
-void* gc_malloc (size_t size) {
-  
-  /** Ensure that the heap is initialized. */
-  gc_init();
-
-  /** Ensure that the pointer that gets returned is double-word aligned.
-   *  Specifically, free_addr should be sizeof(header_s) away from a
-   *  double-word boundary, so that after the header is put in place, the
-   *  usable block is aligned appropriately. */
-  intptr_t padding = (sizeof(header_s) + DBL_WORD_SIZE - (free_addr % DBL_WORD_SIZE)) % DBL_WORD_SIZE;
-  free_addr += padding;
+void* field_load (gc_heap_t* heap, void* obj, size_t offset) {
 
-  /** If trying to allocate a block of zero length, return a null pointer. */
-  if (size == 0) {
-    return NULL;
+  if (offset & GC_COMPRESSED_REF) {
+    return gc_heap_ref_decode(heap, *(gc_ref_t*)(obj + (offset & ~GC_COMPRESSED_REF)));
   }
+  return *(void**)(obj + offset);
 
-  /** Start from the head of the list, and search for a best fit by hopping 
-   *  from free block to free block (i.e. peruse the entire list of free blocks
-   *  to find the best fit). */
-  header_s* current = free_list_head;
-  header_s* best    = NULL;
+} // field_load ()
+// ==============================================================================
 
-  /** Keep following pointers to the next free block until we reach a null pointer. */
-  while (current != NULL) {
 
-    /** If we find an allocated block in the list of free blocks, throw an error. */
-    if (current->allocated) {
-      ERROR("Allocated block on free list", (intptr_t)current);
-    }
-    
-    /** The current block is a best fit if:
-     *  (1) We haven't found a best fit yet, and the current block's size is
-     *      at least as large as the requested size, OR
-     *  (2) We have found a best fit, but the current block is an even better
-     *      fit, i.e. it's smaller than the best fit we previously found, but
-     *      still at least as big as the requested size. */
-    if ( (best == NULL && size <= current->size) ||
-	 (best != NULL && size <= current->size && current->size < best->size) ) {
-      best = current;
-    }
 
-    /** If we have found a best fit that's exactly the requested size, we are
+// ==============================================================================
+/**
+ * Write one of an object's pointer fields, compressing the pointer if the
+ * field is a compressed reference.
+ *
+ * \param heap   The heap that holds the object.
+ * \param obj    The object.
+ * \param offset The field's offset, as given by the object's layout.
+ * \param ptr    The pointer.
+ */
+void field_store (gc_heap_t* heap, void* obj, size_t offset, void* ptr) {
+
+  if (offset & GC_COMPRESSED_REF) {
+    *(gc_ref_t*)(obj + (offset & ~GC_COMPRESSED_REF)) = gc_heap_ref_encode(heap, ptr);
+  } else {
+    *(void**)(obj + offset) = ptr;
+  }
+
+} // field_store ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Reserve the region of virtual address space in which a heap will reside,
+ * un-shared and not backed by any file (_anonymous_ space).
+ *
+ * \param heap The heap.
+ * \param size The size of the region, in bytes.
+ * \param hint The address at which to prefer the region, if any.
+ * \return `true` if successful; `false` if the space could not be mapped.
+ */
+bool heap_map (gc_heap_t* heap, size_t size, void* hint) {
+
+  void* region = mmap(hint,
+		      size,
+		      PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+		      -1,
+		      0);
+  if (region == MAP_FAILED) {
+    return false;
+  }
+
+  // Hold onto the boundaries of the heap as a whole.
+  heap->start_addr   = (intptr_t)region;
+  heap->end_addr     = heap->start_addr + size;
+  heap->free_addr    = heap->start_addr;
+  heap->region_floor = heap->end_addr;
+
+  heap->buffer.heap_base = heap->start_addr;
+
+  return true;
+
+} // heap_map ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The initialization method.  If this is the first use of the current heap,
+ * initialize it.  (Only the default heap is initialized lazily; others are
+ * initialized when created.)
+ */
+void gc_init () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  // Only do anything if there is no heap region (i.e., first time called).
+  if (heap->start_addr == 0) {
+
+    DEBUG("Trying to initialize");
+    
+    // A failure to map the heap's space is fatal.  Prefer the same address
+    // every run, though any will do.
+    if (!heap_map(heap, HEAP_SIZE, HEAP_BASE_HINT)) {
+      ERROR("Could not mmap() heap region");
+    }
+
+    // DEBUG: Emit a message to indicate that this allocator is being called.
+    DEBUG("bf-alloc initialized");
+
+  }
+
+} // gc_init ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Create a new, empty heap, organized by `GC_HEAP_FREE_LIST`.
+ *
+ * \param size The address space to reserve for the heap, in bytes; `0` for the
+ *             same amount as the default heap.
+ * \return The heap, if successful; `NULL` if unsuccessful.
+ */
+gc_heap_t* gc_heap_create (size_t size) {
+
+  return gc_heap_create_with_policy(size, GC_HEAP_FREE_LIST);
+
+} // gc_heap_create ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Create a new, empty heap, organized by the given policy.
+ *
+ * \param size   The address space to reserve for the heap, in bytes; `0` for
+ *               the same amount as the default heap.
+ * \param policy How the heap's objects are organized.
+ * \return The heap, if successful; `NULL` if unsuccessful.
+ */
+gc_heap_t* gc_heap_create_with_policy (size_t size, gc_heap_policy_t policy) {
+
+  gc_heap_t* heap = calloc(1, sizeof(gc_heap_t));
+  if (heap == NULL) {
+    return NULL;
+  }
+  if (!heap_map(heap, size > 0 ? size : HEAP_SIZE, NULL)) {
+    free(heap);
+    return NULL;
+  }
+  heap->policy       = policy;
+  heap->object_space = policy == GC_HEAP_IMMIX ? SPACE_IMMIX : SPACE_HEAP;
+  heap->buffer.space = heap->object_space;
+  heap->mark_epoch   = 1;
+  heap->line_epoch   = 1;
+  pthread_mutex_init(&heap->finalize_lock, NULL);
+  pthread_cond_init(&heap->finalize_ready, NULL);
+
+  pthread_mutex_lock(&heap_list_lock);
+  heap->id        = heap_next_id++;
+  heap->next_heap = heap_list_head;
+  __atomic_store_n(&heap_list_head, heap, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&heap_list_lock);
+
+  return heap;
+
+} // gc_heap_create_with_policy ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Wait until every thread that was in `dirty_fault()` has left it.  A heap
+ * unlinked from the heap list, or a dirty map unhooked from its heap, before
+ * the call is then out of every handler's reach, and may be freed.
+ */
+void dirty_quiesce () {
+
+  while (__atomic_load_n(&dirty_readers, __ATOMIC_SEQ_CST) != 0) {
+    sched_yield();
+  }
+
+} // dirty_quiesce ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Destroy a heap, unmapping its region at once.  The links of its root set,
+ * finalization lists and remembered set, which live outside of it, are freed
+ * too, and the profiler and recorder forget its objects.
+ *
+ * \param heap The heap; not the default heap.
+ */
+void gc_heap_destroy (gc_heap_t* heap) {
+
+  if (heap == &default_heap) {
+    ERROR("gc_heap_destroy(): Cannot destroy the default heap");
+  }
+
+  gc_heap_t* previous = gc_heap_switch(heap);
+  gc_finalizer_thread_stop();
+  gc_dirty_tracking_stop();
+  gc_current_heap = previous == heap ? &default_heap : previous;
+
+  pthread_mutex_lock(&heap_list_lock);
+  gc_heap_t** entry = &heap_list_head;
+  while (*entry != heap) {
+    entry = &(*entry)->next_heap;
+  }
+  __atomic_store_n(entry, heap->next_heap, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&heap_list_lock);
+  dirty_quiesce();
+
+  profile_forget_range((void*)heap->start_addr, (void*)heap->end_addr);
+  record_heap_destroy(heap);
+  munmap((void*)heap->start_addr, heap->end_addr - heap->start_addr);
+  while (heap->root_set_head != NULL) {
+    link_pop(&heap->root_set_head);
+  }
+  while (heap->region_remembered != NULL) {
+    link_pop(&heap->region_remembered);
+  }
+  while (heap->finalizable_list_head != NULL) {
+    link_pop(&heap->finalizable_list_head);
+  }
+  while (heap->finalize_queue_head != NULL) {
+    link_pop(&heap->finalize_queue_head);
+  }
+  while (heap->finalizing_list_head != NULL) {
+    ptr_link_s* batch = link_pop(&heap->finalizing_list_head);
+    while (batch != NULL) {
+      link_pop(&batch);
+    }
+  }
+  pthread_mutex_destroy(&heap->finalize_lock);
+  pthread_cond_destroy(&heap->finalize_ready);
+  free(heap);
+
+} // gc_heap_destroy ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Make a heap the calling thread's current heap.
+ *
+ * \param heap The heap; `NULL` for the default heap.
+ * \return The thread's previously current heap.
+ */
+gc_heap_t* gc_heap_switch (gc_heap_t* heap) {
+
+  gc_heap_t* previous = gc_current_heap;
+  gc_current_heap = heap != NULL ? heap : &default_heap;
+
+  return previous;
+
+} // gc_heap_switch ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Add a pointer to a heap's _root set_.
+ *
+ * \param heap The heap.
+ * \param ptr  A pointer to be added to the heap's _root set_ of pointers.
+ */
+void gc_heap_root_set_insert (gc_heap_t* heap, void* ptr) {
+
+  link_push(&heap->root_set_head, ptr);
+  if (gc_recording) {
+    record_root(ptr);
+  }
+
+} // gc_heap_root_set_insert ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Send every heap's subsequent allocations down the slow path.  Each heap's
+ * slow path keeps doing so for as long as the profiler, tracer or recorder is
+ * running.
+ */
+void gc_alloc_buffers_disable () {
+
+  pthread_mutex_lock(&heap_list_lock);
+  for (gc_heap_t* heap = heap_list_head; heap != NULL; heap = heap->next_heap) {
+    heap->buffer.limit = 0;
+  }
+  pthread_mutex_unlock(&heap_list_lock);
+
+} // gc_alloc_buffers_disable ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Insert a free block at the head of the free list.
+ *
+ * \param header_ptr The header of the block, which is on no other list.
+ */
+void free_list_insert (header_s* header_ptr) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  header_ptr->allocated = false;
+  header_ptr->prev      = NULL;
+  header_ptr->next      = heap->free_list_head;
+  if (heap->free_list_head != NULL) {
+    heap->free_list_head->prev = header_ptr;
+  }
+  heap->free_list_head = header_ptr;
+  
+} // free_list_insert ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Remove a block from the free list.
+ *
+ * \param header_ptr The header of the block, which is on the free list.
+ */
+void free_list_remove (header_s* header_ptr) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (header_ptr->prev == NULL) {
+    heap->free_list_head         = header_ptr->next;
+  } else {
+    header_ptr->prev->next = header_ptr->next;
+  }
+  if (header_ptr->next != NULL) {
+    header_ptr->next->prev = header_ptr->prev;
+  }
+  header_ptr->prev = NULL;
+  header_ptr->next = NULL;
+  
+} // free_list_remove ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Retire the allocation buffer.  Its objects are linked onto the allocated list
+ * (or, in a region, readied for promotion), and its unused space is given back:
+ * to the bump frontier, if it came from there; to its last object, if it is too
+ * small to be worth a free block; or else as a free block.
+ */
+void alloc_buffer_retire () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (heap->buffer_start == 0) {
+    return;
+  }
+
+  // Immix objects are on no list, and the rest of their hole is left unused
+  // until the next collection finds its lines free again.
+  if (heap->buffer.space == SPACE_IMMIX) {
+    heap->buffer_start  = 0;
+    heap->buffer_end    = 0;
+    heap->buffer.cursor = 0;
+    heap->buffer.limit  = 0;
+    return;
+  }
+
+  intptr_t  cursor = heap->buffer.cursor;
+  header_s* last   = NULL;
+  for (intptr_t addr = heap->buffer_start; addr < cursor; addr += sizeof(header_s) + last->size) {
+
+    last = (header_s*)addr;
+    if (heap->buffer.space == SPACE_REGION) {
+      last->next = NULL;
+      last->prev = NULL;
+      continue;
+    }
+    last->prev = NULL;
+    last->next = heap->allocated_list_head;
+    if (heap->allocated_list_head != NULL) {
+      heap->allocated_list_head->prev = last;
+    }
+    heap->allocated_list_head = last;
+
+  }
+
+  if (heap->buffer.space == SPACE_REGION) {
+    ((region_chunk_s*)heap->region_floor)->cursor = cursor;
+  } else if (heap->buffer_end == heap->free_addr) {
+    heap->free_addr = cursor;
+  } else if (last != NULL && heap->buffer_end - cursor < MIN_FREE_SPAN) {
+    last->size += heap->buffer_end - cursor;
+  } else if (heap->buffer_end > cursor) {
+    header_s* tail = (header_s*)cursor;
+    tail->size     = heap->buffer_end - cursor - sizeof(header_s);
+    tail->marked   = 0;
+    tail->space    = SPACE_HEAP;
+    free_list_insert(tail);
+  }
+
+  heap->buffer_start           = 0;
+  heap->buffer_end             = 0;
+  heap->buffer.cursor = 0;
+  heap->buffer.limit  = 0;
+  
+} // alloc_buffer_retire ()
+// ==============================================================================
+
+
+// ==============================================================================
+// COPY-AND-PASTE YOUR PROJECT-4 malloc() HERE.
+//
+//   Note that you may have to adapt small things.  For example, the `init()`
+//   function is now `gc_init()` (above); the header is a little bit different
+//   from the Project-4 one; my `allocated_list_head` may be a slightly
+//   different name than the one you used.  Check the details.
+//
+/**
+ * Allocate and return `size` bytes of heap space.  Specifically, search the
+ * free list, choosing the _best fit_.  If no such block is available, expand
+ * into the heap region via _pointer bumping_.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* gc_malloc (size_t size) {
+
+  gc_heap_t* heap = gc_current_heap;
+  
+  /** Ensure that the heap is initialized. */
+  gc_init();
+
+  /** If the allocation buffer is at the bump frontier, give back its unused
+   *  space, so that any pointer bumping below continues from its objects.
+   *  (An Immix buffer is a hole within a block, and cannot be given back.) */
+  if (heap->buffer.space == SPACE_HEAP &&
+      heap->buffer_end != 0 && heap->buffer_end == heap->free_addr) {
+    alloc_buffer_retire();
+  }
+
+  /** Ensure that the pointer that gets returned is double-word aligned.
+   *  Specifically, free_addr should be sizeof(header_s) away from a
+   *  double-word boundary, so that after the header is put in place, the
+   *  usable block is aligned appropriately. */
+  heap->free_addr = HEADER_POSITION(heap->free_addr);
+
+  /** If trying to allocate a block of zero length, return a null pointer. */
+  if (size == 0) {
+    return NULL;
+  }
+
+  /** Start from the head of the list, and search for a best fit by hopping 
+   *  from free block to free block (i.e. peruse the entire list of free blocks
+   *  to find the best fit). */
+  header_s* current = heap->free_list_head;
+  header_s* best    = NULL;
+
+  /** Keep following pointers to the next free block until we reach a null pointer. */
+  while (current != NULL) {
+
+    /** If we find an allocated block in the list of free blocks, throw an error. */
+    if (current->allocated) {
+      ERROR("Allocated block on free list", (intptr_t)current);
+    }
+    
+    /** The current block is a best fit if:
+     *  (1) We haven't found a best fit yet, and the current block's size is
+     *      at least as large as the requested size, OR
+     *  (2) We have found a best fit, but the current block is an even better
+     *      fit, i.e. it's smaller than the best fit we previously found, but
+     *      still at least as big as the requested size. */
+    if ( (best == NULL && size <= current->size) ||
+	 (best != NULL && size <= current->size && current->size < best->size) ) {
+      best = current;
+    }
+
+    /** If we have found a best fit that's exactly the requested size, we are
      *  done and can break out of the loop (to avoid unneccessary iterations). */
     if (best != NULL && best->size == size) {
       break;
     }
 
-    /** Move on to the next free block in the linked list, and keep iterating. */
-    current = current->next;
-    
+    /** Move on to the next free block in the linked list, and keep iterating. */
+    current = current->next;
+    
+  }
+
+  /** Pointer to the block we will return. Don't know what that is yet, so
+   *  make it a null pointer. */
+  void* new_block_ptr = NULL;
+
+  /** If we have found a best fit... */
+  if (best != NULL) {
+
+    /** ...remove it from the linked list of free blocks. Specifically, if it
+     *  is the first in the list (i.e. it has no previous block), then just 
+     *  set the free list head to the free block immediately following it.
+     *  If it is not the first block in the list (i.e. it has a block before
+     *  it), make that previous block point to the block immediately following
+     *  the best fit one (i.e. skip over the best fit block). */
+    if (best->prev == NULL) {
+      heap->free_list_head   = best->next;
+    } else {
+      best->prev->next = best->next;
+    }
+
+    /** If the best fit block has a block following it, make that next block
+     *  point to the block before the best fit one as its predecessor (i.e. skip
+     *  over the best fit block). */
+    if (best->next != NULL) {
+      best->next->prev = best->prev;
+    }
+   
+    /** Remove the best fit block's pointer to its predecessor. */ 
+    best->prev = NULL;
+
+    /** Remove the best fit block's pointer to its successor. */
+    best->next = NULL;
+
+    /** We have allocated the best fit block. Set a pointer to that block.
+     *  Its mark is from some earlier collection, and so is cleared. */
+    best->allocated  = true;
+    best->marked     = 0;
+    best->visited    = false;
+    best->remembered = false;
+    new_block_ptr    = HEADER_TO_BLOCK(best);
+    
+  } else {
+
+    /** If we have not found a best fit, then we must pointer bump and keep
+     *  growing the heap by creating a new block. Set a pointer to that block. */
+    header_s* header_ptr = (header_s*)heap->free_addr;
+    new_block_ptr = HEADER_TO_BLOCK(header_ptr);
+
+    /** Pointer bumping: find the next new free address in the heap by moving
+     *  away from the block pointer by a translation equal to the block's size. */
+    intptr_t new_free_addr = (intptr_t)new_block_ptr + size;
+
+    /** Have we exceeded the maximum size of the heap, or run into the
+     *  region chunks at its top?  If so, allocation failed, and nothing may
+     *  be written, lest it overwrite the lowest chunk. */
+    if (new_free_addr > heap->region_floor) {
+      return NULL;
+    }
+    heap->free_addr = new_free_addr;
+
+    /** The block will not be part of a linked list (since it is allocated),
+     *  its size will be exactly the requested size, and we must signal that
+     *  it is allocated. */
+    header_ptr->next       = NULL;
+    header_ptr->prev       = NULL;
+    header_ptr->size       = size;
+    header_ptr->allocated  = true;
+    header_ptr->marked     = 0;
+    header_ptr->space      = SPACE_HEAP;
+    header_ptr->visited    = false;
+    header_ptr->remembered = false;
+    
+  }
+
+  /** Insert the block at the beginning of the linked list of allocated blocks, 
+   *  i.e. make it point to the first allocated block currently in the list, and
+   *  set the head of the allocated list to point at the block we are allocating.
+   *  Also, since the newly allocated block is the first one in the list, there
+   *  will be no block before it, so its previous pointer is a null pointer. */
+  header_s* allocated_header_ptr = BLOCK_TO_HEADER(new_block_ptr);
+  allocated_header_ptr->next = heap->allocated_list_head;
+  heap->allocated_list_head = allocated_header_ptr;
+  allocated_header_ptr->prev = NULL;
+
+  /** If the next block is not null, then we must ensure its previous pointer
+   *  will point to the block we are deallocating. */
+  if (allocated_header_ptr->next != NULL) {
+    allocated_header_ptr->next->prev = allocated_header_ptr;
+  }
+
+  /** Return a pointer to the newly allocated block - allocation succeeded. */
+  return new_block_ptr;
+
+} // gc_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// COPY-AND-PASTE YOUR PROJECT-4 free() HERE.
+//
+//   See above.  Small details may have changed, but the code should largely be
+//   unchanged.
+//
+/**
+ * Deallocate a given block on the heap.  Add the given block (if any) to the
+ * free list.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+void gc_free (void* ptr) {
+
+  gc_heap_t* heap = gc_current_heap;
+    
+  /** If passed a null pointer, there's nothing to free. */
+  if (ptr == NULL) {
+    return;
+  }
+
+  /** Get a pointer to the block's header. */
+  header_s* header_ptr = BLOCK_TO_HEADER(ptr);
+
+  /** If the block is not allocated, there's no point in trying to free it,
+   *  so throw an error. */
+  if (!header_ptr->allocated) {
+    ERROR("Double-free: ", (intptr_t)header_ptr);
+  }
+
+  /** An Immix object is on no list; its space is reclaimed with its lines. */
+  if (header_ptr->space == SPACE_IMMIX) {
+    header_ptr->allocated = false;
+    return;
+  }
+
+  /** Remove the block from the linked list of allocated blocks. Specifically, 
+   *  if it is the first in the list (i.e. it has no previous block), then just 
+   *  set the allocated list head to the allocated block immediately following it.
+   *  If it is not the first block in the list (i.e. it has a block before
+   *  it), make that previous block point to the block immediately following
+   *  the one we are deallocating (i.e. skip over the deallocated block). */
+   if (header_ptr->prev == NULL) {
+     heap->allocated_list_head = header_ptr->next;
+   } else {
+     header_ptr->prev->next = header_ptr->next;
+   }
+
+   /** If the deallocated block has a block following it, make that next block
+    *  point to the block before the deallocated one as its predecessor (i.e. skip
+    *  over the deallocated block). */
+   if (header_ptr->next != NULL) {
+     header_ptr->next->prev = header_ptr->prev;
+   }
+  
+   /** Remove the deallocated block's pointer to its predecessor. */
+   header_ptr->prev = NULL;
+
+   /** Remove the deallocated block's pointer to its successor. */
+   header_ptr->next = NULL;
+
+  /** Insert the block at the beginning of the linked list of free blocks, i.e.
+   *  make it point to the first free block currently in the list, and set the 
+   *  head of the free list to point at the block we are deallocating. Also,
+   *  since the newly deallocated block is the first one in the list, there
+   *  will be no block before it, so its previous pointer is a null pointer. */
+  header_ptr->next = heap->free_list_head;
+  heap->free_list_head   = header_ptr;
+  header_ptr->prev = NULL;
+
+  /** If the next block is not null, then we must ensure its previous pointer
+   *  will point to the block we are deallocating. */
+  if (header_ptr->next != NULL) {
+    header_ptr->next->prev = header_ptr;
+  }
+
+  /** We are done, so mark the block as officially deallocated. */
+  header_ptr->allocated = false;
+
+} // gc_free ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find a region chunk with room for a block, adding a new chunk below the
+ * current one if the current one is full.
+ *
+ * \param span The space needed, header included.
+ * \return The chunk, if successful; `NULL` if the heap is full.
+ */
+region_chunk_s* region_chunk_with_room (size_t span) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  // Try the current chunk, if there is one.
+  region_chunk_s* chunk = (region_chunk_s*)heap->region_floor;
+  if (heap->region_floor < heap->end_addr &&
+      HEADER_POSITION(chunk->cursor) + (intptr_t)span <= heap->region_floor + (intptr_t)chunk->size) {
+    return chunk;
+  }
+
+  // Add a chunk below the current one, big enough for the block.
+  size_t needed     = sizeof(region_chunk_s) + DBL_WORD_SIZE + span;
+  size_t chunk_size = REGION_CHUNK_SIZE;
+  if (chunk_size < needed) {
+    chunk_size = PAGE_ROUND_UP(needed);
+  }
+  if (heap->region_floor - (intptr_t)chunk_size < heap->free_addr) {
+    return NULL;
+  }
+  heap->region_floor       -= chunk_size;
+  heap->buffer.region_start = heap->region_floor;
+  chunk         = (region_chunk_s*)heap->region_floor;
+  chunk->size   = chunk_size;
+  chunk->cursor = heap->region_floor + sizeof(region_chunk_s);
+
+  return chunk;
+  
+} // region_chunk_with_room ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes from the open region by pointer bumping within its
+ * current chunk, carving a new chunk downward from the top of the heap when
+ * the current one is full.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* region_malloc (size_t size) {
+
+  if (size == 0) {
+    return NULL;
+  }
+  alloc_buffer_retire();
+
+  // Use the current chunk if the block fits, or else a new one.
+  region_chunk_s* chunk = region_chunk_with_room(sizeof(header_s) + size);
+  if (chunk == NULL) {
+    return NULL;
+  }
+  intptr_t header = HEADER_POSITION(chunk->cursor);
+
+  // Bump past the new block.  Region blocks are on neither list.
+  header_s* header_ptr   = (header_s*)header;
+  header_ptr->next       = NULL;
+  header_ptr->prev       = NULL;
+  header_ptr->size       = size;
+  header_ptr->allocated  = true;
+  header_ptr->marked     = 0;
+  header_ptr->space      = SPACE_REGION;
+  header_ptr->visited    = false;
+  header_ptr->remembered = false;
+  chunk->cursor          = (intptr_t)HEADER_TO_BLOCK(header_ptr) + size;
+
+  return HEADER_TO_BLOCK(header_ptr);
+  
+} // region_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Open a region.  Until it is closed by `gc_region_end()`, objects (other than
+ * those with finalizers) are allocated by pointer bumping into region chunks,
+ * rather than from the free list.
+ */
+void gc_region_begin () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  gc_init();
+  if (heap->region_active) {
+    ERROR("gc_region_begin(): Regions do not nest");
+  }
+  alloc_buffer_retire();
+  heap->region_active       = true;
+  heap->buffer.space        = SPACE_REGION;
+  heap->buffer.region_start = heap->region_floor;
+  heap->buffer.region_end   = heap->end_addr;
+
+  if (gc_recording) {
+    record_region(true);
+  }
+  
+} // gc_region_begin ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Note that an object outside the open region now points into it, so that
+ * `gc_region_end()` will promote what it points to.
+ *
+ * \param obj The object.
+ */
+void gc_region_remember (void* obj) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (!heap->region_active || !heap_contains(heap, obj) || region_contains(heap, obj)) {
+    return;
+  }
+  header_s* header = BLOCK_TO_HEADER(obj);
+  if (!header->remembered) {
+    header->remembered = true;
+    link_push(&heap->region_remembered, obj);
+  }
+
+} // gc_region_remember ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * During a collection while a region is open, remember a traced object outside
+ * the region if any of its pointers lead into the region, since that pointer
+ * may not have been stored by `gc_store()`.
+ *
+ * \param obj    The object, outside the region.
+ * \param layout Its layout.
+ */
+void region_remember_escapes (void* obj, const gc_layout_s* layout) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  for (unsigned int i = 0; i < layout->num_ptrs; i += 1) {
+    if (region_contains(heap, field_load(heap, obj, layout->ptr_offsets[i]))) {
+      gc_region_remember(obj);
+      return;
+    }
+  }
+
+} // region_remember_escapes ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * After a collection's marking, forget the remembered objects that were not
+ * marked, which are about to be freed.
+ */
+void region_remembered_prune () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  ptr_link_s** link = &heap->region_remembered;
+  while (*link != NULL) {
+    if (IS_MARKED(heap, BLOCK_TO_HEADER((*link)->ptr))) {
+      link = &(*link)->next;
+    } else {
+      BLOCK_TO_HEADER(link_pop(link))->remembered = false;
+    }
+  }
+
+} // region_remembered_prune ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Copy a region object into the heap, if it has not already been, and update
+ * a pointer to it.  A copy is pushed to have its own pointers handled in turn.
+ * Pointers to anything other than region objects are left alone; the heap is
+ * not traversed.
+ *
+ * \param handle The location of the pointer.
+ * \param ev     The state of the promotion.
+ */
+void region_evacuate (void** handle, evacuation_s* ev) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  void* ptr = *handle;
+  if (!region_contains(heap, ptr)) {
+    return;
+  }
+  header_s* header = BLOCK_TO_HEADER(ptr);
+
+  // A region object is copied the first time, and forwarded thereafter.  Its
+  // unused `next` field holds the forwarding address.
+  if (header->next == NULL) {
+    void* copy = gc_malloc(header->size);
+    if (copy == NULL) {
+      ERROR("gc_region_end(): Could not promote object", (intptr_t)ptr);
+    }
+    memcpy(copy, ptr, header->size);
+    header_s* copy_header = BLOCK_TO_HEADER(copy);
+    copy_header->layout   = header->layout;
+    copy_header->kind     = header->kind;
+    header->next          = copy_header;
+    ev->promoted         += 1;
+    link_push(&ev->scan, copy);
+    if (gc_recording || record_move_hook != NULL) {
+      record_move(ptr, copy);
+    }
+  }
+  *handle = HEADER_TO_BLOCK(header->next);
+  
+} // region_evacuate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Close the open region, releasing all of its objects at once.  Region objects
+ * reachable, through other region objects, from the root set or from the
+ * remembered objects outside the region have _escaped_, and so are first
+ * promoted into the heap, with the pointers to them updated.  Only the root
+ * set, the remembered objects and the promoted objects are scanned, and so the
+ * cost is proportional to them, not to the heap.
+ *
+ * \return The number of objects promoted.
+ */
+size_t gc_region_end () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (!heap->region_active) {
+    ERROR("gc_region_end(): No region is open");
+  }
+  alloc_buffer_retire();
+
+  if (gc_recording) {
+    record_region(false);
+  }
+
+  // Gather the objects from which escaping pointers may be reached:  the roots
+  // in the region, and the heap objects among the roots and remembered.
+  evacuation_s ev   = { NULL, 0 };
+  ptr_link_s*  weak = NULL;
+  for (ptr_link_s* link = heap->root_set_head; link != NULL; link = link->next) {
+    if (region_contains(heap, link->ptr)) {
+      region_evacuate(&link->ptr, &ev);
+    } else if (heap_contains(heap, link->ptr)) {
+      link_push(&ev.scan, link->ptr);
+    }
+  }
+  while (heap->region_remembered != NULL) {
+    void* ptr = link_pop(&heap->region_remembered);
+    BLOCK_TO_HEADER(ptr)->remembered = false;
+    link_push(&ev.scan, ptr);
+  }
+
+  // Handle the pointers of each object reached.  Ephemerons are treated as
+  // strong here; weak references are revisited once all else is promoted.
+  while (ev.scan != NULL) {
+
+    void*     ptr    = link_pop(&ev.scan);
+    header_s* header = BLOCK_TO_HEADER(ptr);
+    if (header->kind == KIND_WEAK) {
+      link_push(&weak, ptr);
+    } else if (header->kind == KIND_EPHEMERON) {
+      gc_ephemeron_table_t* table = ptr;
+      for (size_t i = 0; i < table->capacity; i += 1) {
+	ephemeron_entry_s* entry = &table->entries[i];
+	if (entry->key != NULL && entry->key != TOMBSTONE) {
+	  region_evacuate(&entry->key,   &ev);
+	  region_evacuate(&entry->value, &ev);
+	}
+      }
+    } else {
+      const gc_layout_s* layout = header->layout;
+      for (unsigned int i = 0; i < layout->num_ptrs; i += 1) {
+	void* field = field_load(heap, ptr, layout->ptr_offsets[i]);
+	if (region_contains(heap, field)) {
+	  region_evacuate(&field, &ev);
+	  field_store(heap, ptr, layout->ptr_offsets[i], field);
+	}
+      }
+    }
+
+  }
+
+  // Weak references into the region follow their targets if promoted, and are
+  // cleared otherwise.
+  while (weak != NULL) {
+    gc_weak_ref_t* ref = link_pop(&weak);
+    if (region_contains(heap, ref->target)) {
+      header_s* target = BLOCK_TO_HEADER(ref->target);
+      ref->target = target->next == NULL ? NULL : HEADER_TO_BLOCK(target->next);
+    }
+  }
+
+  // Release every chunk but the topmost, which is kept for the next region.
+  // The objects left in them are gone.
+  if (gc_recording) {
+    record_forget_range((void*)heap->region_floor, (void*)heap->end_addr);
+  }
+  intptr_t top_chunk = heap->end_addr - REGION_CHUNK_SIZE;
+  if (heap->region_floor < top_chunk) {
+    madvise((void*)heap->region_floor, top_chunk - heap->region_floor, MADV_DONTNEED);
+  }
+  heap->region_floor        = heap->end_addr;
+  heap->region_active       = false;
+  heap->buffer.space        = heap->object_space;
+  heap->buffer.region_start = 0;
+  heap->buffer.region_end   = 0;
+
+  return ev.promoted;
+  
+} // gc_region_end ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Carve a new Immix block from the bump frontier, aligned to its size.  The
+ * space skipped to align it becomes a free block, unless there is too little
+ * of it for a header, in which case the block goes one further on.
+ *
+ * \return The block, if successful; `NULL` if the heap is full.
+ */
+immix_block_s* immix_block_new () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  intptr_t header = HEADER_POSITION(heap->free_addr);
+  intptr_t start  = ((heap->free_addr + IMMIX_BLOCK_SIZE - 1) &
+		     ~(intptr_t)(IMMIX_BLOCK_SIZE - 1));
+  intptr_t gap    = start + offsetof(immix_block_s, header) - header;
+  if (gap > 0 && gap < (intptr_t)sizeof(header_s) + DBL_WORD_SIZE) {
+    start += IMMIX_BLOCK_SIZE;
+    gap   += IMMIX_BLOCK_SIZE;
+  }
+  if (start + (intptr_t)IMMIX_BLOCK_SIZE > heap->region_floor) {
+    return NULL;
+  }
+  if (gap > 0) {
+    header_s* gap_ptr = (header_s*)header;
+    gap_ptr->size     = gap - sizeof(header_s);
+    gap_ptr->marked   = 0;
+    gap_ptr->space    = SPACE_HEAP;
+    free_list_insert(gap_ptr);
+  }
+  heap->free_addr = start + IMMIX_BLOCK_SIZE;
+
+  // Cover the block with a header, so that walks of the heap step over it.
+  immix_block_s* block    = (immix_block_s*)start;
+  block->next             = NULL;
+  block->header.next      = NULL;
+  block->header.prev      = NULL;
+  block->header.size      = (IMMIX_BLOCK_SIZE - offsetof(immix_block_s, header) -
+			     sizeof(header_s));
+  block->header.allocated  = true;
+  block->header.marked     = 0;
+  block->header.kind       = KIND_BLOCK;
+  block->header.space      = SPACE_IMMIX;
+  block->header.visited    = false;
+  block->header.remembered = false;
+  block->header.layout     = NULL;
+  block->free_lines        = IMMIX_LINES - IMMIX_FIRST_LINE;
+  memset(block->line_marks, 0, IMMIX_LINES);
+
+  if (heap->block_list_tail == NULL) {
+    heap->block_list_head = block;
+  } else {
+    heap->block_list_tail->next = block;
+  }
+  heap->block_list_tail = block;
+
+  return block;
+
+} // immix_block_new ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the next hole, from a given position, with room for at least `span`
+ * bytes, carving new blocks once past the last one.  The hole's lines are
+ * claimed, so that no other search finds it before the next collection.
+ *
+ * \param scan  Where to start searching; advanced past the hole.
+ * \param span  The space needed, header included.
+ * \param start Set to the position of the hole's first header.
+ * \param end   Set to the end of the hole.
+ * \return `true` if successful; `false` if the heap is full.
+ */
+bool immix_find_hole (immix_scan_s* scan, size_t span, intptr_t* start, intptr_t* end) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  while (true) {
+
+    if (scan->block == NULL) {
+      scan->block = immix_block_new();
+      scan->line  = IMMIX_FIRST_LINE;
+      if (scan->block == NULL) {
+	return false;
+      }
+    }
+
+    // A hole is a run of lines marked in neither the last collection nor
+    // since; its first object's header goes just past the start of its line.
+    immix_block_s* block = scan->block;
+    while (scan->line < IMMIX_LINES) {
+      size_t first = scan->line;
+      while (first < IMMIX_LINES && block->line_marks[first] == heap->line_epoch) {
+	first += 1;
+      }
+      size_t last = first;
+      while (last < IMMIX_LINES && block->line_marks[last] != heap->line_epoch) {
+	last += 1;
+      }
+      scan->line = last;
+      if (last > first) {
+	*start = HEADER_POSITION((intptr_t)block + first * IMMIX_LINE_SIZE);
+	*end   = (intptr_t)block + last * IMMIX_LINE_SIZE;
+	if (*end - *start >= (intptr_t)span) {
+	  memset(&block->line_marks[first], heap->line_epoch, last - first);
+	  return true;
+	}
+      }
+    }
+
+    scan->block = block->next;
+    scan->line  = IMMIX_FIRST_LINE;
+
+  }
+
+} // immix_find_hole ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate space for a medium-sized object, one spanning more than a line,
+ * that does not fit in the rest of the allocation buffer.  Rather than give
+ * up that buffer, which is likely to have room for many more small objects,
+ * use a second hole, kept for objects like this one.
+ *
+ * \param span The space needed, header included.
+ * \return The position of the object's header, if successful; `0` if the
+ *         heap is full.
+ */
+intptr_t immix_overflow_alloc (size_t span) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (heap->overflow_cursor + (intptr_t)span > heap->overflow_limit &&
+      !immix_find_hole(&heap->overflow_scan, span, &heap->overflow_cursor, &heap->overflow_limit)) {
+    heap->overflow_cursor = 0;
+    heap->overflow_limit  = 0;
+    return 0;
+  }
+  intptr_t header = heap->overflow_cursor;
+  heap->overflow_cursor += span;
+
+  return header;
+
+} // immix_overflow_alloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Mark the lines spanned by a marked Immix object.
+ *
+ * \param header_ptr The header of the object.
+ */
+void immix_mark_lines (header_s* header_ptr) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  immix_block_s* block = IMMIX_BLOCK_OF(header_ptr);
+  intptr_t       start = (intptr_t)header_ptr - (intptr_t)block;
+  intptr_t       end   = start + sizeof(header_s) + header_ptr->size - 1;
+  for (intptr_t line = start / IMMIX_LINE_SIZE; line <= end / IMMIX_LINE_SIZE; line += 1) {
+    block->line_marks[line] = heap->mark_epoch;
+  }
+
+} // immix_mark_lines ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Determine whether an object survived the current collection, as far as the
+ * Immix sweep is concerned:  objects other than the heap's Immix objects are
+ * not its to sweep, and so count as live.
+ *
+ * \param ptr The object.
+ * \return `true` if the object is marked or not an Immix object of the heap;
+ *         `false`, otherwise.
+ */
+bool immix_object_is_live (void* ptr) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  return (!heap_contains(heap, ptr) ||
+	  BLOCK_TO_HEADER(ptr)->space != SPACE_IMMIX ||
+	  IS_MARKED(heap, BLOCK_TO_HEADER(ptr)));
+
+} // immix_object_is_live ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Sweep the Immix blocks:  each line not marked by this collection is free,
+ * and its mark is cleared, so that no stale epoch can later be mistaken for a
+ * current one.  Allocation then starts again from the first block.  The dead
+ * objects on those lines are freed with them, and so are forgotten by the
+ * recorder here.
+ *
+ * \return The number of bytes freed:  those of the lines in use before the
+ *         collection that no longer are.
+ */
+size_t immix_sweep () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (gc_recording && heap->block_list_head != NULL) {
+    record_forget_dead(immix_object_is_live);
+  }
+
+  size_t freed_lines = 0;
+  for (immix_block_s* block = heap->block_list_head; block != NULL; block = block->next) {
+
+    size_t free_lines = 0;
+    for (size_t line = IMMIX_FIRST_LINE; line < IMMIX_LINES; line += 1) {
+      unsigned char mark = block->line_marks[line];
+      if (mark != heap->mark_epoch) {
+	freed_lines            += mark == heap->line_epoch;
+	free_lines             += 1;
+	block->line_marks[line] = 0;
+      }
+    }
+    block->free_lines  = free_lines;
+    heap->live_bytes  += (IMMIX_LINES - IMMIX_FIRST_LINE - free_lines) * IMMIX_LINE_SIZE;
+
+  }
+
+  heap->line_epoch      = heap->mark_epoch;
+  heap->buffer_scan     = (immix_scan_s){ heap->block_list_head, IMMIX_FIRST_LINE };
+  heap->overflow_scan   = heap->buffer_scan;
+  heap->overflow_cursor = 0;
+  heap->overflow_limit  = 0;
+
+  return freed_lines * IMMIX_LINE_SIZE;
+
+} // immix_sweep ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Replace the allocation buffer with one that has room for at least `span`
+ * bytes.  In a region, the buffer is the rest of the current chunk (or a new
+ * one).  In an Immix heap, it is the next hole large enough.  Otherwise, it is
+ * the best-fitting free block, if there is one, or else a fresh run of space
+ * carved from the bump frontier.
+ *
+ * \param span The space needed, header included.
+ * \return `true` if successful; `false` if no such space is available.
+ */
+bool alloc_buffer_refill (size_t span) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  alloc_buffer_retire();
+
+  if (heap->buffer.space == SPACE_REGION) {
+
+    region_chunk_s* chunk = region_chunk_with_room(span);
+    if (chunk == NULL) {
+      return false;
+    }
+    heap->buffer_start = HEADER_POSITION(chunk->cursor);
+    heap->buffer_end   = heap->region_floor + chunk->size;
+
+  } else if (heap->buffer.space == SPACE_IMMIX) {
+
+    if (!immix_find_hole(&heap->buffer_scan, span, &heap->buffer_start, &heap->buffer_end)) {
+      heap->buffer_start = 0;
+      heap->buffer_end   = 0;
+      return false;
+    }
+
+  } else {
+
+    // Look for the best-fitting free block.
+    header_s* best = NULL;
+    for (header_s* current = heap->free_list_head; current != NULL; current = current->next) {
+      if (sizeof(header_s) + current->size >= span &&
+	  (best == NULL || current->size < best->size)) {
+	best = current;
+	if (sizeof(header_s) + best->size == span) {
+	  break;
+	}
+      }
+    }
+
+    if (best != NULL) {
+
+      free_list_remove(best);
+      heap->buffer_start = (intptr_t)best;
+      heap->buffer_end   = (intptr_t)HEADER_TO_BLOCK(best) + best->size;
+
+    } else {
+
+      intptr_t start = HEADER_POSITION(heap->free_addr);
+      intptr_t end   = start + BUFFER_SIZE;
+      if (end > heap->region_floor) {
+	end = heap->region_floor;
+      }
+      if (end - start < (intptr_t)span) {
+	return false;
+      }
+      heap->buffer_start = start;
+      heap->buffer_end   = end;
+      heap->free_addr    = end;
+
+    }
+
+  }
+
+  heap->buffer.cursor = heap->buffer_start;
+  heap->buffer.limit  = heap->buffer_end;
+
+  return true;
+  
+} // alloc_buffer_refill ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate heap space for the structure defined by the given `layout`, when
+ * `gc_new()` cannot do so from the allocation buffer:  because the buffer is
+ * exhausted, the object is large or has a finalizer, or every allocation must
+ * be seen here (as when profiling).
+ *
+ * \param layout A descriptor of the fields
+ * \param site   The return address into the code that called the allocator,
+ *               for the profiler.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* gc_new_slow (const gc_layout_s* layout, void* site) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  gc_init();
+
+  // Small objects without finalizers come from the allocation buffer, which is
+  // refilled if need be.  In an Immix heap, medium-sized objects that do not
+  // fit in the buffer come from the overflow hole instead.
+  void*    block_ptr = NULL;
+  size_t   span      = GC_BLOCK_SPAN(layout->size);
+  intptr_t header    = 0;
+  if (layout->finalizer == NULL && layout->size > 0 && span <= BUFFER_MAX_SPAN) {
+    if (heap->buffer.cursor + (intptr_t)span <= heap->buffer_end) {
+      header               = heap->buffer.cursor;
+      heap->buffer.cursor += span;
+    } else if (heap->buffer.space == SPACE_IMMIX && span > IMMIX_LINE_SIZE) {
+      header = immix_overflow_alloc(span);
+    } else if (alloc_buffer_refill(span)) {
+      header               = heap->buffer.cursor;
+      heap->buffer.cursor += span;
+    }
+  }
+
+  if (header != 0) {
+
+    header_s* header_ptr   = (header_s*)header;
+    header_ptr->size       = span - sizeof(header_s);
+    header_ptr->allocated  = true;
+    header_ptr->marked     = 0;
+    header_ptr->kind       = KIND_OBJECT;
+    header_ptr->space      = heap->buffer.space;
+    header_ptr->visited    = false;
+    header_ptr->remembered = false;
+    header_ptr->layout     = layout;
+    block_ptr              = HEADER_TO_BLOCK(header_ptr);
+
+  } else {
+
+    // Otherwise, get a block large enough for the requested layout, from the
+    // open region if there is one.  Objects with finalizers cannot die with a
+    // region, and so always come from the heap.
+    block_ptr = (heap->region_active && layout->finalizer == NULL
+		 ? region_malloc(layout->size)
+		 : gc_malloc(layout->size));
+    if (block_ptr == NULL) {
+      return NULL;
+    }
+    header_s* header_ptr = BLOCK_TO_HEADER(block_ptr);
+
+    // Hold onto the layout for later, when a collection occurs.
+    header_ptr->layout = layout;
+    header_ptr->kind   = KIND_OBJECT;
+
+  }
+
+  // Track objects that will need finalizing once unreachable.
+  if (layout->finalizer != NULL) {
+    link_push(&heap->finalizable_list_head, block_ptr);
+  }
+
+  // Sample the allocation, if profiling and its turn has come.  Region objects
+  // die without being swept, and so are not tracked.
+  if (profile_enabled) {
+    profile_countdown -= layout->size;
+    if (profile_countdown <= 0) {
+      profile_sample(block_ptr, layout, layout->size,
+		     BLOCK_TO_HEADER(block_ptr)->space != SPACE_REGION, site);
+    }
+  }
+
+  if (trace_enabled) {
+    trace_event(TRACE_ALLOC, (uintptr_t)block_ptr, layout->size);
+  }
+
+  // Weak references are recorded by `gc_weak_new()`, along with their targets.
+  if (gc_recording && layout != &weak_layout) {
+    record_new(block_ptr, layout);
+  }
+
+  // Let `gc_new()` use the buffer directly, unless it must not.
+  heap->buffer.limit = profile_enabled || trace_enabled || gc_recording ? 0 : heap->buffer_end;
+  
+  return block_ptr;
+  
+} // gc_new_slow ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate space in a heap for the structure defined by the given `layout`,
+ * when `gc_heap_new()` cannot do so from the allocation buffer.
+ *
+ * \param heap   The heap.
+ * \param layout A descriptor of the fields
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* gc_heap_new_slow (gc_heap_t* heap, const gc_layout_s* layout) {
+
+  gc_heap_t* previous = gc_current_heap;
+  gc_current_heap = heap;
+  void* block_ptr = gc_new_slow(layout, __builtin_return_address(0));
+  gc_current_heap = previous;
+
+  return block_ptr;
+
+} // gc_heap_new_slow ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Shrink a heap block to hold `size` bytes, giving the space beyond them back
+ * to the bump frontier, if the block is at the frontier, or else as a free
+ * block, if there is enough of it to be worth one.
+ *
+ * \param header_ptr The header of the block, which is on the allocated list.
+ * \param size       The new size; no more than its current size.
+ */
+void split_tail (header_s* header_ptr, size_t size) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  intptr_t block = (intptr_t)HEADER_TO_BLOCK(header_ptr);
+  intptr_t end   = block + header_ptr->size;
+  intptr_t tail  = HEADER_POSITION(block + (intptr_t)size);
+
+  if (end <= heap->free_addr && HEADER_POSITION(end) >= heap->free_addr) {
+    heap->free_addr        = block + size;
+    header_ptr->size = size;
+  } else if (end - tail >= MIN_FREE_SPAN) {
+    header_s* tail_ptr = (header_s*)tail;
+    tail_ptr->size     = end - tail - sizeof(header_s);
+    tail_ptr->marked   = 0;
+    tail_ptr->space    = SPACE_HEAP;
+    free_list_insert(tail_ptr);
+    header_ptr->size   = size;
+  }
+
+} // split_tail ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Try to resize a heap object without moving it:  within the allocation
+ * buffer, if it is the buffer's last object; by splitting off its tail, if it
+ * shrinks; or, if it grows, by absorbing the free blocks that follow it and,
+ * if it reaches the bump frontier, by pushing the frontier back.
+ *
+ * \param header_ptr The header of the object, which is in the heap.
+ * \param size       The new size of the object.
+ * \return `true` if the object was resized; `false` if it must be moved.
+ */
+bool resize_in_place (header_s* header_ptr, size_t size) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  intptr_t block = (intptr_t)HEADER_TO_BLOCK(header_ptr);
+  intptr_t end   = block + header_ptr->size;
+  intptr_t want  = block + size;
+
+  // An object in the allocation buffer is not yet on the allocated list.  The
+  // last one can be resized by moving the buffer's cursor; any other is left
+  // alone if it shrinks, and otherwise is first retired with the buffer.
+  if ((intptr_t)header_ptr >= heap->buffer_start && (intptr_t)header_ptr < heap->buffer.cursor) {
+    intptr_t span = GC_BLOCK_SPAN(size);
+    if (end == heap->buffer.cursor && (intptr_t)header_ptr + span <= heap->buffer_end) {
+      heap->buffer.cursor = (intptr_t)header_ptr + span;
+      header_ptr->size       = span - sizeof(header_s);
+      return true;
+    }
+    if (size <= header_ptr->size) {
+      return true;
+    }
+    alloc_buffer_retire();
+    end = block + header_ptr->size;
+  }
+
+  if (size <= header_ptr->size) {
+    split_tail(header_ptr, size);
+    return true;
+  }
+
+  // Find how far the object could grow:  over the free blocks that follow it
+  // (the allocator does not coalesce, so there may be several), and, if those
+  // lead to the bump frontier, on up to the region chunks.
+  intptr_t reach = end;
+  intptr_t next  = HEADER_POSITION(end);
+  while (reach < want) {
+    if (next >= heap->free_addr) {
+      reach = heap->region_floor;
+      break;
+    }
+    header_s* next_ptr = (header_s*)next;
+    if (next == heap->buffer_start || next_ptr->allocated) {
+      break;
+    }
+    reach = (intptr_t)HEADER_TO_BLOCK(next_ptr) + next_ptr->size;
+    next  = HEADER_POSITION(reach);
+  }
+  if (reach < want) {
+    return false;
+  }
+
+  // Absorb those blocks.
+  while (end < want && HEADER_POSITION(end) < heap->free_addr) {
+    header_s* next_ptr = (header_s*)HEADER_POSITION(end);
+    end = (intptr_t)HEADER_TO_BLOCK(next_ptr) + next_ptr->size;
+    free_list_remove(next_ptr);
+  }
+  if (end < want) {
+    heap->free_addr        = want;
+    header_ptr->size = size;
+  } else {
+    header_ptr->size = end - block;
+    split_tail(header_ptr, size);
+  }
+
+  return true;
+  
+} // resize_in_place ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Resize an object to the structure defined by a new layout, keeping its
+ * contents up to the smaller of the two sizes, and zeroing the rest.  A heap
+ * object is resized in place when it can be:  when it shrinks, or when the
+ * space after it is free or is the bump frontier.  Otherwise, the object is
+ * copied into a new one, allocated as by `gc_new()`, and the old one is left
+ * for the collector; a copied object's finalizer then belongs to the copy.
+ *
+ * \param ptr        The object to resize; `NULL` to allocate a new one.
+ * \param new_layout The object's new layout.
+ * \return The resized object, which may have moved, if successful; `NULL`, if
+ *         unsuccessful, in which case the object is unchanged.
+ */
+void* gc_resize (void* ptr, const gc_layout_s* new_layout) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  // A new object is all new fields, and so is zeroed, too.
+  if (ptr == NULL) {
+    void* new_ptr = gc_new(new_layout);
+    if (new_ptr != NULL) {
+      memset(new_ptr, 0, new_layout->size);
+    }
+    return new_ptr;
+  }
+  if (new_layout->size == 0) {
+    return NULL;
+  }
+
+  header_s* header_ptr = BLOCK_TO_HEADER(ptr);
+  if (header_ptr->kind != KIND_OBJECT) {
+    ERROR("gc_resize(): Cannot resize a weak reference or ephemeron table", (intptr_t)ptr);
+  }
+  const gc_layout_s* old_layout = header_ptr->layout;
+  size_t             old_size   = old_layout->size;
+  size_t             new_size   = new_layout->size;
+
+  void* new_ptr = NULL;
+  if (header_ptr->space == SPACE_HEAP && resize_in_place(header_ptr, new_size)) {
+
+    new_ptr            = ptr;
+    header_ptr->layout = new_layout;
+    if (old_layout->finalizer == NULL && new_layout->finalizer != NULL) {
+      link_push(&heap->finalizable_list_head, ptr);
+    }
+
+  } else {
+
+    new_ptr = gc_new(new_layout);
+    if (new_ptr == NULL) {
+      return NULL;
+    }
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+
+  }
+
+  // The old object is no longer to be finalized, unless it still is the object.
+  if (old_layout->finalizer != NULL && (new_ptr != ptr || new_layout->finalizer == NULL)) {
+    link_remove(&heap->finalizable_list_head, ptr);
+  }
+
+  // Clear the new fields, so that any pointers among them are null.
+  if (new_size > old_size) {
+    memset(new_ptr + old_size, 0, new_size - old_size);
+  }
+
+  if (gc_recording) {
+    record_resize(ptr, new_ptr, new_layout, old_size < new_size ? old_size : new_size);
+  }
+
+  return new_ptr;
+
+} // gc_resize ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a weak reference to the given `target`.
+ *
+ * \param target The object to refer to weakly; may be `NULL`.
+ * \return The new weak reference, if successful; `NULL` if unsuccessful.
+ */
+gc_weak_ref_t* gc_weak_new (void* target) {
+
+  gc_weak_ref_t* weak = gc_new(&weak_layout);
+  if (weak == NULL) {
+    return NULL;
+  }
+  BLOCK_TO_HEADER(weak)->kind = KIND_WEAK;
+  weak->target = target;
+
+  if (gc_recording) {
+    record_weak(weak, target);
+  }
+
+  return weak;
+  
+} // gc_weak_new ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Obtain the target of a weak reference.
+ *
+ * \param weak The weak reference.
+ * \return The target, or `NULL` if it has been collected.
+ */
+void* gc_weak_get (gc_weak_ref_t* weak) {
+
+  return weak->target;
+  
+} // gc_weak_get ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate an empty ephemeron table.
+ *
+ * \param capacity The number of entries the table must be able to hold.
+ * \return The new table, if successful; `NULL` if unsuccessful.
+ */
+gc_ephemeron_table_t* gc_ephemeron_table_new (size_t capacity) {
+
+  // Round up to a power of two, leaving at least one slot always empty so
+  // that probing terminates.
+  size_t slots = MIN_EPHEMERON_CAPACITY;
+  while (slots <= capacity) {
+    slots = slots * 2;
+  }
+
+  size_t size = sizeof(gc_ephemeron_table_t) + slots * sizeof(ephemeron_entry_s);
+  gc_ephemeron_table_t* table = gc_malloc(size);
+  if (table == NULL) {
+    return NULL;
+  }
+  header_s* header = BLOCK_TO_HEADER(table);
+  header->layout = &ephemeron_layout;
+  header->kind   = KIND_EPHEMERON;
+
+  table->capacity = slots;
+  table->count    = 0;
+  table->used     = 0;
+  memset(table->entries, 0, slots * sizeof(ephemeron_entry_s));
+
+  if (gc_recording) {
+    record_ephemeron_table(table, capacity);
+  }
+
+  return table;
+  
+} // gc_ephemeron_table_new ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the slot of an ephemeron table in which a key resides or would reside.
+ *
+ * \param table The table to search.
+ * \param key   The key being sought.
+ * \return The slot holding `key`, if present; otherwise, the first reusable
+ *         slot (a tombstone or an empty slot) along its probe sequence.
+ */
+ephemeron_entry_s* ephemeron_find (gc_ephemeron_table_t* table, void* key) {
+
+  // Blocks are double-word aligned, so the low bits carry no information.
+  size_t             mask     = table->capacity - 1;
+  size_t             index    = (((uintptr_t)key >> 4) * 0x9e3779b97f4a7c15ULL) & mask;
+  ephemeron_entry_s* reusable = NULL;
+
+  while (true) {
+    ephemeron_entry_s* entry = &table->entries[index];
+    if (entry->key == key) {
+      return entry;
+    }
+    if (entry->key == NULL) {
+      return reusable != NULL ? reusable : entry;
+    }
+    if (entry->key == TOMBSTONE && reusable == NULL) {
+      reusable = entry;
+    }
+    index = (index + 1) & mask;
+  }
+  
+} // ephemeron_find ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Associate a value with a key in an ephemeron table.  The table holds `key`
+ * weakly, and holds `value` only for as long as `key` is otherwise reachable.
+ *
+ * \param table The table to update.
+ * \param key   The key, which must be a heap object.
+ * \param value The value, which may be `NULL`.
+ * \return `true` if successful; `false` if the table is full.
+ */
+bool gc_ephemeron_table_put (gc_ephemeron_table_t* table, void* key, void* value) {
+
+  assert(key != NULL && key != TOMBSTONE);
+
+  ephemeron_entry_s* entry = ephemeron_find(table, key);
+  if (entry->key != key) {
+
+    // Claiming an empty slot must still leave one empty for probing.
+    if (entry->key == NULL) {
+      if (table->used + 1 >= table->capacity) {
+	return false;
+      }
+      table->used += 1;
+    }
+    entry->key    = key;
+    table->count += 1;
+
+  }
+  entry->value = value;
+
+  // A table outside an open region that now points into it must be
+  // remembered, as by `gc_store()`.
+  gc_region_barrier(table, key);
+  gc_region_barrier(table, value);
+
+  if (gc_recording) {
+    record_ephemeron_put(table, key, value);
+  }
+
+  return true;
+  
+} // gc_ephemeron_table_put ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Re-insert every entry of an ephemeron table, as needed once its keys have
+ * moved, dropping its tombstones along the way.
+ *
+ * \param table The table to rehash.
+ */
+void ephemeron_rehash (gc_ephemeron_table_t* table) {
+
+  size_t             bytes   = table->capacity * sizeof(ephemeron_entry_s);
+  ephemeron_entry_s* entries = malloc(bytes);
+  if (entries == NULL) {
+    ERROR("ephemeron_rehash(): Failed to allocate entries");
+  }
+  memcpy(entries, table->entries, bytes);
+  memset(table->entries, 0, bytes);
+
+  table->used = 0;
+  for (size_t i = 0; i < table->capacity; i += 1) {
+    if (entries[i].key != NULL && entries[i].key != TOMBSTONE) {
+      *ephemeron_find(table, entries[i].key) = entries[i];
+      table->used += 1;
+    }
+  }
+  free(entries);
+  
+} // ephemeron_rehash ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Look up the value associated with a key in an ephemeron table.
+ *
+ * \param table The table to search.
+ * \param key   The key being sought.
+ * \return The associated value, if present; `NULL`, otherwise.
+ */
+void* gc_ephemeron_table_get (gc_ephemeron_table_t* table, void* key) {
+
+  ephemeron_entry_s* entry = ephemeron_find(table, key);
+
+  return entry->key == key ? entry->value : NULL;
+  
+} // gc_ephemeron_table_get ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Remove a key, and its value, from an ephemeron table.
+ *
+ * \param table The table to update.
+ * \param key   The key to remove.
+ * \return `true` if the key was present; `false`, otherwise.
+ */
+bool gc_ephemeron_table_remove (gc_ephemeron_table_t* table, void* key) {
+
+  ephemeron_entry_s* entry = ephemeron_find(table, key);
+  if (entry->key != key) {
+    return false;
+  }
+  entry->key    = TOMBSTONE;
+  entry->value  = NULL;
+  table->count -= 1;
+
+  if (gc_recording) {
+    record_ephemeron_remove(table, key);
+  }
+
+  return true;
+  
+} // gc_ephemeron_table_remove ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Count the entries of an ephemeron table.
+ *
+ * \param table The table.
+ * \return The number of entries whose keys have not been removed or collected.
+ */
+size_t gc_ephemeron_table_count (gc_ephemeron_table_t* table) {
+
+  return table->count;
+  
+} // gc_ephemeron_table_count ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Push a pointer found by a scan onto the root set stack, unless it is `NULL`,
+ * points outside the heap, or points to an object already marked, any of which
+ * `mark()` would only pop and discard.
+ *
+ * \param heap The heap being marked.
+ * \param ptr  The pointer.
+ */
+void mark_scan_push (gc_heap_t* heap, void* ptr) {
+
+  if (heap_contains(heap, ptr) && !IS_MARKED(heap, BLOCK_TO_HEADER(ptr))) {
+    rs_push(ptr);
+  }
+
+} // mark_scan_push ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Scan an object's pointer fields one at a time.
+ *
+ * \param heap     The heap being marked.
+ * \param obj      The object.
+ * \param offsets  The offsets of its pointer fields, as given by its layout.
+ * \param num_ptrs The number of those fields.
+ */
+void mark_scan_scalar (gc_heap_t* heap, void* obj, const size_t* offsets, unsigned int num_ptrs) {
+
+  for (unsigned int i = 0; i < num_ptrs; i += 1) {
+    mark_scan_push(heap, field_load(heap, obj, offsets[i]));
+  }
+
+} // mark_scan_scalar ()
+// ==============================================================================
+
+
+
+#if defined (__x86_64__)
+// ==============================================================================
+/**
+ * Scan an object's pointer fields two at a time with SSE2, wherever two
+ * consecutive offsets name adjacent, uncompressed pointers (as in an array or
+ * hash table), so that both are loaded at once and a pair of `NULL`s, as in a
+ * sparse table, is skipped at once.  SSE2 has no 64-bit comparisons, so the
+ * rest are range-checked one at a time.
+ *
+ * \param heap     The heap being marked.
+ * \param obj      The object.
+ * \param offsets  The offsets of its pointer fields, as given by its layout.
+ * \param num_ptrs The number of those fields.
+ */
+void mark_scan_sse2 (gc_heap_t* heap, void* obj, const size_t* offsets, unsigned int num_ptrs) {
+
+  const __m128i stride = _mm_set_epi64x(8, 0);
+  const __m128i zero   = _mm_setzero_si128();
+
+  unsigned int i = 0;
+  while (i + 2 <= num_ptrs) {
+
+    __m128i expected = _mm_add_epi64(_mm_set1_epi64x(offsets[i]), stride);
+    __m128i actual   = _mm_loadu_si128((const __m128i*)&offsets[i]);
+    if ((offsets[i] & GC_COMPRESSED_REF) ||
+	_mm_movemask_epi8(_mm_cmpeq_epi32(expected, actual)) != 0xffff) {
+      mark_scan_push(heap, field_load(heap, obj, offsets[i]));
+      i += 1;
+      continue;
+    }
+
+    // A pointer is `NULL` when all eight of its bytes are.
+    void**  fields = (void**)(obj + offsets[i]);
+    __m128i ptrs   = _mm_loadu_si128((const __m128i*)fields);
+    int     nulls  = _mm_movemask_epi8(_mm_cmpeq_epi8(ptrs, zero));
+    if ((nulls & 0x00ff) != 0x00ff) {
+      mark_scan_push(heap, fields[0]);
+    }
+    if ((nulls & 0xff00) != 0xff00) {
+      mark_scan_push(heap, fields[1]);
+    }
+    i += 2;
+
+  }
+  mark_scan_scalar(heap, obj, offsets + i, num_ptrs - i);
+
+} // mark_scan_sse2 ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Scan an object's pointer fields four at a time with AVX2, wherever four
+ * consecutive offsets name adjacent, uncompressed pointers, range-checking all
+ * four against the heap at once, so that `NULL`s and pointers elsewhere are
+ * never looked at individually.
+ *
+ * \param heap     The heap being marked.
+ * \param obj      The object.
+ * \param offsets  The offsets of its pointer fields, as given by its layout.
+ * \param num_ptrs The number of those fields.
+ */
+__attribute__((target("avx2")))
+void mark_scan_avx2 (gc_heap_t* heap, void* obj, const size_t* offsets, unsigned int num_ptrs) {
+
+  // AVX2 compares only signed 64-bit integers, so flip the sign bit of each
+  // address to compare them as unsigned.
+  const __m256i stride = _mm256_set_epi64x(24, 16, 8, 0);
+  const __m256i sign   = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i low    = _mm256_set1_epi64x(heap->start_addr ^ INT64_MIN);
+  const __m256i high   = _mm256_set1_epi64x(heap->end_addr ^ INT64_MIN);
+
+  unsigned int i = 0;
+  while (i + 4 <= num_ptrs) {
+
+    __m256i expected = _mm256_add_epi64(_mm256_set1_epi64x(offsets[i]), stride);
+    __m256i actual   = _mm256_loadu_si256((const __m256i*)&offsets[i]);
+    if ((offsets[i] & GC_COMPRESSED_REF) ||
+	_mm256_movemask_epi8(_mm256_cmpeq_epi64(expected, actual)) != -1) {
+      mark_scan_push(heap, field_load(heap, obj, offsets[i]));
+      i += 1;
+      continue;
+    }
+
+    // Keep the pointers strictly between the heap's bounds, as
+    // `heap_contains()` does; `NULL` is never among them.
+    void**  fields  = (void**)(obj + offsets[i]);
+    __m256i ptrs    = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)fields), sign);
+    __m256i inside  = _mm256_and_si256(_mm256_cmpgt_epi64(ptrs, low),
+				       _mm256_cmpgt_epi64(high, ptrs));
+    int     matches = _mm256_movemask_pd(_mm256_castsi256_pd(inside));
+    while (matches != 0) {
+      int lane = __builtin_ctz(matches);
+      matches &= matches - 1;
+      if (!IS_MARKED(heap, BLOCK_TO_HEADER(fields[lane]))) {
+	rs_push(fields[lane]);
+      }
+    }
+    i += 4;
+
+  }
+  mark_scan_scalar(heap, obj, offsets + i, num_ptrs - i);
+
+} // mark_scan_avx2 ()
+// ==============================================================================
+#endif // __x86_64__
+
+
+
+// ==============================================================================
+/**
+ * Choose the scan of pointer fields for `mark()` to use:  the widest that this
+ * CPU supports, or one at a time if it is not an x86-64 CPU.
+ */
+void mark_scan_select () {
+
+#if defined (__x86_64__)
+  __builtin_cpu_init();
+  mark_scan = __builtin_cpu_supports("avx2") ? mark_scan_avx2 : mark_scan_sse2;
+#else
+  mark_scan = mark_scan_scalar;
+#endif
+
+} // mark_scan_select ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Traverse the heap, marking all live objects.  Weak references and ephemeron
+ * tables are marked but not traced; they are set aside on `weak_list_head` and
+ * `ephemeron_list_head` for `mark_ephemerons()` and `clear_weak()`.
+ */
+void mark () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (mark_scan == NULL) {
+    mark_scan_select();
+  }
+
+  // WRITE ME.
+  //
+  //   Adapt the pseudocode from class for a copying collector to real code here
+  //   for a non-copying collector.  Do the traversal, using the linked stack of
+  //   pointers that starts at `root_set_head`, setting the `marked` field on
+  //   each object you reach.
+  
+  /** We begin our depth-first search at the begining of our root set, and keep
+   *  going until we ecounter a null pointer. */
+  while (heap->root_set_head != NULL) {
+
+    /** Get the curret pointer. */
+    void* current_ptr = rs_pop();
+
+    /** If the curret pointer actually points to something in this heap, then
+     *  mark that place and add all its pointers to the stack for searching.
+     *  Pointers into other heaps are not followed. */
+    if (heap_contains(heap, current_ptr)) {
+
+      header_s* header = BLOCK_TO_HEADER(current_ptr);
+
+      /** An object already marked has already been traced, too. */
+      if (IS_MARKED(heap, header)) {
+        continue;
+      }
+      header->marked = heap->mark_epoch;
+
+      /** An Immix object keeps its lines from being reused. */
+      if (header->space == SPACE_IMMIX) {
+        immix_mark_lines(header);
+      }
+
+      /** Count the object in the profiler's census. */
+      if (profile_enabled) {
+        profile_census_add(header->layout, header->size);
+      }
+
+      /** Weak references and ephemeron tables are traced after the fact. */
+      if (header->kind == KIND_WEAK) {
+        link_push(&heap->weak_list_head, current_ptr);
+        continue;
+      }
+      if (header->kind == KIND_EPHEMERON) {
+        link_push(&heap->ephemeron_list_head, current_ptr);
+        continue;
+      }
+
+      /** Where can we travel from here? */
+      const gc_layout_s* current_layout = header->layout;
+
+      /** Add those places to our list, to be searched later.  Only pointers
+       *  to objects of this heap not yet marked are worth adding. */
+      if (current_layout->num_ptrs >= MARK_SCAN_WIDE) {
+        mark_scan(heap, current_ptr, current_layout->ptr_offsets, current_layout->num_ptrs);
+      } else {
+        mark_scan_scalar(heap, current_ptr, current_layout->ptr_offsets, current_layout->num_ptrs);
+      }
+
+      /** While a region is open, note which objects outside it point in. */
+      if (heap->region_active && header->space != SPACE_REGION) {
+        region_remember_escapes(current_ptr, current_layout);
+      }
+
+    }
+
+  }  
+
+} // mark ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Determine whether an object has been marked.  Objects in other heaps are not
+ * being collected, and so count as marked.
+ *
+ * \param ptr The object.
+ * \return `true` if the object is marked or in another heap; `false`, otherwise.
+ */
+bool block_is_marked (void* ptr) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  return !heap_contains(heap, ptr) || IS_MARKED(heap, BLOCK_TO_HEADER(ptr));
+  
+} // block_is_marked ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Trace the values of every ephemeron table reached by `mark()` whose keys
+ * have been marked.  Since tracing those values may mark further keys (or reach
+ * further tables), repeat until no new values are found.
+ */
+void mark_ephemerons () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  bool progress = true;
+  while (progress) {
+
+    progress = false;
+    for (ptr_link_s* link = heap->ephemeron_list_head; link != NULL; link = link->next) {
+
+      gc_ephemeron_table_t* table = link->ptr;
+      for (size_t i = 0; i < table->capacity; i += 1) {
+
+	ephemeron_entry_s* entry = &table->entries[i];
+	if (entry->key == NULL || entry->key == TOMBSTONE || entry->value == NULL) {
+	  continue;
+	}
+	if (block_is_marked(entry->key) && !block_is_marked(entry->value)) {
+	  rs_push(entry->value);
+	  progress = true;
+	}
+
+      }
+
+    }
+
+    // Trace whatever was newly found; this may add to `ephemeron_list_head`.
+    mark();
+
+  }
+  
+} // mark_ephemerons ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Clear each weak reference, and remove each ephemeron, whose target or key was
+ * not marked.  This must happen before `sweep()` frees those objects.
+ */
+void clear_weak () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  while (heap->weak_list_head != NULL) {
+    gc_weak_ref_t* weak = link_pop(&heap->weak_list_head);
+    if (weak->target != NULL && !block_is_marked(weak->target)) {
+      weak->target = NULL;
+    }
+  }
+
+  while (heap->ephemeron_list_head != NULL) {
+    gc_ephemeron_table_t* table = link_pop(&heap->ephemeron_list_head);
+    for (size_t i = 0; i < table->capacity; i += 1) {
+      ephemeron_entry_s* entry = &table->entries[i];
+      if (entry->key == NULL || entry->key == TOMBSTONE) {
+	continue;
+      }
+      if (!block_is_marked(entry->key)) {
+	entry->key    = TOMBSTONE;
+	entry->value  = NULL;
+	table->count -= 1;
+      }
+    }
+  }
+  
+} // clear_weak ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Add the objects awaiting, or undergoing, finalization to the root set.  They
+ * must survive until their finalizers have run.
+ */
+void mark_finalize_queue () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  pthread_mutex_lock(&heap->finalize_lock);
+  for (ptr_link_s* link = heap->finalize_queue_head; link != NULL; link = link->next) {
+    rs_push(link->ptr);
+  }
+  for (ptr_link_s* batch = heap->finalizing_list_head; batch != NULL; batch = batch->next) {
+    for (ptr_link_s* link = batch->ptr; link != NULL; link = link->next) {
+      rs_push(link->ptr);
+    }
+  }
+  pthread_mutex_unlock(&heap->finalize_lock);
+  
+} // mark_finalize_queue ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Move each unmarked, finalizable object from `finalizable_list_head` to the
+ * finalization queue, _resurrecting_ it (and everything it reaches) so that
+ * its finalizer may safely use it.  Each object is queued only once; after
+ * its finalizer runs, it is collected like any other once unreachable.
+ */
+void queue_finalizers () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  // Detach the unmarked objects, and treat each as a root.
+  ptr_link_s*  dead = NULL;
+  ptr_link_s** link = &heap->finalizable_list_head;
+  while (*link != NULL) {
+    ptr_link_s* current = *link;
+    if (IS_MARKED(heap, BLOCK_TO_HEADER(current->ptr))) {
+      link = &current->next;
+    } else {
+      *link         = current->next;
+      current->next = dead;
+      dead          = current;
+      rs_push(current->ptr);
+    }
+  }
+  if (dead == NULL) {
+    return;
+  }
+
+  // Resurrect them.  Weak references to them have already been cleared; any
+  // newly reached weak references or ephemeron tables are handled here.
+  mark();
+  mark_ephemerons();
+  clear_weak();
+
+  // And hand them to whoever runs the finalizers.
+  pthread_mutex_lock(&heap->finalize_lock);
+  while (dead != NULL) {
+    ptr_link_s* current = dead;
+    dead                = current->next;
+    current->next       = heap->finalize_queue_head;
+    heap->finalize_queue_head = current;
+  }
+  pthread_cond_signal(&heap->finalize_ready);
+  pthread_mutex_unlock(&heap->finalize_lock);
+  
+} // queue_finalizers ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Traverse the allocated list of objects.  Free each unmarked object; the
+ * marks of the others are left, since the next collection's are of a new
+ * epoch.
+ *
+ * \return The number of bytes freed, including headers.
+ */
+size_t sweep () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  // WRITE ME
+  //
+  //   Walk the allocated list.  Each object that is marked is alive, so clear
+  //   its mark.  Each object that is unmarked is dead, so free it with
+  //   `gc_free()`.
+  
+  /** Start at the beginning of the allocated list, and free unmarked blocks. */
+  header_s* current_ptr = heap->allocated_list_head;
+  size_t    freed_bytes = 0;
+  heap->live_bytes            = 0;
+
+  /** Keep checking blocks until we reach the end of the allocated list. */
+  while (current_ptr != NULL) {
+
+    /** Get a hold of the next header before we free the block (if we do). */
+    header_s* next_ptr = current_ptr->next;
+
+    /** Get the curret block. */
+    void* current_block = HEADER_TO_BLOCK(current_ptr);
+
+    /** If the current header is unmarked, then we free it. If it is marked,
+     *  we leave it alone. */
+    if (IS_MARKED(heap, current_ptr)) {
+      heap->live_bytes += sizeof(header_s) + current_ptr->size;
+    } else {
+      freed_bytes += sizeof(header_s) + current_ptr->size;
+      if (gc_recording) {
+	record_forget(current_block);
+      }
+      gc_free(current_block);
+    }
+
+    /** Move on to the next block. */
+    current_ptr = next_ptr;
+
+  }
+
+  return freed_bytes;
+
+} // sweep ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Note a write to a write-protected page of a heap whose dirty pages are being
+ * tracked, and let the write proceed.  Any other fault is passed to the
+ * `SIGSEGV` action that was in place before.
+ *
+ * \param signal  `SIGSEGV`.
+ * \param info    The cause of the fault, including its address.
+ * \param context The context of the faulting thread.
+ */
+void dirty_fault (int signal, siginfo_t* info, void* context) {
+
+  intptr_t addr = (intptr_t)info->si_addr;
+  __atomic_add_fetch(&dirty_readers, 1, __ATOMIC_SEQ_CST);
+  for (gc_heap_t* heap = __atomic_load_n(&heap_list_head, __ATOMIC_SEQ_CST);
+       heap != NULL;
+       heap = __atomic_load_n(&heap->next_heap, __ATOMIC_ACQUIRE)) {
+    unsigned char* map = __atomic_load_n(&heap->dirty_map, __ATOMIC_SEQ_CST);
+    if (map != NULL && addr >= heap->start_addr && addr < heap->dirty_limit) {
+      size_t page = (addr - heap->start_addr) / dirty_page_size;
+      map[page] = 1;
+      mprotect((void*)(heap->start_addr + page * dirty_page_size), dirty_page_size,
+	       PROT_READ | PROT_WRITE);
+      __atomic_sub_fetch(&dirty_readers, 1, __ATOMIC_RELEASE);
+      return;
+    }
+  }
+  __atomic_sub_fetch(&dirty_readers, 1, __ATOMIC_RELEASE);
+
+  // Not ours.  With no handler to pass it to, restore the old action, so that
+  // the faulting access is retried and meets it.
+  if (dirty_previous_action.sa_flags & SA_SIGINFO) {
+    dirty_previous_action.sa_sigaction(signal, info, context);
+  } else if (dirty_previous_action.sa_handler != SIG_DFL &&
+	     dirty_previous_action.sa_handler != SIG_IGN) {
+    dirty_previous_action.sa_handler(signal);
+  } else {
+    sigaction(SIGSEGV, &dirty_previous_action, NULL);
+  }
+
+} // dirty_fault ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Make the pages of the current heap protected by the last collection
+ * writable again, so that the collector may write to them freely.  Which pages
+ * were dirtied is kept.
+ */
+void dirty_unprotect () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (heap->dirty_limit > heap->start_addr) {
+    mprotect((void*)heap->start_addr, heap->dirty_limit - heap->start_addr,
+	     PROT_READ | PROT_WRITE);
+  }
+
+} // dirty_unprotect ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * At the end of a collection, mark every page of the current heap clean, and
+ * write-protect those in use, so that the next write to each is noticed.
+ */
+void dirty_protect () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  intptr_t limit = heap->start_addr + ((heap->free_addr - heap->start_addr + dirty_page_size - 1) /
+				       dirty_page_size * dirty_page_size);
+  memset(heap->dirty_map, 0, (limit - heap->start_addr) / dirty_page_size);
+  if (limit > heap->start_addr) {
+    mprotect((void*)heap->start_addr, limit - heap->start_addr, PROT_READ);
+  }
+  heap->dirty_limit = limit;
+
+} // dirty_protect ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Determine whether any page spanned by an object has been written since the
+ * last collection.
+ *
+ * \param header_ptr The header of the object.
+ * \return `true` if any has; `false`, otherwise.
+ */
+bool dirty_object (header_s* header_ptr) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  intptr_t start = (intptr_t)header_ptr - heap->start_addr;
+  intptr_t end   = start + sizeof(header_s) + header_ptr->size - 1;
+  for (intptr_t page = start / dirty_page_size; page <= end / (intptr_t)dirty_page_size; page += 1) {
+    if (heap->dirty_map[page]) {
+      return true;
+    }
+  }
+
+  return false;
+
+} // dirty_object ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Begin a minor collection's traversal from the objects that survived the last
+ * collection, and so are still marked, but lie on a page written since:  only
+ * they can have come to point to newer objects.  Their unmarked referents are
+ * pushed onto the root set stack; the ephemeron tables among them are set aside
+ * to be traced again.
+ */
+void mark_dirty () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  for (header_s* current = heap->allocated_list_head; current != NULL; current = current->next) {
+
+    if (!IS_MARKED(heap, current) || !dirty_object(current)) {
+      continue;
+    }
+
+    void* block_ptr = HEADER_TO_BLOCK(current);
+    if (current->kind == KIND_EPHEMERON) {
+      link_push(&heap->ephemeron_list_head, block_ptr);
+      continue;
+    }
+    if (current->kind != KIND_OBJECT) {
+      continue;
+    }
+
+    // Of an object larger than a page, scan only the fields on dirty pages.
+    const gc_layout_s* layout = current->layout;
+    if (sizeof(header_s) + current->size <= dirty_page_size) {
+      mark_scan(heap, block_ptr, layout->ptr_offsets, layout->num_ptrs);
+      continue;
+    }
+    for (unsigned int i = 0; i < layout->num_ptrs; i += 1) {
+      size_t   offset = layout->ptr_offsets[i];
+      intptr_t field  = (intptr_t)block_ptr + (offset & ~GC_COMPRESSED_REF);
+      if (heap->dirty_map[(field - heap->start_addr) / dirty_page_size]) {
+	mark_scan_push(heap, field_load(heap, block_ptr, offset));
+      }
+    }
+
+  }
+
+} // mark_dirty ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Garbage collect the heap.  A full collection starts a new epoch, so that
+ * every object is unmarked until traced.  A minor one keeps the epoch of the
+ * last collection, whose survivors thus stay marked (their marks _sticky_),
+ * and traces only from the root set and those survivors on dirty pages.
+ *
+ * \param minor Whether to perform a minor collection.
+ */
+void collect (bool minor) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (gc_recording) {
+    record_gc();
+  }
+
+  heap->collection_count += 1;
+  if (!minor) {
+    heap->mark_epoch = heap->mark_epoch % MAX_EPOCH + 1;
+  }
+  if (trace_enabled) {
+    trace_event(TRACE_GC_BEGIN, heap->collection_count, heap->id);
+    trace_event(TRACE_PHASE_BEGIN, TRACE_PHASE_MARK, heap->collection_count);
+  }
+
+  // The collector writes all over the heap, and so must first lift any
+  // protection from writes.
+  if (heap->dirty_map != NULL) {
+    dirty_unprotect();
+  }
+
+  // Objects in the allocation buffer must be on the allocated list to be swept
+  // (and an Immix hole must not be allocated into while its lines are swept).
+  alloc_buffer_retire();
+
+  if (profile_enabled) {
+    profile_census_begin();
+  }
+
+  // Traverse the heap, marking the objects visited as live.  Objects still
+  // awaiting finalization are live, too, as are, in a minor collection, the
+  // objects that survived the last one.
+  mark_finalize_queue();
+  if (minor) {
+    mark_dirty();
+  }
+  mark();
+
+  if (trace_enabled) {
+    trace_event(TRACE_PHASE_END, TRACE_PHASE_MARK, heap->collection_count);
+    trace_event(TRACE_PHASE_BEGIN, TRACE_PHASE_WEAK, heap->collection_count);
+  }
+
+  // Trace ephemeron values whose keys survived, then clear any weak references
+  // to, and ephemerons keyed by, objects that did not.
+  mark_ephemerons();
+  clear_weak();
+
+  if (trace_enabled) {
+    trace_event(TRACE_PHASE_END, TRACE_PHASE_WEAK, heap->collection_count);
+    trace_event(TRACE_PHASE_BEGIN, TRACE_PHASE_FINALIZERS, heap->collection_count);
+  }
+
+  // Keep unreachable objects with finalizers alive until finalized.
+  queue_finalizers();
+
+  // Stop following the sampled objects that are about to be freed, and forget
+  // any that the open region remembered.
+  profile_census_end(block_is_marked);
+  region_remembered_prune();
+
+  if (trace_enabled) {
+    trace_event(TRACE_PHASE_END, TRACE_PHASE_FINALIZERS, heap->collection_count);
+    trace_event(TRACE_PHASE_BEGIN, TRACE_PHASE_SWEEP, heap->collection_count);
+  }
+
+  // And then sweep the dead objects away, and the lines on which no object
+  // survived.  Region objects are not swept.
+  size_t freed_bytes = sweep();
+  freed_bytes += immix_sweep();
+
+  if (trace_enabled) {
+    trace_event(TRACE_PHASE_END, TRACE_PHASE_SWEEP, heap->collection_count);
+    trace_event(TRACE_HEAP_SIZE, heap->free_addr - heap->start_addr, heap->live_bytes);
+    trace_event(TRACE_GC_END, heap->collection_count, freed_bytes);
+  }
+
+  if (heap->dirty_map != NULL) {
+    dirty_protect();
+  }
+
+  // Sanity check:  The root set should be empty now.
+  assert(heap->root_set_head == NULL);
+  
+} // collect ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Garbage collect the heap.  Traverse and _mark_ live objects based on the
+ * _root set_ passed, and then _sweep_ the unmarked, dead objects onto the free
+ * list.  This function empties the _root set_.
+ */
+void gc () {
+
+  collect(false);
+
+} // gc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Garbage collect the heap, tracing only from the _root set_ and the objects
+ * on pages written since the last collection, if its dirty pages are tracked;
+ * otherwise, or in an Immix heap, while a region is open, or while profiling,
+ * perform a full collection.
+ */
+void gc_minor () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  collect(heap->dirty_limit != 0 &&
+	  heap->policy != GC_HEAP_IMMIX &&
+	  !heap->region_active &&
+	  !profile_enabled);
+
+} // gc_minor ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Garbage collect a heap, from its _root set_.
+ *
+ * \param heap The heap.
+ */
+void gc_heap_collect (gc_heap_t* heap) {
+
+  gc_heap_t* previous = gc_current_heap;
+  gc_current_heap = heap;
+  gc();
+  gc_current_heap = previous;
+
+} // gc_heap_collect ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Gather statistics about a heap.
+ *
+ * \param heap  The heap.
+ * \param stats Where to store them.
+ */
+void gc_heap_stats (gc_heap_t* heap, gc_stats_s* stats) {
+
+  stats->collections = heap->collection_count;
+  stats->extent      = heap->free_addr - heap->start_addr;
+  stats->live_bytes  = heap->live_bytes;
+
+} // gc_heap_stats ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Start tracking which pages of the current heap are written between
+ * collections, so that `gc_minor()` may trace from only those.  After each
+ * collection, the heap's pages in use are write-protected; the first write to
+ * each is caught as a `SIGSEGV`, noted, and allowed.
+ *
+ * \return `true` if tracking has started (or already had); `false` if the
+ *         page map could not be allocated or the handler installed.
+ */
+bool gc_dirty_tracking_start () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  gc_init();
+  if (heap->dirty_map != NULL) {
+    return true;
+  }
+
+  if (dirty_page_size == 0) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = dirty_fault;
+    action.sa_flags     = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &dirty_previous_action) != 0) {
+      return false;
+    }
+    dirty_page_size = PAGE_SIZE;
+  }
+
+  heap->dirty_map = calloc((heap->end_addr - heap->start_addr) / dirty_page_size, 1);
+  if (heap->dirty_map == NULL) {
+    return false;
+  }
+  heap->dirty_limit = 0;
+
+  return true;
+
+} // gc_dirty_tracking_start ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Stop tracking the current heap's dirty pages, lifting the protection from
+ * its pages.
+ */
+void gc_dirty_tracking_stop () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (heap->dirty_map == NULL) {
+    return;
+  }
+
+  unsigned char* map = heap->dirty_map;
+  dirty_unprotect();
+  __atomic_store_n(&heap->dirty_map, NULL, __ATOMIC_SEQ_CST);
+  dirty_quiesce();
+  free(map);
+  heap->dirty_limit = 0;
+
+} // gc_dirty_tracking_stop ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Run the finalizers of up to `max_count` objects from the finalization queue.
+ *
+ * \param max_count The most objects to finalize; `0` for no limit.
+ * \return The number of objects finalized.
+ */
+size_t gc_finalize (size_t max_count) {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  // Take a batch from the queue, keeping it visible to any collection that
+  // happens while its finalizers run.
+  pthread_mutex_lock(&heap->finalize_lock);
+  ptr_link_s* batch = NULL;
+  size_t      count = 0;
+  while (heap->finalize_queue_head != NULL && (max_count == 0 || count < max_count)) {
+    ptr_link_s* current = heap->finalize_queue_head;
+    heap->finalize_queue_head = current->next;
+    current->next       = batch;
+    batch               = current;
+    count += 1;
+  }
+  if (batch != NULL) {
+    link_push(&heap->finalizing_list_head, batch);
+  }
+  pthread_mutex_unlock(&heap->finalize_lock);
+  if (batch == NULL) {
+    return 0;
+  }
+
+  // Finalize the batch outside of the lock.
+  for (ptr_link_s* link = batch; link != NULL; link = link->next) {
+    BLOCK_TO_HEADER(link->ptr)->layout->finalizer(link->ptr);
+  }
+  if (trace_enabled) {
+    trace_event(TRACE_FINALIZE, count, 0);
+  }
+
+  // The objects may now be collected.
+  pthread_mutex_lock(&heap->finalize_lock);
+  ptr_link_s** entry = &heap->finalizing_list_head;
+  while ((*entry)->ptr != batch) {
+    entry = &(*entry)->next;
+  }
+  ptr_link_s* finished = *entry;
+  *entry = finished->next;
+  pthread_mutex_unlock(&heap->finalize_lock);
+  free(finished);
+  while (batch != NULL) {
+    link_pop(&batch);
+  }
+
+  return count;
+  
+} // gc_finalize ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The body of the background finalizer thread:  wait for queued objects, and
+ * finalize them in batches until asked to stop.
+ *
+ * \param arg The heap whose objects to finalize.
+ * \return `NULL`.
+ */
+void* finalizer_thread_main (void* arg) {
+
+  gc_heap_t* heap = arg;
+  gc_current_heap = heap;
+
+  pthread_mutex_lock(&heap->finalize_lock);
+  while (!heap->finalizer_thread_stopping) {
+
+    if (heap->finalize_queue_head == NULL) {
+      pthread_cond_wait(&heap->finalize_ready, &heap->finalize_lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&heap->finalize_lock);
+    gc_finalize(FINALIZER_BATCH_SIZE);
+    pthread_mutex_lock(&heap->finalize_lock);
+
+  }
+  pthread_mutex_unlock(&heap->finalize_lock);
+
+  return NULL;
+  
+} // finalizer_thread_main ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Start a background thread that runs finalizers as objects are queued.
+ *
+ * \return `true` if the thread is running; `false` if it could not be started.
+ */
+bool gc_finalizer_thread_start () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (heap->finalizer_thread_running) {
+    return true;
+  }
+
+  heap->finalizer_thread_stopping = false;
+  if (pthread_create(&heap->finalizer_thread, NULL, finalizer_thread_main, heap) != 0) {
+    return false;
+  }
+  heap->finalizer_thread_running = true;
+
+  return true;
+  
+} // gc_finalizer_thread_start ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Stop the background finalizer thread, waiting for its current batch to
+ * finish.  Objects still queued remain so, for `gc_finalize()`.
+ */
+void gc_finalizer_thread_stop () {
+
+  gc_heap_t* heap = gc_current_heap;
+
+  if (!heap->finalizer_thread_running) {
+    return;
+  }
+
+  pthread_mutex_lock(&heap->finalize_lock);
+  heap->finalizer_thread_stopping = true;
+  pthread_cond_signal(&heap->finalize_ready);
+  pthread_mutex_unlock(&heap->finalize_lock);
+
+  pthread_join(heap->finalizer_thread, NULL);
+  heap->finalizer_thread_running = false;
+  
+} // gc_finalizer_thread_stop ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the slot of an address in an open-addressed table of addresses, as used
+ * to map objects to their offsets within a heap image.
+ *
+ * \param keys     The addresses; `NULL` marks an empty slot.
+ * \param capacity The number of slots; a power of two.
+ * \param ptr      The address sought.
+ * \return The index of the slot holding `ptr`, or of the empty slot where it
+ *         would go.
+ */
+size_t image_slot (void** keys, size_t capacity, void* ptr) {
+
+  size_t index = (((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ULL) & (capacity - 1);
+  while (keys[index] != NULL && keys[index] != ptr) {
+    index = (index + 1) & (capacity - 1);
+  }
+
+  return index;
+  
+} // image_slot ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Translate a pointer to an object into its address within a heap image.
+ *
+ * \param ptr      The pointer.
+ * \param keys     The objects in the image.
+ * \param values   Their addresses in the image.
+ * \param capacity The number of slots in `keys` and `values`.
+ * \return The image address, or `NULL` if `ptr` is not in the image.
+ */
+void* image_translate (void* ptr, void** keys, intptr_t* values, size_t capacity) {
+
+  if (ptr == NULL || ptr == TOMBSTONE) {
+    return ptr;
   }
+  size_t index = image_slot(keys, capacity, ptr);
 
-  /** Pointer to the block we will return. Don't know what that is yet, so
-   *  make it a null pointer. */
-  void* new_block_ptr = NULL;
+  return keys[index] == NULL ? NULL : (void*)values[index];
+  
+} // image_translate ()
+// ==============================================================================
 
-  /** If we have found a best fit... */
-  if (best != NULL) {
 
-    /** ...remove it from the linked list of free blocks. Specifically, if it
-     *  is the first in the list (i.e. it has no previous block), then just 
-     *  set the free list head to the free block immediately following it.
-     *  If it is not the first block in the list (i.e. it has a block before
-     *  it), make that previous block point to the block immediately following
-     *  the best fit one (i.e. skip over the best fit block). */
-    if (best->prev == NULL) {
-      free_list_head   = best->next;
-    } else {
-      best->prev->next = best->next;
-    }
 
-    /** If the best fit block has a block following it, make that next block
-     *  point to the block before the best fit one as its predecessor (i.e. skip
-     *  over the best fit block). */
-    if (best->next != NULL) {
-      best->next->prev = best->prev;
-    }
-   
-    /** Remove the best fit block's pointer to its predecessor. */ 
-    best->prev = NULL;
+// ==============================================================================
+/**
+ * Save the heap reachable from the given roots, along with the layouts of its
+ * objects, as a heap image that `gc_image_load()` can map back into the heap.
+ * Weak references whose targets are not otherwise saved are cleared in the
+ * image; ephemeron tables are saved with all of their entries.
+ *
+ * \param path      The file to write.
+ * \param roots     The roots of the objects to save.
+ * \param num_roots The number of roots.
+ * \return `true` if successful; `false` if the file could not be written, an
+ *         object to be saved has a finalizer, or a region is open.
+ */
+bool gc_image_save (const char* path, void** roots, size_t num_roots) {
 
-    /** Remove the best fit block's pointer to its successor. */
-    best->next = NULL;
+  gc_heap_t* heap = gc_current_heap;
 
-    /** We have allocated the best fit block. Set a pointer to that block. */
-    best->allocated = true;
-    new_block_ptr   = HEADER_TO_BLOCK(best);
-    
-  } else {
+  gc_init();
 
-    /** If we have not found a best fit, then we must pointer bump and keep
-     *  growing the heap by creating a new block. Set a pointer to that block. */
-    header_s* header_ptr = (header_s*)free_addr;
-    new_block_ptr = HEADER_TO_BLOCK(header_ptr);
+  // The open region's objects are about to be released or moved.
+  if (heap->region_active) {
+    return false;
+  }
 
-    /** The block will not be part of a linked list (since it is allocated),
-     *  its size will be exactly the requested size, and we must signal that
-     *  it is allocated. */
-    header_ptr->next      = NULL;
-    header_ptr->prev      = NULL;
-    header_ptr->size      = size;
-    header_ptr->allocated = true;
-    
-    /** Pointer bumping: find the next new free address in the heap by moving
-     *  away from the block pointer by a translation equal to the block's size. */
-    intptr_t new_free_addr = (intptr_t)new_block_ptr + size;
+  // Gather the reachable objects, in depth-first order, and their layouts.
+  size_t        num_objects  = 0;
+  size_t        max_objects  = 1024;
+  void**        objects      = malloc(max_objects * sizeof(void*));
+  const gc_layout_s** layouts      = NULL;
+  size_t        num_layouts  = 0;
+  size_t        offsets_size = 0;
+  bool          savable      = objects != NULL;
+  ptr_link_s*   stack        = NULL;
+  for (size_t i = 0; i < num_roots; i += 1) {
+    link_push(&stack, roots[i]);
+  }
+  while (stack != NULL) {
 
-    /** Have we exceeded the maximum size of the heap? */
-    if (new_free_addr > end_addr) {
+    void* ptr = link_pop(&stack);
+    if (ptr == NULL || BLOCK_TO_HEADER(ptr)->visited) {
+      continue;
+    }
+    header_s* header = BLOCK_TO_HEADER(ptr);
+    header->visited  = true;
+
+    if (num_objects == max_objects) {
+      max_objects   *= 2;
+      void** larger  = realloc(objects, max_objects * sizeof(void*));
+      if (larger == NULL) {
+	savable = false;
+	break;
+      }
+      objects = larger;
+    }
+    objects[num_objects++] = ptr;
 
-      /** If yes, then return a null pointer - allocation failed. */
-      return NULL;
+    const gc_layout_s* layout = header->layout;
+    if (layout->finalizer != NULL) {
+      savable = false;
+    }
+    size_t j = 0;
+    while (j < num_layouts && layouts[j] != layout) {
+      j += 1;
+    }
+    if (j == num_layouts) {
+      const gc_layout_s** larger = realloc(layouts, (num_layouts + 1) * sizeof(gc_layout_s*));
+      if (larger == NULL) {
+	savable = false;
+	break;
+      }
+      layouts                 = larger;
+      layouts[num_layouts++]  = layout;
+      offsets_size           += layout->num_ptrs * sizeof(size_t);
+    }
 
-    } else {
+    if (header->kind == KIND_EPHEMERON) {
+      gc_ephemeron_table_t* table = ptr;
+      for (size_t k = 0; k < table->capacity; k += 1) {
+	if (table->entries[k].key != NULL && table->entries[k].key != TOMBSTONE) {
+	  link_push(&stack, table->entries[k].key);
+	  link_push(&stack, table->entries[k].value);
+	}
+      }
+    } else if (header->kind == KIND_OBJECT) {
+      for (unsigned int k = 0; k < layout->num_ptrs; k += 1) {
+	link_push(&stack, field_load(heap, ptr, layout->ptr_offsets[k]));
+      }
+    }
+
+  }
+  while (stack != NULL) {
+    link_pop(&stack);
+  }
+  for (size_t i = 0; i < num_objects; i += 1) {
+    BLOCK_TO_HEADER(objects[i])->visited = false;
+  }
 
-      /** If not, then the first free address gets updated accordingly. */
-      free_addr = new_free_addr;
+  // Lay out the image:  a block holding the layouts, and then the objects, as
+  // they would be placed by pointer bumping from `base`.
+  intptr_t  base        = heap->start_addr;
+  intptr_t  layouts_hdr = HEADER_POSITION(base);
+  intptr_t  layouts_at  = (intptr_t)HEADER_TO_BLOCK(layouts_hdr);
+  intptr_t  end         = layouts_at + num_layouts * sizeof(gc_layout_s) + offsets_size;
+  size_t    capacity    = 16;
+  while (capacity < num_objects * 2) {
+    capacity *= 2;
+  }
+  void**    keys        = calloc(capacity, sizeof(void*));
+  intptr_t* values      = calloc(capacity, sizeof(intptr_t));
+  if (!savable || keys == NULL || values == NULL) {
+    free(objects);
+    free(layouts);
+    free(keys);
+    free(values);
+    return false;
+  }
+  for (size_t i = 0; i < num_objects; i += 1) {
+    intptr_t header = HEADER_POSITION(end);
+    size_t   index  = image_slot(keys, capacity, objects[i]);
+    keys[index]     = objects[i];
+    values[index]   = (intptr_t)HEADER_TO_BLOCK(header);
+    end             = values[index] + BLOCK_TO_HEADER(objects[i])->size;
+  }
 
+  image_header_s image;
+  memset(&image, 0, sizeof(image));
+  memcpy(image.magic, IMAGE_MAGIC, sizeof(image.magic));
+  image.header_size    = sizeof(header_s);
+  image.page_size      = PAGE_SIZE;
+  image.base           = base;
+  image.data_offset    = PAGE_ROUND_UP(sizeof(image_header_s) + num_roots * sizeof(uint64_t));
+  image.used_size      = end - base;
+  image.map_size       = PAGE_ROUND_UP(image.used_size);
+  image.num_layouts    = num_layouts;
+  image.layouts_offset = layouts_at - base;
+  image.num_objects    = num_objects;
+  image.num_roots      = num_roots;
+
+  // Build the heap data, with every pointer translated into the image.
+  char* data = calloc(1, image.map_size);
+  if (data == NULL) {
+    free(objects);
+    free(layouts);
+    free(keys);
+    free(values);
+    return false;
+  }
+  header_s* layouts_block  = (header_s*)(data + (layouts_hdr - base));
+  layouts_block->size      = num_layouts * sizeof(gc_layout_s) + offsets_size;
+  layouts_block->allocated = true;
+  layouts_block->space     = SPACE_HEAP;
+  gc_layout_s* layout_copy = (gc_layout_s*)(data + image.layouts_offset);
+  intptr_t     offsets_at  = layouts_at + num_layouts * sizeof(gc_layout_s);
+  for (size_t i = 0; i < num_layouts; i += 1) {
+    layout_copy[i]             = *layouts[i];
+    layout_copy[i].ptr_offsets = NULL;
+    if (layouts[i]->num_ptrs > 0) {
+      layout_copy[i].ptr_offsets = (size_t*)offsets_at;
+      memcpy(data + (offsets_at - base), layouts[i]->ptr_offsets, layouts[i]->num_ptrs * sizeof(size_t));
+      offsets_at += layouts[i]->num_ptrs * sizeof(size_t);
     }
-    
   }
 
-  /** Insert the block at the beginning of the linked list of allocated blocks, 
-   *  i.e. make it point to the first allocated block currently in the list, and
-   *  set the head of the allocated list to point at the block we are allocating.
-   *  Also, since the newly allocated block is the first one in the list, there
-   *  will be no block before it, so its previous pointer is a null pointer. */
-  header_s* allocated_header_ptr = BLOCK_TO_HEADER(new_block_ptr);
-  allocated_header_ptr->next = allocated_list_head;
-  allocated_list_head = allocated_header_ptr;
-  allocated_header_ptr->prev = NULL;
+  for (size_t i = 0; i < num_objects; i += 1) {
+
+    void*     ptr       = objects[i];
+    header_s* header    = BLOCK_TO_HEADER(ptr);
+    intptr_t  copy_addr = (intptr_t)image_translate(ptr, keys, values, capacity);
+    void*     copy      = data + (copy_addr - base);
+    header_s* copy_hdr  = BLOCK_TO_HEADER(copy);
+    memcpy(copy, ptr, header->size);
+
+    // Chain the objects as a segment of the allocated list.
+    copy_hdr->prev       = i == 0               ? NULL : BLOCK_TO_HEADER(image_translate(objects[i - 1], keys, values, capacity));
+    copy_hdr->next       = i == num_objects - 1 ? NULL : BLOCK_TO_HEADER(image_translate(objects[i + 1], keys, values, capacity));
+    copy_hdr->size       = header->size;
+    copy_hdr->allocated  = true;
+    copy_hdr->marked     = 0;
+    copy_hdr->visited    = false;
+    copy_hdr->remembered = false;
+    copy_hdr->kind       = header->kind;
+    copy_hdr->space      = SPACE_HEAP;
+    size_t j = 0;
+    while (layouts[j] != header->layout) {
+      j += 1;
+    }
+    copy_hdr->layout = (gc_layout_s*)(layouts_at + j * sizeof(gc_layout_s));
+
+    if (header->kind == KIND_WEAK) {
+      gc_weak_ref_t* weak = copy;
+      weak->target = image_translate(weak->target, keys, values, capacity);
+    } else if (header->kind == KIND_EPHEMERON) {
+      gc_ephemeron_table_t* table = copy;
+      for (size_t k = 0; k < table->capacity; k += 1) {
+	table->entries[k].key   = image_translate(table->entries[k].key,   keys, values, capacity);
+	table->entries[k].value = image_translate(table->entries[k].value, keys, values, capacity);
+      }
+      ephemeron_rehash(table);
+    } else {
+      // Compressed references remain relative to the heap's start, `base`.
+      for (unsigned int k = 0; k < header->layout->num_ptrs; k += 1) {
+	size_t offset = header->layout->ptr_offsets[k];
+	field_store(heap, copy, offset,
+		    image_translate(field_load(heap, ptr, offset), keys, values, capacity));
+      }
+    }
+
+    if (i == 0) {
+      image.first_offset = (intptr_t)BLOCK_TO_HEADER(copy_addr) - base;
+    }
+    image.last_offset = (intptr_t)BLOCK_TO_HEADER(copy_addr) - base;
 
-  /** If the next block is not null, then we must ensure its previous pointer
-   *  will point to the block we are deallocating. */
-  if (allocated_header_ptr->next != NULL) {
-    allocated_header_ptr->next->prev = allocated_header_ptr;
   }
 
-  /** Return a pointer to the newly allocated block - allocation succeeded. */
-  return new_block_ptr;
+  // Write the header, the roots, and the data.
+  bool  written = false;
+  FILE* out     = fopen(path, "w");
+  if (out != NULL) {
+    written = fwrite(&image, sizeof(image), 1, out) == 1;
+    for (size_t i = 0; written && i < num_roots; i += 1) {
+      uint64_t root = roots[i] == NULL ? 0 : (intptr_t)image_translate(roots[i], keys, values, capacity) - base;
+      written = fwrite(&root, sizeof(root), 1, out) == 1;
+    }
+    written = (written &&
+	       fseek(out, image.data_offset, SEEK_SET) == 0 &&
+	       fwrite(data, 1, image.map_size, out) == image.map_size);
+    written = fclose(out) == 0 && written;
+  }
 
-} // gc_malloc ()
+  free(data);
+  free(objects);
+  free(layouts);
+  free(keys);
+  free(values);
+
+  return written;
+  
+} // gc_image_save ()
 // ==============================================================================
 
 
 
 // ==============================================================================
-// COPY-AND-PASTE YOUR PROJECT-4 free() HERE.
-//
-//   See above.  Small details may have changed, but the code should largely be
-//   unchanged.
-//
 /**
- * Deallocate a given block on the heap.  Add the given block (if any) to the
- * free list.
+ * Adjust a pointer within heap data that was laid out for another address.
+ * Nothing is written if the data was not moved, so that its pages stay shared
+ * with the file.
  *
- * \param ptr A pointer to the block to be deallocated.
+ * \param handle The location of the pointer.
+ * \param base   The address for which the data was laid out.
+ * \param size   The size of the data.
+ * \param delta  The difference between the actual address and `base`.
  */
-void gc_free (void* ptr) {
-    
-  /** If passed a null pointer, there's nothing to free. */
-  if (ptr == NULL) {
-    return;
-  }
-
-  /** Get a pointer to the block's header. */
-  header_s* header_ptr = BLOCK_TO_HEADER(ptr);
+void image_relocate (void** handle, intptr_t base, size_t size, intptr_t delta) {
 
-  /** If the block is not allocated, there's no point in trying to free it,
-   *  so throw an error. */
-  if (!header_ptr->allocated) {
-    ERROR("Double-free: ", (intptr_t)header_ptr);
+  intptr_t ptr = (intptr_t)*handle;
+  if (delta != 0 && ptr >= base && ptr < base + (intptr_t)size) {
+    *handle = (void*)(ptr + delta);
   }
+  
+} // image_relocate ()
+// ==============================================================================
 
-  /** Remove the block from the linked list of allocated blocks. Specifically, 
-   *  if it is the first in the list (i.e. it has no previous block), then just 
-   *  set the allocated list head to the allocated block immediately following it.
-   *  If it is not the first block in the list (i.e. it has a block before
-   *  it), make that previous block point to the block immediately following
-   *  the one we are deallocating (i.e. skip over the deallocated block). */
-   if (header_ptr->prev == NULL) {
-     allocated_list_head = header_ptr->next;
-   } else {
-     header_ptr->prev->next = header_ptr->next;
-   }
 
-   /** If the deallocated block has a block following it, make that next block
-    *  point to the block before the deallocated one as its predecessor (i.e. skip
-    *  over the deallocated block). */
-   if (header_ptr->next != NULL) {
-     header_ptr->next->prev = header_ptr->prev;
-   }
-  
-   /** Remove the deallocated block's pointer to its predecessor. */
-   header_ptr->prev = NULL;
 
-   /** Remove the deallocated block's pointer to its successor. */
-   header_ptr->next = NULL;
+// ==============================================================================
+/**
+ * Check that the sizes and offsets in an image's header are consistent with one
+ * another and with the file, so that mapping and walking the data stays within
+ * both the file and the mapping.
+ *
+ * \param image     The image's header.
+ * \param file_size The size of the image file, in bytes.
+ * \return `true` if the header is consistent; `false` otherwise.
+ */
+bool image_header_valid (const image_header_s* image, uint64_t file_size) {
+
+  uint64_t roots_end = sizeof(image_header_s) + image->num_roots * sizeof(uint64_t);
+  if (image->num_roots   > (file_size - sizeof(image_header_s)) / sizeof(uint64_t) ||
+      image->data_offset % PAGE_SIZE != 0 || image->data_offset < roots_end ||
+      image->map_size    % PAGE_SIZE != 0 || image->data_offset > file_size  ||
+      image->map_size    > file_size - image->data_offset                    ||
+      image->used_size   > image->map_size) {
+    return false;
+  }
 
-  /** Insert the block at the beginning of the linked list of free blocks, i.e.
-   *  make it point to the first free block currently in the list, and set the 
-   *  head of the free list to point at the block we are deallocating. Also,
-   *  since the newly deallocated block is the first one in the list, there
-   *  will be no block before it, so its previous pointer is a null pointer. */
-  header_ptr->next = free_list_head;
-  free_list_head   = header_ptr;
-  header_ptr->prev = NULL;
+  uint64_t max_layouts = image->used_size / sizeof(gc_layout_s);
+  if (image->layouts_offset % sizeof(void*) != 0 || image->num_layouts > max_layouts ||
+      image->layouts_offset > image->used_size - image->num_layouts * sizeof(gc_layout_s)) {
+    return false;
+  }
 
-  /** If the next block is not null, then we must ensure its previous pointer
-   *  will point to the block we are deallocating. */
-  if (header_ptr->next != NULL) {
-    header_ptr->next->prev = header_ptr;
+  if (image->num_objects > 0 &&
+      (image->used_size    < sizeof(header_s)                          ||
+       image->first_offset > image->used_size - sizeof(header_s)      ||
+       image->last_offset  > image->used_size - sizeof(header_s)      ||
+       image->first_offset % sizeof(void*) != 0 || image->last_offset % sizeof(void*) != 0)) {
+    return false;
   }
 
-  /** We are done, so mark the block as officially deallocated. */
-  header_ptr->allocated = false;
+  return true;
 
-} // gc_free ()
+} // image_header_valid ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Allocate and return heap space for the structure defined by the given
- * `layout`.
+ * Determine whether a pointer into a loaded image is to one of its objects.
  *
- * \param layout A descriptor of the fields
- * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ * \param load The state of the load, after every header has been checked.
+ * \param ptr  The pointer.
+ * \return `true` if an object starts at `ptr`; `false` otherwise.
  */
-void* gc_new (gc_layout_s* layout) {
+bool image_is_object (const image_load_s* load, void* ptr) {
 
-  // Get a block large enough for the requested layout.
-  void*     block_ptr  = gc_malloc(layout->size);
-  header_s* header_ptr = BLOCK_TO_HEADER(block_ptr);
+  intptr_t addr = (intptr_t)ptr;
+  if (addr < load->load_addr + (intptr_t)sizeof(header_s) || addr >= load->end ||
+      (addr - load->load_addr) % DBL_WORD_SIZE != 0) {
+    return false;
+  }
+  size_t bit = (addr - load->load_addr) / DBL_WORD_SIZE;
 
-  // Hold onto the layout for later, when a collection occurs.
-  header_ptr->layout = layout;
-  
-  return block_ptr;
-  
-} // gc_new ()
+  return (load->starts[bit / 8] & (1 << (bit % 8))) != 0;
+
+} // image_is_object ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Traverse the heap, marking all live objects.
+ * Check, and relocate if need be, a loaded image's layouts:  the pointer
+ * offsets of each must lie within the image, and none may have a finalizer.
+ *
+ * \param load The state of the load.
+ * \return `true` if the layouts are sound; `false` otherwise.
  */
-void mark () {
+bool image_layouts_check (image_load_s* load) {
 
-  // WRITE ME.
-  //
-  //   Adapt the pseudocode from class for a copying collector to real code here
-  //   for a non-copying collector.  Do the traversal, using the linked stack of
-  //   pointers that starts at `root_set_head`, setting the `marked` field on
-  //   each object you reach.
-  
-  /** We begin our depth-first search at the begining of our root set, and keep
-   *  going until we ecounter a null pointer. */
-  while (root_set_head != NULL) {
+  const image_header_s* image = load->image;
+  intptr_t              end   = (intptr_t)image->base + image->used_size;
 
-    /** Get the curret pointer. */
-    void* current_ptr = rs_pop();
+  for (size_t i = 0; i < image->num_layouts; i += 1) {
+    gc_layout_s* layout  = &load->layouts[i];
+    intptr_t     offsets = (intptr_t)layout->ptr_offsets;
+    if (layout->finalizer != NULL) {
+      return false;
+    }
+    if (layout->num_ptrs > 0 &&
+	(offsets < (intptr_t)image->base || offsets >= end || offsets % sizeof(size_t) != 0 ||
+	 layout->num_ptrs > (end - offsets) / sizeof(size_t))) {
+      return false;
+    }
+    image_relocate((void**)&layout->ptr_offsets, image->base, image->map_size, load->delta);
+  }
 
-    /** If the curret pointer actually points to something in memory, then
-     *  mark that place and add all its pointers to the stack for searching. */
-    if (current_ptr != NULL) {
+  return true;
 
-      header_s* header = BLOCK_TO_HEADER(current_ptr);
+} // image_layouts_check ()
+// ==============================================================================
 
-      if (!header->marked) {
-        header->marked = true;
-      }
 
-      /** Where can we travel from here? */
-      gc_layout_s* current_layout = header->layout;
 
-      /** Add those places to our list, to be searched later. */
-      for (int i = 0; i < current_layout->num_ptrs; i++) {
+// ==============================================================================
+/**
+ * Walk the headers of a loaded image, checking, and relocating if need be,
+ * each in turn:  every block must lie within the data, be of a known kind,
+ * have one of the image's layouts, and be big enough for the fields that its
+ * layout or kind implies; and the headers must be chained, in order, from the
+ * first object to the last.  The start of each object is noted.
+ *
+ * \param load The state of the load.
+ * \return `true` if the headers are sound; `false` otherwise.
+ */
+bool image_headers_check (image_load_s* load) {
 
-        /** Get handle. */
-        void** handle = current_ptr + current_layout->ptr_offsets[i];
+  const image_header_s* image    = load->image;
+  header_s*             previous = NULL;
+  size_t                count    = 0;
 
-        /** Get pointer. */
-        void* ptr = *handle;
+  intptr_t addr = image->num_objects > 0 ? load->load_addr + (intptr_t)image->first_offset : load->end;
+  while (addr < load->end) {
 
-        /** Add the pointer to the list. */
-        rs_push(ptr);
+    header_s* header = (header_s*)addr;
+    void*     ptr    = HEADER_TO_BLOCK(header);
+    if (addr + (intptr_t)sizeof(header_s) > load->end || header->size > (size_t)(load->end - (intptr_t)ptr)) {
+      return false;
+    }
+    image_relocate((void**)&header->next,   image->base, image->map_size, load->delta);
+    image_relocate((void**)&header->prev,   image->base, image->map_size, load->delta);
+    image_relocate((void**)&header->layout, image->base, image->map_size, load->delta);
+
+    intptr_t layout_at = (intptr_t)header->layout - (intptr_t)load->layouts;
+    if (!header->allocated || header->space != SPACE_HEAP ||
+	layout_at < 0 || layout_at % sizeof(gc_layout_s) != 0 ||
+	(size_t)layout_at / sizeof(gc_layout_s) >= image->num_layouts ||
+	header->prev != previous || (previous != NULL && previous->next != header)) {
+      return false;
+    }
 
+    if (header->kind == KIND_WEAK) {
+      if (header->size < sizeof(gc_weak_ref_t)) {
+	return false;
       }
-
+    } else if (header->kind == KIND_EPHEMERON) {
+      gc_ephemeron_table_t* table = ptr;
+      if (header->size < sizeof(gc_ephemeron_table_t) ||
+	  table->capacity == 0 || (table->capacity & (table->capacity - 1)) != 0 ||
+	  table->capacity > (header->size - sizeof(gc_ephemeron_table_t)) / sizeof(ephemeron_entry_s)) {
+	return false;
+      }
+    } else if (header->kind == KIND_OBJECT) {
+      const gc_layout_s* layout = header->layout;
+      for (unsigned int k = 0; k < layout->num_ptrs; k += 1) {
+	size_t offset = layout->ptr_offsets[k] & ~GC_COMPRESSED_REF;
+	size_t width  = layout->ptr_offsets[k] & GC_COMPRESSED_REF ? sizeof(gc_ref_t) : sizeof(void*);
+	if (offset > header->size || width > header->size - offset) {
+	  return false;
+	}
+      }
+    } else {
+      return false;
     }
 
-  }  
+    size_t bit = ((intptr_t)ptr - load->load_addr) / DBL_WORD_SIZE;
+    load->starts[bit / 8] |= 1 << (bit % 8);
+    previous  = header;
+    count    += 1;
+    addr      = HEADER_POSITION((intptr_t)ptr + header->size);
 
-} // mark ()
+  }
+
+  return (count == image->num_objects &&
+	  (count == 0 ||
+	   ((intptr_t)previous == load->load_addr + (intptr_t)image->last_offset && previous->next == NULL)));
+
+} // image_headers_check ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Traverse the allocated list of objects.  Free each unmarked object;
- * unmark each marked object (preparing it for the next sweep.
+ * Walk the objects of a loaded image, whose headers have been checked, and
+ * check, and relocate if need be, each pointer within them:  every one must be
+ * `NULL` or to an object of the image.
+ *
+ * \param load The state of the load.
+ * \return `true` if the pointers are sound; `false` otherwise.
  */
-void sweep () {
-
-  // WRITE ME
-  //
-  //   Walk the allocated list.  Each object that is marked is alive, so clear
-  //   its mark.  Each object that is unmarked is dead, so free it with
-  //   `gc_free()`.
-  
-  /** Start at the beginning of the allocated list, and free unmarked blocks. */
-  header_s* current_ptr = allocated_list_head;
+bool image_pointers_check (image_load_s* load) {
 
-  /** Keep checking blocks until we reach the end of the allocated list. */
-  while (current_ptr != NULL) {
+  const image_header_s* image = load->image;
+  gc_heap_t*            heap  = gc_current_heap;
 
-    /** Get a hold of the next header before we free the block (if we do). */
-    header_s* next_ptr = current_ptr->next;
+  intptr_t addr = image->num_objects > 0 ? load->load_addr + (intptr_t)image->first_offset : load->end;
+  while (addr < load->end) {
 
-    /** Get the curret block. */
-    void* current_block = HEADER_TO_BLOCK(current_ptr);
+    header_s* header = (header_s*)addr;
+    void*     ptr    = HEADER_TO_BLOCK(header);
 
-    /** If the current header is unmarked, then we free it. If it is marked,
-     *  we leave it alone, but we unmark it for future garbage collectios. */
-    if (current_ptr->marked) {
-      current_ptr->marked = false;
+    if (header->kind == KIND_WEAK) {
+      void** target = &((gc_weak_ref_t*)ptr)->target;
+      image_relocate(target, image->base, image->map_size, load->delta);
+      if (*target != NULL && !image_is_object(load, *target)) {
+	return false;
+      }
+    } else if (header->kind == KIND_EPHEMERON) {
+      // A table must keep an empty slot, at which every search can end.
+      gc_ephemeron_table_t* table = ptr;
+      size_t                live  = 0;
+      size_t                used  = 0;
+      for (size_t k = 0; k < table->capacity; k += 1) {
+	ephemeron_entry_s* entry = &table->entries[k];
+	used += entry->key != NULL;
+	if (entry->key == NULL || entry->key == TOMBSTONE) {
+	  continue;
+	}
+	image_relocate(&entry->key,   image->base, image->map_size, load->delta);
+	image_relocate(&entry->value, image->base, image->map_size, load->delta);
+	if (!image_is_object(load, entry->key) ||
+	    (entry->value != NULL && !image_is_object(load, entry->value))) {
+	  return false;
+	}
+	live += 1;
+      }
+      if (used == table->capacity) {
+	return false;
+      }
+      if (table->count != live || table->used != used) {
+	table->count = live;
+	table->used  = used;
+      }
+      if (load->delta != 0) {
+	ephemeron_rehash(table);
+      }
     } else {
-      gc_free(current_block);
+      const gc_layout_s* layout = header->layout;
+      for (unsigned int k = 0; k < layout->num_ptrs; k += 1) {
+	size_t offset = layout->ptr_offsets[k];
+	if (offset & GC_COMPRESSED_REF) {
+	  gc_ref_t* ref = ptr + (offset & ~GC_COMPRESSED_REF);
+	  if (*ref != 0 && load->ref_delta != 0) {
+	    *ref += load->ref_delta;
+	  }
+	  if (*ref != 0 && !image_is_object(load, gc_heap_ref_decode(heap, *ref))) {
+	    return false;
+	  }
+	} else {
+	  void** field = ptr + offset;
+	  image_relocate(field, image->base, image->map_size, load->delta);
+	  if (*field != NULL && !image_is_object(load, *field)) {
+	    return false;
+	  }
+	}
+      }
     }
 
-    /** Move on to the next block. */
-    current_ptr = next_ptr;
+    addr = HEADER_POSITION((intptr_t)ptr + header->size);
 
   }
 
-} // sweep ()
+  return true;
+
+} // image_pointers_check ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Garbage collect the heap.  Traverse and _mark_ live objects based on the
- * _root set_ passed, and then _sweep_ the unmarked, dead objects onto the free
- * list.  This function empties the _root set_.
+ * Map a heap image saved by `gc_image_save()` into the heap, just past the
+ * bump frontier.  If that is where the image was laid out for -- as it is when
+ * the image is loaded before any allocation, in a process whose heap region is
+ * at the same address -- the data is simply mapped, and its pages are shared
+ * with the file until written.  Otherwise, every pointer in it is relocated.
+ * Either way, every header, layout and pointer is checked to lie within the
+ * image before any of it joins the heap.  The loaded objects, and the layouts
+ * that describe them, then belong to the heap.
+ *
+ * \param path      The file to read.
+ * \param roots     Where to store the image's roots.
+ * \param max_roots The number of roots there is room for.
+ * \param num_roots Where to store the number of roots; may be `NULL`.
+ * \return `true` if successful; `false` if the file is not a compatible image,
+ *         is malformed, has more than `max_roots` roots, or does not fit in the heap.
  */
-void gc () {
+bool gc_image_load (const char* path, void** roots, size_t max_roots, size_t* num_roots) {
 
-  // Traverse the heap, marking the objects visited as live.
-  mark();
+  gc_heap_t* heap = gc_current_heap;
 
-  // And then sweep the dead objects away.
-  sweep();
+  gc_init();
+  alloc_buffer_retire();
 
-  // Sanity check:  The root set should be empty now.
-  assert(root_set_head == NULL);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  image_header_s image;
+  struct stat    file;
+  if (fstat(fd, &file) != 0                               ||
+      read(fd, &image, sizeof(image)) != sizeof(image)    ||
+      memcmp(image.magic, IMAGE_MAGIC, sizeof(image.magic)) != 0 ||
+      image.header_size != sizeof(header_s)               ||
+      image.page_size   != PAGE_SIZE                      ||
+      image.num_roots   >  max_roots                      ||
+      !image_header_valid(&image, file.st_size)) {
+    close(fd);
+    return false;
+  }
+  uint64_t* offsets = malloc((image.num_roots + 1) * sizeof(uint64_t));
+  if (offsets == NULL ||
+      read(fd, offsets, image.num_roots * sizeof(uint64_t)) != (ssize_t)(image.num_roots * sizeof(uint64_t))) {
+    free(offsets);
+    close(fd);
+    return false;
+  }
+
+  // Map the data at the first page past the bump frontier, leaving room to
+  // turn the gap before it into a free block.
+  intptr_t gap_header = HEADER_POSITION(heap->free_addr);
+  intptr_t load_addr  = PAGE_ROUND_UP(heap->free_addr);
+  if (load_addr != heap->free_addr && load_addr < gap_header + (intptr_t)sizeof(header_s) + DBL_WORD_SIZE) {
+    load_addr += PAGE_SIZE;
+  }
+  if (load_addr > heap->region_floor || image.map_size > (uint64_t)(heap->region_floor - load_addr)) {
+    free(offsets);
+    close(fd);
+    return false;
+  }
+  void* data = mmap((void*)load_addr,
+		    image.map_size,
+		    PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_FIXED,
+		    fd,
+		    image.data_offset);
+  close(fd);
+  if (data == MAP_FAILED) {
+    free(offsets);
+    return false;
+  }
+
+  // Check the data, relocating it if need be.  Compressed references were
+  // measured from the image's base, and now must be from the start of this
+  // heap.  The roots must be objects, too.
+  image_load_s load;
+  load.image     = &image;
+  load.load_addr = load_addr;
+  load.end       = load_addr + image.used_size;
+  load.delta     = load_addr - (intptr_t)image.base;
+  load.ref_delta = (load_addr - heap->start_addr) >> GC_REF_SHIFT;
+  load.layouts   = (gc_layout_s*)(load_addr + image.layouts_offset);
+  load.starts    = calloc(image.used_size / DBL_WORD_SIZE / 8 + 1, 1);
+  bool sound = (load.starts != NULL        &&
+		image_layouts_check(&load)  &&
+		image_headers_check(&load)  &&
+		image_pointers_check(&load));
+  for (size_t i = 0; sound && i < image.num_roots; i += 1) {
+    sound = offsets[i] == 0 || image_is_object(&load, (void*)(load_addr + offsets[i]));
+  }
+  free(load.starts);
+
+  // If it is unsound, put back the heap's own anonymous space.
+  if (!sound) {
+    mmap((void*)load_addr,
+	 image.map_size,
+	 PROT_READ | PROT_WRITE,
+	 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+	 -1,
+	 0);
+    free(offsets);
+    return false;
+  }
+
+  if (load_addr != heap->free_addr) {
+    header_s* gap = (header_s*)gap_header;
+    gap->size     = load_addr - (intptr_t)HEADER_TO_BLOCK(gap);
+    gap->marked   = 0;
+    gap->space    = SPACE_HEAP;
+    free_list_insert(gap);
+  }
+  heap->free_addr = load.end;
+
+  // Splice the objects onto the front of the allocated list.
+  if (image.num_objects > 0) {
+    header_s* first = (header_s*)(load_addr + image.first_offset);
+    header_s* last  = (header_s*)(load_addr + image.last_offset);
+    last->next = heap->allocated_list_head;
+    if (heap->allocated_list_head != NULL) {
+      heap->allocated_list_head->prev = last;
+    }
+    heap->allocated_list_head = first;
+  }
+
+  for (size_t i = 0; i < image.num_roots; i += 1) {
+    roots[i] = offsets[i] == 0 ? NULL : (void*)(load_addr + offsets[i]);
+  }
+  free(offsets);
+  if (num_roots != NULL) {
+    *num_roots = image.num_roots;
+  }
+
+  return true;
   
-} // gc ()
+} // gc_image_load ()
 // ==============================================================================
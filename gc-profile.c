@@ -0,0 +1,612 @@
+// ==============================================================================
+/**
+ * gc-profile.c
+ *
+ * A low-overhead sampling allocation profiler.  Allocations are sampled as a
+ * Poisson process over allocated bytes:  the distance between samples is drawn
+ * from an exponential distribution, so that every byte is equally likely to be
+ * sampled, and the cost is paid only on the (rare) sampled allocations.  Each
+ * sample is attributed to its layout and its call site.  Additionally, each
+ * collection takes a census of the live objects, by layout.  Each thread
+ * counts down to its own next sample; the profile itself is shared, under a
+ * lock.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <execinfo.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc.h"
+#include "gc-profile.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The most frames of a call site's backtrace that are kept. */
+#define PROFILE_MAX_DEPTH 32
+
+/** The number of chains in the bucket hash table. */
+#define PROFILE_BUCKETS 1021
+
+/**
+ * The most innermost frames searched for the call site, and so omitted:  the
+ * profiler's own and the allocator's, however many the compiler did not inline.
+ */
+#define PROFILE_MAX_SKIP 8
+
+/** The initial number of slots in the census table. */
+#define CENSUS_INITIAL_CAPACITY 64
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** The sampled allocations from one layout at one call site. */
+typedef struct profile_bucket {
+
+  /** The next bucket in the same hash chain. */
+  struct profile_bucket* next;
+
+  /** The layout of the objects allocated. */
+  const gc_layout_s*     layout;
+
+  /** The number of frames in the backtrace. */
+  int                    depth;
+
+  /** The backtrace of the call site, innermost first. */
+  void*                  frames[PROFILE_MAX_DEPTH];
+
+  /** The number of sampled allocations, and their total size. */
+  size_t                 alloc_count;
+  size_t                 alloc_bytes;
+
+  /** The number, and total size, of those not yet found dead. */
+  size_t                 inuse_count;
+  size_t                 inuse_bytes;
+
+} profile_bucket_s;
+
+/** A sampled object being tracked until it dies. */
+typedef struct profile_sample {
+
+  /** The next tracked sample. */
+  struct profile_sample* next;
+
+  /** The object itself. */
+  void*                  obj;
+
+  /** Its size, in bytes. */
+  size_t                 size;
+
+  /** The bucket to which it was attributed. */
+  profile_bucket_s*      bucket;
+
+} profile_sample_s;
+
+/** The census count of live objects of a single layout. */
+typedef struct census_entry {
+
+  /** The layout; `NULL` if the entry is unused. */
+  const gc_layout_s* layout;
+
+  /** The number of live objects, and their total size. */
+  size_t       count;
+  size_t       bytes;
+
+} census_entry_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+bool             profile_enabled   = false;
+__thread int64_t profile_countdown = 0;
+
+/**
+ * Guards everything below:  the profile, and the random number generator from
+ * which every thread draws its sample distances.
+ */
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** The mean number of bytes between samples. */
+static size_t profile_interval = 0;
+
+/** The state of the random number generator used to draw sample distances. */
+static uint64_t profile_random = 0x2545f4914f6cdd1dULL;
+
+/** The hash table of buckets. */
+static profile_bucket_s* profile_buckets[PROFILE_BUCKETS];
+
+/** The sampled objects being tracked. */
+static profile_sample_s* profile_samples = NULL;
+
+/** The census of the most recent collection; open addressed by layout. */
+static census_entry_s* census         = NULL;
+static size_t          census_capacity = 0;
+static size_t          census_used     = 0;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Draw the number of bytes until the next sample, from an exponential
+ * distribution whose mean is the sampling interval.  The caller must hold
+ * `profile_lock`.
+ *
+ * \return The distance to the next sample.
+ */
+int64_t profile_next_distance () {
+
+  // Xorshift, then map to a uniform value in (0, 1].
+  profile_random ^= profile_random << 13;
+  profile_random ^= profile_random >> 7;
+  profile_random ^= profile_random << 17;
+  double uniform = ((profile_random >> 11) + 1) * (1.0 / 9007199254740992.0);
+
+  return (int64_t)(-log(uniform) * profile_interval) + 1;
+
+} // profile_next_distance ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Start the profiler, discarding any previous profile.
+ *
+ * \param sample_interval The mean number of bytes allocated between samples.
+ */
+void gc_profile_start (size_t sample_interval) {
+
+  gc_profile_stop();
+  gc_profile_reset();
+
+  pthread_mutex_lock(&profile_lock);
+  profile_interval  = sample_interval > 0 ? sample_interval : GC_PROFILE_DEFAULT_INTERVAL;
+  profile_countdown = profile_next_distance();
+  profile_enabled   = true;
+  pthread_mutex_unlock(&profile_lock);
+
+  // Route every allocation through `gc_new_slow()`, where it can be counted.
+  gc_alloc_buffers_disable();
+
+} // gc_profile_start ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Stop the profiler, keeping the profile gathered so far.
+ */
+void gc_profile_stop () {
+
+  profile_enabled = false;
+
+} // gc_profile_stop ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Discard the profile gathered so far.
+ */
+void gc_profile_reset () {
+
+  pthread_mutex_lock(&profile_lock);
+  for (int i = 0; i < PROFILE_BUCKETS; i += 1) {
+    while (profile_buckets[i] != NULL) {
+      profile_bucket_s* bucket = profile_buckets[i];
+      profile_buckets[i] = bucket->next;
+      free(bucket);
+    }
+  }
+  while (profile_samples != NULL) {
+    profile_sample_s* sample = profile_samples;
+    profile_samples = sample->next;
+    free(sample);
+  }
+  free(census);
+  census          = NULL;
+  census_capacity = 0;
+  census_used     = 0;
+  pthread_mutex_unlock(&profile_lock);
+
+} // gc_profile_reset ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record a sampled allocation, with a backtrace of its call site, and draw the
+ * distance to the next sample.
+ *
+ * \param obj    The allocated object.
+ * \param layout The object's layout.
+ * \param size   The object's size, in bytes.
+ * \param track  Whether to track the object, counting it as in use until a
+ *               collection finds it dead.
+ * \param site   The return address into the code that called the allocator,
+ *               at which the backtrace begins.
+ */
+void profile_sample (void* obj, const gc_layout_s* layout, size_t size, bool track, void* site) {
+
+  // Capture the call site, omitting the frames inside it.  How many there are
+  // depends on what the compiler inlined, so look for the site itself; if it
+  // is not found, keep every frame.
+  void* all_frames[PROFILE_MAX_DEPTH + PROFILE_MAX_SKIP];
+  int   depth = backtrace(all_frames, PROFILE_MAX_DEPTH + PROFILE_MAX_SKIP);
+  int   skip  = 0;
+  while (skip < depth && skip < PROFILE_MAX_SKIP && all_frames[skip] != site) {
+    skip += 1;
+  }
+  if (skip == depth || skip == PROFILE_MAX_SKIP) {
+    skip = 0;
+  }
+  void** frames = &all_frames[skip];
+  depth         = depth - skip > PROFILE_MAX_DEPTH ? PROFILE_MAX_DEPTH : depth - skip;
+
+  // Find its bucket.
+  pthread_mutex_lock(&profile_lock);
+  profile_countdown = profile_next_distance();
+  uintptr_t hash = (uintptr_t)layout;
+  for (int i = 0; i < depth; i += 1) {
+    hash = hash * 31 + (uintptr_t)frames[i];
+  }
+  profile_bucket_s** chain  = &profile_buckets[hash % PROFILE_BUCKETS];
+  profile_bucket_s*  bucket = *chain;
+  while (bucket != NULL &&
+	 (bucket->layout != layout ||
+	  bucket->depth  != depth  ||
+	  memcmp(bucket->frames, frames, depth * sizeof(void*)) != 0)) {
+    bucket = bucket->next;
+  }
+  if (bucket == NULL) {
+    bucket = calloc(1, sizeof(profile_bucket_s));
+    if (bucket == NULL) {
+      pthread_mutex_unlock(&profile_lock);
+      return;
+    }
+    bucket->layout = layout;
+    bucket->depth  = depth;
+    memcpy(bucket->frames, frames, depth * sizeof(void*));
+    bucket->next   = *chain;
+    *chain         = bucket;
+  }
+
+  bucket->alloc_count += 1;
+  bucket->alloc_bytes += size;
+
+  // Follow the object until it dies.
+  if (track) {
+    profile_sample_s* sample = malloc(sizeof(profile_sample_s));
+    if (sample == NULL) {
+      pthread_mutex_unlock(&profile_lock);
+      return;
+    }
+    sample->obj          = obj;
+    sample->size         = size;
+    sample->bucket       = bucket;
+    sample->next         = profile_samples;
+    profile_samples      = sample;
+    bucket->inuse_count += 1;
+    bucket->inuse_bytes += size;
+  }
+  pthread_mutex_unlock(&profile_lock);
+
+} // profile_sample ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Begin a new census of live objects, at the start of a collection.
+ */
+void profile_census_begin () {
+
+  pthread_mutex_lock(&profile_lock);
+  if (census != NULL) {
+    memset(census, 0, census_capacity * sizeof(census_entry_s));
+  }
+  census_used = 0;
+  pthread_mutex_unlock(&profile_lock);
+
+} // profile_census_begin ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Double the capacity of the census table.  The caller must hold
+ * `profile_lock`.
+ *
+ * \return `true` if successful; `false` if the table could not grow.
+ */
+bool census_grow () {
+
+  size_t          old_capacity = census_capacity;
+  census_entry_s* old_census   = census;
+
+  census_capacity = old_capacity == 0 ? CENSUS_INITIAL_CAPACITY : old_capacity * 2;
+  census          = calloc(census_capacity, sizeof(census_entry_s));
+  if (census == NULL) {
+    census          = old_census;
+    census_capacity = old_capacity;
+    return false;
+  }
+
+  // Rehash the existing entries.
+  for (size_t i = 0; i < old_capacity; i += 1) {
+    if (old_census[i].layout != NULL) {
+      size_t index = ((uintptr_t)old_census[i].layout >> 4) & (census_capacity - 1);
+      while (census[index].layout != NULL) {
+	index = (index + 1) & (census_capacity - 1);
+      }
+      census[index] = old_census[i];
+    }
+  }
+  free(old_census);
+
+  return true;
+
+} // census_grow ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Count a live object in the census.
+ *
+ * \param layout The object's layout.
+ * \param size   The object's size, in bytes.
+ */
+void profile_census_add (const gc_layout_s* layout, size_t size) {
+
+  pthread_mutex_lock(&profile_lock);
+  if (census_used * 2 >= census_capacity && !census_grow()) {
+    pthread_mutex_unlock(&profile_lock);
+    return;
+  }
+
+  size_t index = ((uintptr_t)layout >> 4) & (census_capacity - 1);
+  while (census[index].layout != layout && census[index].layout != NULL) {
+    index = (index + 1) & (census_capacity - 1);
+  }
+  if (census[index].layout == NULL) {
+    census[index].layout = layout;
+    census_used += 1;
+  }
+  census[index].count += 1;
+  census[index].bytes += size;
+  pthread_mutex_unlock(&profile_lock);
+
+} // profile_census_add ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Complete the census, ceasing to track the sampled objects that were found
+ * dead.
+ *
+ * \param is_live A function that determines whether an object was marked.
+ */
+void profile_census_end (bool (*is_live) (void* obj)) {
+
+  pthread_mutex_lock(&profile_lock);
+  profile_sample_s** link = &profile_samples;
+  while (*link != NULL) {
+    profile_sample_s* sample = *link;
+    if (is_live(sample->obj)) {
+      link = &sample->next;
+    } else {
+      sample->bucket->inuse_count -= 1;
+      sample->bucket->inuse_bytes -= sample->size;
+      *link = sample->next;
+      free(sample);
+    }
+  }
+  pthread_mutex_unlock(&profile_lock);
+
+} // profile_census_end ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Cease to track the sampled objects within a range of addresses, such as a
+ * heap being destroyed.
+ *
+ * \param start The start of the range.
+ * \param end   The end of the range.
+ */
+void profile_forget_range (void* start, void* end) {
+
+  pthread_mutex_lock(&profile_lock);
+  profile_sample_s** link = &profile_samples;
+  while (*link != NULL) {
+    profile_sample_s* sample = *link;
+    if (sample->obj < start || sample->obj >= end) {
+      link = &sample->next;
+    } else {
+      sample->bucket->inuse_count -= 1;
+      sample->bucket->inuse_bytes -= sample->size;
+      *link = sample->next;
+      free(sample);
+    }
+  }
+  pthread_mutex_unlock(&profile_lock);
+
+} // profile_forget_range ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Estimate the true number of bytes represented by a bucket's samples.  An
+ * allocation of `s` bytes is sampled with probability `1 - exp(-s/interval)`.
+ *
+ * \param count The number of samples.
+ * \param bytes Their total size.
+ * \return The estimated number of bytes allocated.
+ */
+double profile_unsample (size_t count, size_t bytes) {
+
+  if (count == 0) {
+    return 0.0;
+  }
+  double mean = (double)bytes / count;
+
+  return bytes / (1.0 - exp(-mean / profile_interval));
+
+} // profile_unsample ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write the profile as flat text:  the census, then the estimated allocation by
+ * layout, then the sampled call sites, symbolized where possible.
+ *
+ * \param out The stream to which to write.
+ */
+void profile_dump_text (FILE* out) {
+
+  fprintf(out, "# Live objects by layout, at the last collection\n");
+  fprintf(out, "%-18s %10s %6s %12s %14s\n", "layout", "size", "ptrs", "objects", "bytes");
+  for (size_t i = 0; i < census_capacity; i += 1) {
+    census_entry_s* entry = &census[i];
+    if (entry->layout != NULL) {
+      fprintf(out, "%-18p %10zu %6u %12zu %14zu\n",
+	      (void*)entry->layout, entry->layout->size, entry->layout->num_ptrs,
+	      entry->count, entry->bytes);
+    }
+  }
+
+  fprintf(out, "\n# Sampled allocation sites (mean interval %zu bytes)\n", profile_interval);
+  for (int i = 0; i < PROFILE_BUCKETS; i += 1) {
+    for (profile_bucket_s* bucket = profile_buckets[i]; bucket != NULL; bucket = bucket->next) {
+
+      fprintf(out, "layout %p: %zu samples, ~%.0f bytes allocated, ~%.0f bytes in use\n",
+	      (void*)bucket->layout, bucket->alloc_count,
+	      profile_unsample(bucket->alloc_count, bucket->alloc_bytes),
+	      profile_unsample(bucket->inuse_count, bucket->inuse_bytes));
+      char** symbols = backtrace_symbols(bucket->frames, bucket->depth);
+      for (int j = 0; j < bucket->depth; j += 1) {
+	fprintf(out, "    %s\n", symbols != NULL ? symbols[j] : "?");
+      }
+      free(symbols);
+
+    }
+  }
+
+} // profile_dump_text ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write the profile in the legacy text format of pprof's heap profiles, which
+ * `pprof` un-samples itself given the sampling interval in the header line.
+ *
+ * \param out The stream to which to write.
+ */
+void profile_dump_pprof (FILE* out) {
+
+  size_t inuse_count = 0, inuse_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+  for (int i = 0; i < PROFILE_BUCKETS; i += 1) {
+    for (profile_bucket_s* bucket = profile_buckets[i]; bucket != NULL; bucket = bucket->next) {
+      inuse_count += bucket->inuse_count;
+      inuse_bytes += bucket->inuse_bytes;
+      alloc_count += bucket->alloc_count;
+      alloc_bytes += bucket->alloc_bytes;
+    }
+  }
+
+  fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+	  inuse_count, inuse_bytes, alloc_count, alloc_bytes, profile_interval);
+  for (int i = 0; i < PROFILE_BUCKETS; i += 1) {
+    for (profile_bucket_s* bucket = profile_buckets[i]; bucket != NULL; bucket = bucket->next) {
+      fprintf(out, "%zu: %zu [%zu: %zu] @",
+	      bucket->inuse_count, bucket->inuse_bytes,
+	      bucket->alloc_count, bucket->alloc_bytes);
+      for (int j = 0; j < bucket->depth; j += 1) {
+	fprintf(out, " %p", bucket->frames[j]);
+      }
+      fprintf(out, "\n");
+    }
+  }
+
+  // Let pprof symbolize the addresses.
+  fprintf(out, "\nMAPPED_LIBRARIES:\n");
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if (maps != NULL) {
+    char   buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), maps)) > 0) {
+      fwrite(buffer, 1, length, out);
+    }
+    fclose(maps);
+  }
+
+} // profile_dump_pprof ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write the profile gathered so far to a file.
+ *
+ * \param path   The file to write.
+ * \param format `GC_PROFILE_TEXT` or `GC_PROFILE_PPROF`.
+ * \return `true` if successful; `false` if the file could not be written.
+ */
+bool gc_profile_dump (const char* path, gc_profile_format_t format) {
+
+  FILE* out = fopen(path, "w");
+  if (out == NULL) {
+    return false;
+  }
+
+  pthread_mutex_lock(&profile_lock);
+  if (format == GC_PROFILE_PPROF) {
+    profile_dump_pprof(out);
+  } else {
+    profile_dump_text(out);
+  }
+  pthread_mutex_unlock(&profile_lock);
+
+  return fclose(out) == 0;
+
+} // gc_profile_dump ()
+// ==============================================================================
@@ -0,0 +1,98 @@
+// ==============================================================================
+/**
+ * gc-profile.h
+ *
+ * The collector's interface to the sampling allocation profiler.  These are
+ * internal to the collector; programs use `gc_profile_*()` from `gc.h`.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// AVOID MULTIPLE INCLUSION
+
+#if !defined (_GC_PROFILE_H)
+#define _GC_PROFILE_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gc.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** Whether the profiler is running. */
+extern bool             profile_enabled;
+
+/**
+ * The number of bytes left for this thread to allocate before its next sample
+ * is taken.  The allocator subtracts each allocation's size, and samples once
+ * this reaches 0.
+ */
+extern __thread int64_t profile_countdown;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// FUNCTIONS
+
+/**
+ * Record a sampled allocation, with a backtrace of its call site, and draw the
+ * distance to the next sample.
+ *
+ * \param obj    The allocated object.
+ * \param layout The object's layout.
+ * \param size   The object's size, in bytes.
+ * \param track  Whether to track the object, counting it as in use until a
+ *               collection finds it dead.
+ * \param site   The return address into the code that called the allocator,
+ *               at which the backtrace begins.
+ */
+void profile_sample (void* obj, const gc_layout_s* layout, size_t size, bool track, void* site);
+
+/** Begin a new census of live objects, at the start of a collection. */
+void profile_census_begin ();
+
+/**
+ * Count a live object in the census; called as `mark()` marks each object.
+ *
+ * \param layout The object's layout.
+ * \param size   The object's size, in bytes.
+ */
+void profile_census_add (const gc_layout_s* layout, size_t size);
+
+/**
+ * Complete the census, before the sweep, ceasing to track the sampled objects
+ * that were found dead.
+ *
+ * \param is_live A function that determines whether an object was marked.
+ */
+void profile_census_end (bool (*is_live) (void* obj));
+
+/**
+ * Cease to track the sampled objects within a range of addresses, such as a
+ * heap being destroyed.
+ *
+ * \param start The start of the range.
+ * \param end   The end of the range.
+ */
+void profile_forget_range (void* start, void* end);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // !defined (_GC_PROFILE_H)
+// ==============================================================================
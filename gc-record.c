@@ -0,0 +1,836 @@
+// ==============================================================================
+/**
+ * gc-record.c
+ *
+ * A recording of a program's use of the heap:  its allocations (of objects,
+ * weak references and ephemeron tables), resizes, pointer stores, ephemeron
+ * table entries, root set insertions, regions and collections, written
+ * compactly enough that a
+ * whole run can be kept, and replayed by the `gcreplay` tool against other
+ * builds and policies of the collector.  Objects are known by the order of
+ * their allocation, so that a replay need not place them where the original
+ * run did.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gc.h"
+#include "gc-record.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS
+
+/** The size of the buffer of events not yet written. */
+#define RECORD_BUFFER_SIZE  65536
+
+/** The most bytes that a single event's type and arguments can take. */
+#define RECORD_MAX_EVENT    (1 + 4 * 10)
+
+/** The initial number of slots in a table; a power of two. */
+#define RECORD_TABLE_MIN    1024
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/**
+ * An open-addressed table from addresses (of objects or layouts) to their
+ * numbers in the recording.  An object's entry is removed when it is swept;
+ * an address reused by a new object is simply renumbered.
+ */
+typedef struct record_table {
+
+  /** The addresses; `NULL` marks an empty slot. */
+  const void** keys;
+
+  /** The numbers of those addresses. */
+  uint64_t*    values;
+
+  /** The number of slots; a power of two. */
+  size_t       capacity;
+
+  /** The number of slots in use. */
+  size_t       count;
+
+} record_table_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+bool                   gc_recording   = false;
+
+/** The heap being recorded. */
+static gc_heap_t*      record_heap    = NULL;
+
+/** The recording, and the events not yet written to it. */
+static int             record_fd      = -1;
+static unsigned char   record_buffer[RECORD_BUFFER_SIZE];
+static size_t          record_used    = 0;
+
+/** The numbers of the objects and layouts seen, and the next of each. */
+static record_table_s  record_objects = { NULL, NULL, 0, 0 };
+static record_table_s  record_layouts = { NULL, NULL, 0, 0 };
+static uint64_t        record_next_object = 1;
+static uint64_t        record_next_layout = 1;
+
+/** Serializes the recording of events. */
+static pthread_mutex_t record_lock    = PTHREAD_MUTEX_INITIALIZER;
+
+void (*record_move_hook) (void* from, void* to) = NULL;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the slot at which an address's probe sequence in a table begins.
+ *
+ * \param table The table.
+ * \param key   The address.
+ * \return The index of that slot.
+ */
+size_t record_home (record_table_s* table, const void* key) {
+
+  return (((uintptr_t)key >> 4) * 0x9e3779b97f4a7c15ULL) & (table->capacity - 1);
+
+} // record_home ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the slot of an address in a table.
+ *
+ * \param table The table.
+ * \param key   The address sought.
+ * \return The index of the slot holding `key`, or of the empty slot where it
+ *         would go.
+ */
+size_t record_slot (record_table_s* table, const void* key) {
+
+  size_t index = record_home(table, key);
+  while (table->keys[index] != NULL && table->keys[index] != key) {
+    index = (index + 1) & (table->capacity - 1);
+  }
+
+  return index;
+
+} // record_slot ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Look up the number of an address in a table.
+ *
+ * \param table The table.
+ * \param key   The address sought.
+ * \return Its number; `0` if it has none.
+ */
+uint64_t record_table_get (record_table_s* table, const void* key) {
+
+  if (table->capacity == 0) {
+    return 0;
+  }
+  size_t index = record_slot(table, key);
+
+  return table->keys[index] == NULL ? 0 : table->values[index];
+
+} // record_table_get ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Number an address in a table, replacing any number it had, and growing the
+ * table once it is half full.
+ *
+ * \param table The table.
+ * \param key   The address.
+ * \param value Its number.
+ * \return `true` if successful; `false` if the table could not be grown.
+ */
+bool record_table_put (record_table_s* table, const void* key, uint64_t value) {
+
+  if (2 * (table->count + 1) > table->capacity) {
+    record_table_s larger;
+    larger.capacity = table->capacity == 0 ? RECORD_TABLE_MIN : 2 * table->capacity;
+    larger.count    = 0;
+    larger.keys     = calloc(larger.capacity, sizeof(void*));
+    larger.values   = malloc(larger.capacity * sizeof(uint64_t));
+    if (larger.keys == NULL || larger.values == NULL) {
+      free(larger.keys);
+      free(larger.values);
+      return false;
+    }
+    for (size_t i = 0; i < table->capacity; i += 1) {
+      if (table->keys[i] != NULL) {
+	size_t index = record_slot(&larger, table->keys[i]);
+	larger.keys[index]   = table->keys[i];
+	larger.values[index] = table->values[i];
+	larger.count        += 1;
+      }
+    }
+    free(table->keys);
+    free(table->values);
+    *table = larger;
+  }
+
+  size_t index = record_slot(table, key);
+  if (table->keys[index] == NULL) {
+    table->keys[index] = key;
+    table->count      += 1;
+  }
+  table->values[index] = value;
+
+  return true;
+
+} // record_table_put ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Remove an address from a table, if it is there.  The entries after it in
+ * its run are shifted back as need be, so that no probe sequence is broken.
+ *
+ * \param table The table.
+ * \param key   The address.
+ */
+void record_table_remove (record_table_s* table, const void* key) {
+
+  if (table->capacity == 0) {
+    return;
+  }
+  size_t mask = table->capacity - 1;
+  size_t hole = record_slot(table, key);
+  if (table->keys[hole] == NULL) {
+    return;
+  }
+
+  // An entry may fill the hole if the hole lies between its home slot and its
+  // own, cyclically.
+  for (size_t index = (hole + 1) & mask; table->keys[index] != NULL; index = (index + 1) & mask) {
+    size_t home = record_home(table, table->keys[index]);
+    if (((index - home) & mask) >= ((index - hole) & mask)) {
+      table->keys[hole]   = table->keys[index];
+      table->values[hole] = table->values[index];
+      hole                = index;
+    }
+  }
+  table->keys[hole] = NULL;
+  table->count     -= 1;
+
+} // record_table_remove ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Remove the addresses within a range from a table:  all of them, or only those
+ * that a function finds are not live.
+ *
+ * \param table   The table.
+ * \param start   The start of the range.
+ * \param end     The end of the range.
+ * \param is_live A function that determines whether an address is live; `NULL`
+ *                to remove every address in the range.
+ */
+void record_table_sweep (record_table_s* table, const void* start, const void* end,
+			 bool (*is_live) (void* obj)) {
+
+  // A removal may shift a later entry back into the slot just emptied, and so
+  // that slot is looked at again.
+  size_t index = 0;
+  while (index < table->capacity) {
+    const void* key = table->keys[index];
+    if (key != NULL && key >= start && key < end && (is_live == NULL || !is_live((void*)key))) {
+      record_table_remove(table, key);
+    } else {
+      index += 1;
+    }
+  }
+
+} // record_table_sweep ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Empty a table, releasing its slots.
+ *
+ * \param table The table.
+ */
+void record_table_clear (record_table_s* table) {
+
+  free(table->keys);
+  free(table->values);
+  *table = (record_table_s){ NULL, NULL, 0, 0 };
+
+} // record_table_clear ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write the buffered events to the recording, retrying partial writes.
+ */
+void record_flush () {
+
+  const unsigned char* data = record_buffer;
+  while (record_used > 0) {
+    ssize_t written = write(record_fd, data, record_used);
+    if (written <= 0) {
+      break;
+    }
+    data        += written;
+    record_used -= written;
+  }
+  record_used = 0;
+
+} // record_flush ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Buffer the type of an event, first making room for all of its arguments.
+ *
+ * \param type The kind of event.
+ */
+void record_type (record_type_t type) {
+
+  if (record_used + RECORD_MAX_EVENT > RECORD_BUFFER_SIZE) {
+    record_flush();
+  }
+  record_buffer[record_used++] = type;
+
+} // record_type ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Buffer an argument of an event, as a varint:  seven bits per byte, least
+ * significant first, with the high bit set on every byte but the last.
+ *
+ * \param value The argument.
+ */
+void record_varint (uint64_t value) {
+
+  while (value >= 0x80) {
+    record_buffer[record_used++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  record_buffer[record_used++] = value;
+
+} // record_varint ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Buffer an argument that refers to an object, by its distance back from the
+ * next object number.
+ *
+ * \param number The object's number; `0` for `NULL`.
+ */
+void record_object (uint64_t number) {
+
+  record_varint(number == 0 ? 0 : record_next_object - number);
+
+} // record_object ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Obtain the number of a layout, recording the layout if it is new.
+ *
+ * \param layout The layout.
+ * \return Its number; `0` if it could not be numbered.
+ */
+uint64_t record_layout (const gc_layout_s* layout) {
+
+  uint64_t number = record_table_get(&record_layouts, layout);
+  if (number != 0) {
+    return number;
+  }
+  number = record_next_layout;
+  if (!record_table_put(&record_layouts, layout, number)) {
+    return 0;
+  }
+  record_next_layout += 1;
+
+  record_type(RECORD_LAYOUT);
+  record_varint(layout->size);
+  record_varint(layout->num_ptrs);
+  for (unsigned int i = 0; i < layout->num_ptrs; i += 1) {
+    size_t offset = layout->ptr_offsets[i];
+    if (record_used + RECORD_MAX_EVENT > RECORD_BUFFER_SIZE) {
+      record_flush();
+    }
+    record_varint((offset & ~GC_COMPRESSED_REF) << 1 | ((offset & GC_COMPRESSED_REF) != 0));
+  }
+  record_varint(layout->finalizer != NULL);
+
+  return number;
+
+} // record_layout ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record the allocation of an object in the current heap, if it is the heap
+ * being recorded.
+ *
+ * \param obj    The object.
+ * \param layout Its layout.
+ */
+void record_new (void* obj, const gc_layout_s* layout) {
+
+  if (gc_current_heap != record_heap) {
+    return;
+  }
+
+  pthread_mutex_lock(&record_lock);
+  uint64_t number = record_layout(layout);
+  if (number != 0 && record_table_put(&record_objects, obj, record_next_object)) {
+    record_next_object += 1;
+    record_type(RECORD_NEW);
+    record_varint(number);
+  }
+  pthread_mutex_unlock(&record_lock);
+
+} // record_new ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record the store of a pointer into one of an object's fields, if the object
+ * was allocated while recording.  A pointer to any other object is recorded as
+ * `NULL`.
+ *
+ * \param obj    The object.
+ * \param offset The field's offset, with `GC_COMPRESSED_REF` set for a
+ *               compressed reference.
+ * \param value  The pointer stored.
+ */
+void gc_record_store (void* obj, size_t offset, void* value) {
+
+  pthread_mutex_lock(&record_lock);
+  uint64_t number = record_table_get(&record_objects, obj);
+  if (number != 0) {
+    record_type(RECORD_STORE);
+    record_object(number);
+    record_varint((offset & ~GC_COMPRESSED_REF) << 1 | ((offset & GC_COMPRESSED_REF) != 0));
+    record_object(value == NULL ? 0 : record_table_get(&record_objects, value));
+  }
+  pthread_mutex_unlock(&record_lock);
+
+} // gc_record_store ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record the insertion of an object into a root set, if the object was
+ * allocated while recording (and so is in the heap being recorded).
+ *
+ * \param obj The object.
+ */
+void record_root (void* obj) {
+
+  pthread_mutex_lock(&record_lock);
+  uint64_t number = record_table_get(&record_objects, obj);
+  if (number != 0) {
+    record_type(RECORD_ROOT);
+    record_object(number);
+  }
+  pthread_mutex_unlock(&record_lock);
+
+} // record_root ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record a collection of the current heap, if it is the heap being recorded.
+ */
+void record_gc () {
+
+  if (gc_current_heap != record_heap) {
+    return;
+  }
+
+  pthread_mutex_lock(&record_lock);
+  record_type(RECORD_GC);
+  pthread_mutex_unlock(&record_lock);
+
+} // record_gc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record the resizing of an object, if it was allocated while recording.
+ *
+ * \param obj    The object.
+ * \param copy   The object into which it was moved; `obj` if it was resized in
+ *               place.
+ * \param layout Its new layout.
+ * \param kept   The number of bytes of its contents kept.
+ */
+void record_resize (void* obj, void* copy, const gc_layout_s* layout, size_t kept) {
+
+  pthread_mutex_lock(&record_lock);
+  uint64_t number = record_table_get(&record_objects, obj);
+  uint64_t layout_number;
+  if (number != 0 && (layout_number = record_layout(layout)) != 0) {
+    record_type(RECORD_RESIZE);
+    record_object(number);
+    record_varint(layout_number);
+    record_object(copy == obj ? 0 : record_table_get(&record_objects, copy));
+    record_varint(kept);
+  }
+  pthread_mutex_unlock(&record_lock);
+
+} // record_resize ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record the allocation of a weak reference in the current heap, if it is the
+ * heap being recorded.
+ *
+ * \param weak   The weak reference.
+ * \param target Its target.
+ */
+void record_weak (void* weak, void* target) {
+
+  if (gc_current_heap != record_heap) {
+    return;
+  }
+
+  pthread_mutex_lock(&record_lock);
+  uint64_t target_number = target == NULL ? 0 : record_table_get(&record_objects, target);
+  if (record_table_put(&record_objects, weak, record_next_object)) {
+    record_type(RECORD_WEAK);
+    record_object(target_number);
+    record_next_object += 1;
+  }
+  pthread_mutex_unlock(&record_lock);
+
+} // record_weak ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record the allocation of an ephemeron table in the current heap, if it is
+ * the heap being recorded.
+ *
+ * \param table    The table.
+ * \param capacity The capacity requested.
+ */
+void record_ephemeron_table (void* table, size_t capacity) {
+
+  if (gc_current_heap != record_heap) {
+    return;
+  }
+
+  pthread_mutex_lock(&record_lock);
+  if (record_table_put(&record_objects, table, record_next_object)) {
+    record_next_object += 1;
+    record_type(RECORD_EPHEMERON_TABLE);
+    record_varint(capacity);
+  }
+  pthread_mutex_unlock(&record_lock);
+
+} // record_ephemeron_table ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record an entry put into an ephemeron table, if both the table and the key
+ * were allocated while recording.  A value that was not is recorded as `NULL`.
+ *
+ * \param table The table.
+ * \param key   The key.
+ * \param value The value.
+ */
+void record_ephemeron_put (void* table, void* key, void* value) {
+
+  pthread_mutex_lock(&record_lock);
+  uint64_t number     = record_table_get(&record_objects, table);
+  uint64_t key_number = record_table_get(&record_objects, key);
+  if (number != 0 && key_number != 0) {
+    record_type(RECORD_EPHEMERON_PUT);
+    record_object(number);
+    record_object(key_number);
+    record_object(value == NULL ? 0 : record_table_get(&record_objects, value));
+  }
+  pthread_mutex_unlock(&record_lock);
+
+} // record_ephemeron_put ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record an entry removed from an ephemeron table, if both the table and the
+ * key were allocated while recording.
+ *
+ * \param table The table.
+ * \param key   The key.
+ */
+void record_ephemeron_remove (void* table, void* key) {
+
+  pthread_mutex_lock(&record_lock);
+  uint64_t number     = record_table_get(&record_objects, table);
+  uint64_t key_number = record_table_get(&record_objects, key);
+  if (number != 0 && key_number != 0) {
+    record_type(RECORD_EPHEMERON_REMOVE);
+    record_object(number);
+    record_object(key_number);
+  }
+  pthread_mutex_unlock(&record_lock);
+
+} // record_ephemeron_remove ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record the opening or closing of a region in the current heap, if it is the
+ * heap being recorded.
+ *
+ * \param begin `true` if the region was opened; `false` if it was closed.
+ */
+void record_region (bool begin) {
+
+  if (gc_current_heap != record_heap) {
+    return;
+  }
+
+  pthread_mutex_lock(&record_lock);
+  record_type(begin ? RECORD_REGION_BEGIN : RECORD_REGION_END);
+  pthread_mutex_unlock(&record_lock);
+
+} // record_region ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Note that an object has been promoted out of a region:  its copy takes over
+ * its number, if it has one, and `record_move_hook` is told, if it is set.
+ *
+ * \param from The object.
+ * \param to   Its copy.
+ */
+void record_move (void* from, void* to) {
+
+  if (gc_recording) {
+    pthread_mutex_lock(&record_lock);
+    uint64_t number = record_table_get(&record_objects, from);
+    if (number != 0) {
+      record_table_remove(&record_objects, from);
+      record_table_put(&record_objects, to, number);
+    }
+    pthread_mutex_unlock(&record_lock);
+  }
+
+  if (record_move_hook != NULL) {
+    record_move_hook(from, to);
+  }
+
+} // record_move ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Forget a swept object.
+ *
+ * \param obj The object.
+ */
+void record_forget (void* obj) {
+
+  pthread_mutex_lock(&record_lock);
+  record_table_remove(&record_objects, obj);
+  pthread_mutex_unlock(&record_lock);
+
+} // record_forget ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Forget the objects that a collection found dead but does not free one by
+ * one, such as those on an Immix heap's lines.
+ *
+ * \param is_live A function that determines whether an object survived.
+ */
+void record_forget_dead (bool (*is_live) (void* obj)) {
+
+  pthread_mutex_lock(&record_lock);
+  record_table_sweep(&record_objects, NULL, (void*)UINTPTR_MAX, is_live);
+  pthread_mutex_unlock(&record_lock);
+
+} // record_forget_dead ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Forget the objects within a range of addresses that is being released at
+ * once, such as a region's chunks.
+ *
+ * \param start The start of the range.
+ * \param end   The end of the range.
+ */
+void record_forget_range (void* start, void* end) {
+
+  pthread_mutex_lock(&record_lock);
+  record_table_sweep(&record_objects, start, end, NULL);
+  pthread_mutex_unlock(&record_lock);
+
+} // record_forget_range ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Start recording the current heap's use to a file, replacing any recording
+ * already being made.
+ *
+ * \param path The file to write.
+ * \return `true` if recording has started; `false` if the file could not be
+ *         created.
+ */
+bool gc_record_start (const char* path) {
+
+  gc_record_stop();
+
+  record_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (record_fd < 0) {
+    return false;
+  }
+
+  record_file_header_s header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+  header.version = RECORD_VERSION;
+  if (write(record_fd, &header, sizeof(header)) != sizeof(header)) {
+    close(record_fd);
+    record_fd = -1;
+    return false;
+  }
+
+  record_heap        = gc_current_heap;
+  record_used        = 0;
+  record_next_object = 1;
+  record_next_layout = 1;
+  gc_recording       = true;
+
+  // Route every allocation through `gc_new_slow()`, where it can be recorded.
+  gc_alloc_buffers_disable();
+
+  return true;
+
+} // gc_record_start ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Stop recording, writing out the events still buffered and closing the file.
+ */
+void gc_record_stop () {
+
+  if (record_fd < 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&record_lock);
+  gc_recording = false;
+  record_flush();
+  close(record_fd);
+  record_fd   = -1;
+  record_heap = NULL;
+  record_table_clear(&record_objects);
+  record_table_clear(&record_layouts);
+  pthread_mutex_unlock(&record_lock);
+
+} // gc_record_stop ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Stop recording if a heap being destroyed is the heap being recorded, since
+ * the numbers of its objects would otherwise outlive them.
+ *
+ * \param heap The heap.
+ */
+void record_heap_destroy (gc_heap_t* heap) {
+
+  if (heap == record_heap) {
+    gc_record_stop();
+  }
+
+} // record_heap_destroy ()
+// ==============================================================================
@@ -0,0 +1,280 @@
+// ==============================================================================
+/**
+ * gc-record.h
+ *
+ * The collector's interface to allocation recording, and the format of the
+ * recordings that it writes.  These are internal to the collector and to the
+ * `gcreplay` tool; programs use `gc_record_*()` and `gc_store*()` from `gc.h`.
+ *
+ * A recording is a `record_file_header_s`, followed by events.  Each event is
+ * a byte, its `record_type_t`, followed by its arguments, each an unsigned
+ * LEB128 varint.  Layouts and objects are numbered from 1, in the order in
+ * which they are first seen; an object is referred to by its distance back
+ * from the next object number, so that recent objects take a single byte, and
+ * `0` refers to `NULL`.  Objects, weak references and ephemeron tables share
+ * one numbering.  An object keeps its number when `gc_region_end()` promotes
+ * it, and loses it when it is swept.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// AVOID MULTIPLE INCLUSION
+
+#if !defined (_GC_RECORD_H)
+#define _GC_RECORD_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gc.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS
+
+/** The magic number at the start of every recording. */
+#define RECORD_MAGIC   "GCRECRD"
+
+/** The version of the recording format. */
+#define RECORD_VERSION 2
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** The kinds of events in a recording. */
+typedef enum record_type {
+
+  /**
+   * A layout was first used.  Its arguments are its size, its number of
+   * pointers, each pointer's offset (shifted left one bit, with the low bit
+   * set for a compressed reference), and whether it has a finalizer.
+   */
+  RECORD_LAYOUT,
+
+  /** An object was allocated.  Its argument is the number of its layout. */
+  RECORD_NEW,
+
+  /**
+   * A pointer was stored.  Its arguments are the object, the offset of the
+   * field (encoded as a layout's), and the object stored.
+   */
+  RECORD_STORE,
+
+  /** An object was inserted into the root set.  Its argument is the object. */
+  RECORD_ROOT,
+
+  /** A collection was requested.  It has no arguments. */
+  RECORD_GC,
+
+  /**
+   * An object was resized.  Its arguments are the object, the number of its
+   * new layout, the copy into which it was moved (allocated by the preceding
+   * `RECORD_NEW`), or `NULL` if it was resized in place, and the number of
+   * bytes of its contents kept.
+   */
+  RECORD_RESIZE,
+
+  /** A weak reference was allocated.  Its argument is its target. */
+  RECORD_WEAK,
+
+  /**
+   * An ephemeron table was allocated.  Its argument is the capacity
+   * requested.
+   */
+  RECORD_EPHEMERON_TABLE,
+
+  /**
+   * An entry was put into an ephemeron table.  Its arguments are the table,
+   * the key and the value.
+   */
+  RECORD_EPHEMERON_PUT,
+
+  /**
+   * An entry was removed from an ephemeron table.  Its arguments are the
+   * table and the key.
+   */
+  RECORD_EPHEMERON_REMOVE,
+
+  /** A region was opened.  It has no arguments. */
+  RECORD_REGION_BEGIN,
+
+  /** The open region was closed.  It has no arguments. */
+  RECORD_REGION_END,
+
+  RECORD_NUM_TYPES
+
+} record_type_t;
+
+/** The header at the start of a recording, followed by its events. */
+typedef struct record_file_header {
+
+  /** `RECORD_MAGIC`, terminated. */
+  char     magic[8];
+
+  /** `RECORD_VERSION`. */
+  uint32_t version;
+
+  /** Unused; zero. */
+  uint32_t reserved;
+
+} record_file_header_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/**
+ * A function to tell of each object that `gc_region_end()` promotes, and of
+ * its copy, if set.  It lets `gcreplay` follow the objects that it replays.
+ */
+extern void (*record_move_hook) (void* from, void* to);
+// ==============================================================================
+
+
+
+// ==============================================================================
+// FUNCTIONS
+
+/**
+ * Record the allocation of an object in the current heap.  Callers should
+ * first check `gc_recording`.
+ *
+ * \param obj    The object.
+ * \param layout Its layout.
+ */
+void record_new (void* obj, const gc_layout_s* layout);
+
+/**
+ * Record the insertion of an object into the recorded heap's root set.
+ * Callers should first check `gc_recording`.
+ *
+ * \param obj The object.
+ */
+void record_root (void* obj);
+
+/**
+ * Record a collection of the current heap.  Callers should first check
+ * `gc_recording`.
+ */
+void record_gc ();
+
+/**
+ * Record the resizing of an object by `gc_resize()`.  Callers should first
+ * check `gc_recording`.
+ *
+ * \param obj    The object.
+ * \param copy   The object into which it was moved; `obj` if it was resized in
+ *               place.
+ * \param layout Its new layout.
+ * \param kept   The number of bytes of its contents kept.
+ */
+void record_resize (void* obj, void* copy, const gc_layout_s* layout, size_t kept);
+
+/**
+ * Record the allocation of a weak reference in the current heap.  Callers
+ * should first check `gc_recording`.
+ *
+ * \param weak   The weak reference.
+ * \param target Its target.
+ */
+void record_weak (void* weak, void* target);
+
+/**
+ * Record the allocation of an ephemeron table in the current heap.  Callers
+ * should first check `gc_recording`.
+ *
+ * \param table    The table.
+ * \param capacity The capacity requested.
+ */
+void record_ephemeron_table (void* table, size_t capacity);
+
+/**
+ * Record an entry put into an ephemeron table.  Callers should first check
+ * `gc_recording`.
+ *
+ * \param table The table.
+ * \param key   The key.
+ * \param value The value.
+ */
+void record_ephemeron_put (void* table, void* key, void* value);
+
+/**
+ * Record an entry removed from an ephemeron table.  Callers should first
+ * check `gc_recording`.
+ *
+ * \param table The table.
+ * \param key   The key.
+ */
+void record_ephemeron_remove (void* table, void* key);
+
+/**
+ * Record the opening (or closing) of a region in the current heap.  Callers
+ * should first check `gc_recording`.
+ *
+ * \param begin `true` if the region was opened; `false` if it was closed.
+ */
+void record_region (bool begin);
+
+/**
+ * Note that `gc_region_end()` has promoted an object:  renumber it, if it is
+ * being recorded, and tell `record_move_hook`, if it is set.
+ *
+ * \param from The object.
+ * \param to   Its copy.
+ */
+void record_move (void* from, void* to);
+
+/**
+ * Forget a swept object, so that its number is not given to whatever is later
+ * placed at its address.  Callers should first check `gc_recording`.
+ *
+ * \param obj The object.
+ */
+void record_forget (void* obj);
+
+/**
+ * Forget the objects that a collection found dead but does not free one by
+ * one, such as those on an Immix heap's lines.  Callers should first check
+ * `gc_recording`.
+ *
+ * \param is_live A function that determines whether an object survived.
+ */
+void record_forget_dead (bool (*is_live) (void* obj));
+
+/**
+ * Forget the objects within a range of addresses that is being released at
+ * once, such as a region's chunks.  Callers should first check `gc_recording`.
+ *
+ * \param start The start of the range.
+ * \param end   The end of the range.
+ */
+void record_forget_range (void* start, void* end);
+
+/**
+ * Stop recording if a heap being destroyed is the heap being recorded.
+ *
+ * \param heap The heap.
+ */
+void record_heap_destroy (gc_heap_t* heap);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _GC_RECORD_H
+// ==============================================================================
@@ -0,0 +1,790 @@
+// ==============================================================================
+/**
+ * gc-replay.c
+ *
+ * The `gcreplay` tool, which re-executes a recording made by
+ * `gc_record_start()` against this build of the collector, and reports how it
+ * fared:  the throughput of the run as a whole, the collections' pause times,
+ * and the heap's peak size.
+ *
+ *   gcreplay [--immix] <recording>
+ *
+ * With `--immix`, the recording is replayed on a `GC_HEAP_IMMIX` heap, rather
+ * than on the default heap.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gc.h"
+#include "gc-record.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS
+
+#define NS_PER_S  1000000000.0
+#define NS_PER_MS 1000000.0
+#define MB        (1024.0 * 1024.0)
+
+/**
+ * The largest ephemeron table capacity believed; a recording that asks for
+ * more is taken to be malformed.
+ */
+#define REPLAY_MAX_CAPACITY ((uint64_t)1 << 32)
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** A growable array of pointers, indexed by number. */
+typedef struct replay_table {
+
+  void**   items;
+  uint64_t count;
+  uint64_t capacity;
+
+} replay_table_s;
+
+/** An object promoted by `gc_region_end()`, and its copy. */
+typedef struct replay_move {
+
+  void* from;
+  void* to;
+
+} replay_move_s;
+
+/** The state of a replay. */
+typedef struct replay {
+
+  /** The events not yet replayed, and their end. */
+  const unsigned char* pos;
+  const unsigned char* end;
+
+  /** The layouts and objects, by number; the first of each is unused. */
+  replay_table_s       layouts;
+  replay_table_s       objects;
+
+  /**
+   * The layout of each object, by number:  `replay_weak_layout` for a weak
+   * reference, and `replay_ephemeron_layout` for an ephemeron table.
+   */
+  replay_table_s       shapes;
+
+  /** Whether a region is open, and the number of its first object. */
+  bool                 region_open;
+  uint64_t             region_first;
+
+  /** The objects promoted by closing a region, and whether any went unnoted. */
+  replay_move_s*       moves;
+  uint64_t             num_moves;
+  uint64_t             max_moves;
+  bool                 moves_lost;
+
+  /** What has been replayed. */
+  uint64_t             events;
+  uint64_t             allocations;
+  uint64_t             allocated_bytes;
+  uint64_t             stores;
+  uint64_t             resizes;
+  uint64_t             roots;
+  uint64_t             regions;
+
+  /** The pause time of each collection, in nanoseconds. */
+  uint64_t*            pauses;
+  uint64_t             num_pauses;
+  uint64_t             max_pauses;
+
+  /** The largest that the heap has been seen to be. */
+  size_t               peak_extent;
+  size_t               peak_live;
+
+} replay_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/**
+ * The stand-in layouts of weak references and ephemeron tables, into neither
+ * of which may pointers be stored.
+ */
+static const gc_layout_s replay_weak_layout      = { 0, 0, NULL, NULL };
+static const gc_layout_s replay_ephemeron_layout = { 0, 0, NULL, NULL };
+
+/** The replay whose region is being closed, to which promotions are told. */
+static replay_s*         replay_closing          = NULL;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read the monotonic clock, in nanoseconds.
+ *
+ * \return Its time.
+ */
+uint64_t replay_clock () {
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * (uint64_t)NS_PER_S + now.tv_nsec;
+
+} // replay_clock ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The finalizer given to replayed objects whose original layouts had one, so
+ * that they are queued, and survive, as the originals did.
+ *
+ * \param obj Unused.
+ */
+void replay_finalize (void* obj) {
+
+  (void)obj;
+
+} // replay_finalize ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Append an item to a table, numbering it from 1.
+ *
+ * \param table The table.
+ * \param item  The item.
+ * \return `true` if successful; `false` if the table could not be grown.
+ */
+bool replay_table_add (replay_table_s* table, void* item) {
+
+  if (table->count + 1 >= table->capacity) {
+    uint64_t capacity = table->capacity == 0 ? 1024 : 2 * table->capacity;
+    void**   larger   = realloc(table->items, capacity * sizeof(void*));
+    if (larger == NULL) {
+      return false;
+    }
+    table->items    = larger;
+    table->capacity = capacity;
+  }
+  table->items[++table->count] = item;
+
+  return true;
+
+} // replay_table_add ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Number a newly allocated object.
+ *
+ * \param replay The replay.
+ * \param obj    The object.
+ * \param layout Its layout, or stand-in layout.
+ * \return `true` if successful; `false` if the tables could not be grown.
+ */
+bool replay_add_object (replay_s* replay, void* obj, const gc_layout_s* layout) {
+
+  return (replay_table_add(&replay->objects, obj) &&
+	  replay_table_add(&replay->shapes, (void*)layout));
+
+} // replay_add_object ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read a varint argument.
+ *
+ * \param replay The replay.
+ * \param value  Where to store the argument.
+ * \return `true` if successful; `false` if the recording ends first.
+ */
+bool replay_varint (replay_s* replay, uint64_t* value) {
+
+  *value = 0;
+  for (int shift = 0; replay->pos < replay->end && shift < 64; shift += 7) {
+    unsigned char byte = *replay->pos++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+
+} // replay_varint ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read an argument that refers to an object.
+ *
+ * \param replay The replay.
+ * \param obj    Where to store the object; `NULL` for `NULL`.
+ * \param number Where to store the object's number; `0` for `NULL`.  May be
+ *               `NULL`.
+ * \return `true` if successful; `false` if the argument is malformed.
+ */
+bool replay_object (replay_s* replay, void** obj, uint64_t* number) {
+
+  uint64_t distance;
+  if (!replay_varint(replay, &distance) || distance > replay->objects.count) {
+    return false;
+  }
+  uint64_t index = distance == 0 ? 0 : replay->objects.count + 1 - distance;
+  *obj = index == 0 ? NULL : replay->objects.items[index];
+  if (number != NULL) {
+    *number = index;
+  }
+
+  return true;
+
+} // replay_object ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Rebuild a layout from its arguments.
+ *
+ * \param replay The replay.
+ * \return `true` if successful; `false` if the arguments are malformed.
+ */
+bool replay_layout (replay_s* replay) {
+
+  uint64_t size, num_ptrs, finalized;
+  if (!replay_varint(replay, &size) || !replay_varint(replay, &num_ptrs) ||
+      num_ptrs > size / sizeof(gc_ref_t)) {
+    return false;
+  }
+
+  gc_layout_s* layout  = malloc(sizeof(gc_layout_s));
+  size_t*      offsets = malloc((num_ptrs + 1) * sizeof(size_t));
+  bool         read    = layout != NULL && offsets != NULL;
+  for (uint64_t i = 0; read && i < num_ptrs; i += 1) {
+    uint64_t offset = 0;
+    read       = replay_varint(replay, &offset);
+    offsets[i] = offset & 1 ? GC_REF_OFFSET(offset >> 1) : offset >> 1;
+  }
+  if (!read || !replay_varint(replay, &finalized)) {
+    free(layout);
+    free(offsets);
+    return false;
+  }
+  layout->size        = size;
+  layout->num_ptrs    = num_ptrs;
+  layout->ptr_offsets = offsets;
+  layout->finalizer   = finalized ? replay_finalize : NULL;
+  if (!replay_table_add(&replay->layouts, layout)) {
+    free(layout);
+    free(offsets);
+    return false;
+  }
+
+  return true;
+
+} // replay_layout ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Note an object promoted out of the region being closed; installed as
+ * `record_move_hook` while `gc_region_end()` runs.
+ *
+ * \param from The object.
+ * \param to   Its copy.
+ */
+void replay_note_move (void* from, void* to) {
+
+  replay_s* replay = replay_closing;
+  if (replay->num_moves == replay->max_moves) {
+    uint64_t       max    = replay->max_moves == 0 ? 256 : 2 * replay->max_moves;
+    replay_move_s* larger = realloc(replay->moves, max * sizeof(replay_move_s));
+    if (larger == NULL) {
+      replay->moves_lost = true;
+      return;
+    }
+    replay->moves     = larger;
+    replay->max_moves = max;
+  }
+  replay->moves[replay->num_moves++] = (replay_move_s){ from, to };
+
+} // replay_note_move ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Compare two promotions by the objects promoted, for sorting and searching.
+ */
+int compare_moves (const void* a, const void* b) {
+
+  uintptr_t x = (uintptr_t)((const replay_move_s*)a)->from;
+  uintptr_t y = (uintptr_t)((const replay_move_s*)b)->from;
+  return x < y ? -1 : x > y;
+
+} // compare_moves ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Close the open region, and renumber the region's objects that were promoted
+ * to their copies.
+ *
+ * \param replay The replay.
+ * \return `true` if successful; `false` if some promotions could not be kept.
+ */
+bool replay_region_end (replay_s* replay) {
+
+  replay->num_moves  = 0;
+  replay->moves_lost = false;
+  replay_closing     = replay;
+  record_move_hook  = replay_note_move;
+  gc_region_end();
+  record_move_hook  = NULL;
+  replay_closing    = NULL;
+
+  qsort(replay->moves, replay->num_moves, sizeof(replay_move_s), compare_moves);
+  for (uint64_t i = replay->region_first; i <= replay->objects.count; i += 1) {
+    replay_move_s  key  = { replay->objects.items[i], NULL };
+    replay_move_s* move = bsearch(&key, replay->moves, replay->num_moves,
+				  sizeof(replay_move_s), compare_moves);
+    if (move != NULL) {
+      replay->objects.items[i] = move->to;
+    }
+  }
+  replay->region_open = false;
+
+  return !replay->moves_lost;
+
+} // replay_region_end ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Collect the heap, timing the pause, and note the heap's size afterwards.
+ *
+ * \param replay The replay.
+ * \param heap   The heap.
+ * \return `true` if successful; `false` if the pause could not be kept.
+ */
+bool replay_gc (replay_s* replay, gc_heap_t* heap) {
+
+  uint64_t start = replay_clock();
+  gc();
+  uint64_t pause = replay_clock() - start;
+
+  if (replay->num_pauses == replay->max_pauses) {
+    uint64_t  max    = replay->max_pauses == 0 ? 256 : 2 * replay->max_pauses;
+    uint64_t* larger = realloc(replay->pauses, max * sizeof(uint64_t));
+    if (larger == NULL) {
+      return false;
+    }
+    replay->pauses     = larger;
+    replay->max_pauses = max;
+  }
+  replay->pauses[replay->num_pauses++] = pause;
+
+  // Run the finalizers of whatever was queued, outside of the pause.
+  gc_finalize(0);
+
+  gc_stats_s stats;
+  gc_heap_stats(heap, &stats);
+  if (stats.extent > replay->peak_extent) {
+    replay->peak_extent = stats.extent;
+  }
+  if (stats.live_bytes > replay->peak_live) {
+    replay->peak_live = stats.live_bytes;
+  }
+
+  return true;
+
+} // replay_gc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Replay every event of a recording.
+ *
+ * \param replay The replay.
+ * \param heap   The heap on which to replay it, which is current.
+ * \return `NULL` if successful; otherwise, a description of what went wrong.
+ */
+const char* replay_run (replay_s* replay, gc_heap_t* heap) {
+
+  while (replay->pos < replay->end) {
+
+    record_type_t type = *replay->pos++;
+    replay->events += 1;
+    switch (type) {
+
+    case RECORD_LAYOUT:
+      if (!replay_layout(replay)) {
+	return "malformed layout";
+      }
+      break;
+
+    case RECORD_NEW: {
+      uint64_t number;
+      if (!replay_varint(replay, &number) || number == 0 || number > replay->layouts.count) {
+	return "malformed allocation";
+      }
+      const gc_layout_s* layout = replay->layouts.items[number];
+      void*              obj    = gc_new(layout);
+      if (obj == NULL) {
+	return "heap exhausted";
+      }
+      // The program initialized its fields, but only its stores of pointers
+      // were recorded; any pointer not yet stored must read as `NULL`.
+      memset(obj, 0, layout->size);
+      if (!replay_add_object(replay, obj, layout)) {
+	return "out of memory";
+      }
+      replay->allocations     += 1;
+      replay->allocated_bytes += layout->size;
+      break;
+    }
+
+    case RECORD_STORE: {
+      void*    obj;
+      void*    value;
+      uint64_t number;
+      uint64_t offset;
+      if (!replay_object(replay, &obj, &number) || obj == NULL ||
+	  !replay_varint(replay, &offset) || !replay_object(replay, &value, NULL)) {
+	return "malformed store";
+      }
+      const gc_layout_s* layout = replay->shapes.items[number];
+      size_t             width  = offset & 1 ? sizeof(gc_ref_t) : sizeof(void*);
+      if (offset >> 1 > layout->size || layout->size - (offset >> 1) < width) {
+	return "store outside of object";
+      }
+      if (offset & 1) {
+	gc_store_ref(obj, (gc_ref_t*)(obj + (offset >> 1)), value);
+      } else {
+	gc_store(obj, (void**)(obj + (offset >> 1)), value);
+      }
+      replay->stores += 1;
+      break;
+    }
+
+    case RECORD_ROOT: {
+      void* obj;
+      if (!replay_object(replay, &obj, NULL) || obj == NULL) {
+	return "malformed root";
+      }
+      gc_root_set_insert(obj);
+      replay->roots += 1;
+      break;
+    }
+
+    case RECORD_GC:
+      if (!replay_gc(replay, heap)) {
+	return "out of memory";
+      }
+      break;
+
+    case RECORD_RESIZE: {
+      void*    obj;
+      void*    copy;
+      uint64_t number, layout_number, copy_number, kept;
+      if (!replay_object(replay, &obj, &number) || obj == NULL ||
+	  !replay_varint(replay, &layout_number) ||
+	  layout_number == 0 || layout_number > replay->layouts.count ||
+	  !replay_object(replay, &copy, &copy_number) || !replay_varint(replay, &kept)) {
+	return "malformed resize";
+      }
+      const gc_layout_s* old_layout = replay->shapes.items[number];
+      const gc_layout_s* layout     = replay->layouts.items[layout_number];
+      if (old_layout == &replay_weak_layout || old_layout == &replay_ephemeron_layout ||
+	  kept > old_layout->size || kept > layout->size ||
+	  (copy != NULL && replay->shapes.items[copy_number] != layout)) {
+	return "malformed resize";
+      }
+      if (copy == NULL) {
+	// Resized in place, originally; here, the object may yet move.
+	void* resized = gc_resize(obj, layout);
+	if (resized == NULL) {
+	  return "heap exhausted";
+	}
+	replay->objects.items[number] = resized;
+	replay->shapes.items[number]  = (void*)layout;
+      } else {
+	memcpy(copy, obj, kept);
+      }
+      replay->resizes += 1;
+      break;
+    }
+
+    case RECORD_WEAK: {
+      void* target;
+      if (!replay_object(replay, &target, NULL)) {
+	return "malformed weak reference";
+      }
+      gc_weak_ref_t* weak = gc_weak_new(target);
+      if (weak == NULL) {
+	return "heap exhausted";
+      }
+      if (!replay_add_object(replay, weak, &replay_weak_layout)) {
+	return "out of memory";
+      }
+      replay->allocations += 1;
+      break;
+    }
+
+    case RECORD_EPHEMERON_TABLE: {
+      uint64_t capacity;
+      if (!replay_varint(replay, &capacity) || capacity > REPLAY_MAX_CAPACITY) {
+	return "malformed ephemeron table";
+      }
+      gc_ephemeron_table_t* table = gc_ephemeron_table_new(capacity);
+      if (table == NULL) {
+	return "heap exhausted";
+      }
+      if (!replay_add_object(replay, table, &replay_ephemeron_layout)) {
+	return "out of memory";
+      }
+      replay->allocations += 1;
+      break;
+    }
+
+    case RECORD_EPHEMERON_PUT:
+    case RECORD_EPHEMERON_REMOVE: {
+      void*    table;
+      void*    key;
+      void*    value = NULL;
+      uint64_t number;
+      if (!replay_object(replay, &table, &number) || table == NULL ||
+	  replay->shapes.items[number] != &replay_ephemeron_layout ||
+	  !replay_object(replay, &key, NULL) || key == NULL ||
+	  (type == RECORD_EPHEMERON_PUT && !replay_object(replay, &value, NULL))) {
+	return "malformed ephemeron table entry";
+      }
+      if (type == RECORD_EPHEMERON_REMOVE) {
+	gc_ephemeron_table_remove(table, key);
+      } else if (!gc_ephemeron_table_put(table, key, value)) {
+	return "ephemeron table full";
+      }
+      replay->stores += 1;
+      break;
+    }
+
+    case RECORD_REGION_BEGIN:
+      if (replay->region_open) {
+	return "malformed region";
+      }
+      gc_region_begin();
+      replay->region_open  = true;
+      replay->region_first = replay->objects.count + 1;
+      replay->regions     += 1;
+      break;
+
+    case RECORD_REGION_END:
+      if (!replay->region_open) {
+	return "malformed region";
+      }
+      if (!replay_region_end(replay)) {
+	return "out of memory";
+      }
+      break;
+
+    default:
+      return "unknown event type";
+
+    }
+
+  }
+
+  return NULL;
+
+} // replay_run ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Compare two pause times, for sorting.
+ */
+int compare_pauses (const void* a, const void* b) {
+
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+
+} // compare_pauses ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Report the results of a replay.
+ *
+ * \param out     The output.
+ * \param replay  The replay.
+ * \param elapsed The time taken by the whole replay, in nanoseconds.
+ */
+void replay_report (FILE* out, replay_s* replay, uint64_t elapsed) {
+
+  double seconds = elapsed / NS_PER_S;
+  fprintf(out, "events       %" PRIu64 "\n", replay->events);
+  fprintf(out, "allocations  %" PRIu64 " (%.1f MB)\n",
+	  replay->allocations, replay->allocated_bytes / MB);
+  fprintf(out, "stores       %" PRIu64 "\n", replay->stores);
+  fprintf(out, "resizes      %" PRIu64 "\n", replay->resizes);
+  fprintf(out, "roots        %" PRIu64 "\n", replay->roots);
+  fprintf(out, "regions      %" PRIu64 "\n", replay->regions);
+  fprintf(out, "time         %.3f ms\n", elapsed / NS_PER_MS);
+  fprintf(out, "throughput   %.0f allocations/s, %.1f MB/s\n",
+	  replay->allocations / seconds, replay->allocated_bytes / MB / seconds);
+
+  fprintf(out, "collections  %" PRIu64 "\n", replay->num_pauses);
+  if (replay->num_pauses > 0) {
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < replay->num_pauses; i += 1) {
+      total += replay->pauses[i];
+    }
+    qsort(replay->pauses, replay->num_pauses, sizeof(uint64_t), compare_pauses);
+    uint64_t n = replay->num_pauses;
+    fprintf(out, "pauses       total %.3f ms (%.1f%%), mean %.3f ms, "
+	    "median %.3f ms, p99 %.3f ms, max %.3f ms\n",
+	    total / NS_PER_MS, 100.0 * total / elapsed, total / NS_PER_MS / n,
+	    replay->pauses[n / 2] / NS_PER_MS, replay->pauses[(n - 1) * 99 / 100] / NS_PER_MS,
+	    replay->pauses[n - 1] / NS_PER_MS);
+  }
+
+  fprintf(out, "peak heap    %.1f MB extent, %.1f MB live\n",
+	  replay->peak_extent / MB, replay->peak_live / MB);
+
+} // replay_report ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+int main (int argc, char** argv) {
+
+  bool        immix = false;
+  const char* path  = NULL;
+  for (int i = 1; i < argc; i += 1) {
+    if (strcmp(argv[i], "--immix") == 0) {
+      immix = true;
+    } else if (path == NULL) {
+      path = argv[i];
+    } else {
+      path = NULL;
+      break;
+    }
+  }
+  if (path == NULL) {
+    fprintf(stderr, "usage: %s [--immix] <recording>\n", argv[0]);
+    return 1;
+  }
+
+  // Read the whole recording first, so that the replay does no I/O.
+  FILE* in = fopen(path, "rb");
+  if (in == NULL) {
+    perror(path);
+    return 1;
+  }
+  record_file_header_s header;
+  if (fread(&header, sizeof(header), 1, in) != 1                    ||
+      memcmp(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 ||
+      header.version != RECORD_VERSION) {
+    fprintf(stderr, "%s: not a version %d recording\n", path, RECORD_VERSION);
+    fclose(in);
+    return 1;
+  }
+  size_t         size   = 0;
+  size_t         max    = 1 << 20;
+  unsigned char* events = malloc(max);
+  size_t         count;
+  while (events != NULL && (count = fread(events + size, 1, max - size, in)) > 0) {
+    size += count;
+    if (size == max) {
+      unsigned char* larger = realloc(events, 2 * max);
+      if (larger == NULL) {
+	free(events);
+      }
+      events = larger;
+      max   *= 2;
+    }
+  }
+  fclose(in);
+  if (events == NULL) {
+    fprintf(stderr, "%s: too large to read\n", path);
+    return 1;
+  }
+
+  gc_heap_t* heap = gc_current_heap;
+  if (immix) {
+    heap = gc_heap_create_with_policy(0, GC_HEAP_IMMIX);
+    if (heap == NULL) {
+      fprintf(stderr, "could not create a heap\n");
+      return 1;
+    }
+    gc_heap_switch(heap);
+  }
+
+  replay_s replay;
+  memset(&replay, 0, sizeof(replay));
+  replay.pos = events;
+  replay.end = events + size;
+
+  uint64_t    start   = replay_clock();
+  const char* error   = replay_run(&replay, heap);
+  uint64_t    elapsed = replay_clock() - start;
+  if (error != NULL) {
+    fprintf(stderr, "%s: %s, at byte %zu\n", path, error,
+	    sizeof(header) + (size_t)(replay.pos - events));
+    return 1;
+  }
+
+  gc_stats_s stats;
+  gc_heap_stats(heap, &stats);
+  if (stats.extent > replay.peak_extent) {
+    replay.peak_extent = stats.extent;
+  }
+  replay_report(stdout, &replay, elapsed);
+
+  return 0;
+
+} // main ()
+// ==============================================================================
@@ -0,0 +1,225 @@
+// ==============================================================================
+/**
+ * gc-trace-decode.c
+ *
+ * The `gctrace` tool, which decodes the binary trace files written by
+ * `gc_trace_start()`, either into readable text, one event per line, or into
+ * the JSON format of the Chrome trace viewer (`chrome://tracing`, Perfetto).
+ *
+ *   gctrace [--chrome] <trace file>
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gc-trace.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS
+
+#define NS_PER_US 1000.0
+
+/** The process ID given to every event in Chrome traces. */
+#define CHROME_PID 1
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+static const char* type_names[TRACE_NUM_TYPES] = {
+  "alloc", "gc-begin", "gc-end", "phase-begin", "phase-end", "heap-size",
+  "finalize", "dropped"
+};
+
+static const char* phase_names[TRACE_NUM_PHASES] = {
+  "mark", "weak", "finalizers", "sweep"
+};
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Name a collection phase.
+ *
+ * \param phase The phase.
+ * \return Its name.
+ */
+const char* phase_name (uint64_t phase) {
+
+  return phase < TRACE_NUM_PHASES ? phase_names[phase] : "unknown";
+
+} // phase_name ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write an event as a line of text.
+ *
+ * \param out   The output.
+ * \param event The event.
+ */
+void decode_text (FILE* out, const trace_event_s* event) {
+
+  fprintf(out, "%14.3f us  T%-3" PRIu32 " %-12s", event->time / NS_PER_US,
+	  event->thread, type_names[event->type]);
+  switch (event->type) {
+  case TRACE_ALLOC:
+    fprintf(out, "addr=0x%" PRIx64 " size=%" PRIu64, event->arg0, event->arg1);
+    break;
+  case TRACE_GC_BEGIN:
+    fprintf(out, "gc=%" PRIu64 " heap=%" PRIu64, event->arg0, event->arg1);
+    break;
+  case TRACE_GC_END:
+    fprintf(out, "gc=%" PRIu64 " freed=%" PRIu64, event->arg0, event->arg1);
+    break;
+  case TRACE_PHASE_BEGIN:
+  case TRACE_PHASE_END:
+    fprintf(out, "gc=%" PRIu64 " phase=%s", event->arg1, phase_name(event->arg0));
+    break;
+  case TRACE_HEAP_SIZE:
+    fprintf(out, "extent=%" PRIu64 " live=%" PRIu64, event->arg0, event->arg1);
+    break;
+  case TRACE_FINALIZE:
+  case TRACE_DROPPED:
+    fprintf(out, "count=%" PRIu64, event->arg0);
+    break;
+  }
+  fputc('\n', out);
+
+} // decode_text ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write an event as a Chrome trace event.  Collections and their phases become
+ * nested duration events; heap sizes become counters; everything else becomes
+ * an instant event.
+ *
+ * \param out   The output.
+ * \param event The event.
+ * \param first Whether this is the first event written.
+ */
+void decode_chrome (FILE* out, const trace_event_s* event, bool first) {
+
+  fprintf(out, "%s\n{\"pid\":%d,\"tid\":%" PRIu32 ",\"ts\":%.3f,", first ? "" : ",",
+	  CHROME_PID, event->thread, event->time / NS_PER_US);
+  switch (event->type) {
+  case TRACE_ALLOC:
+    fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"alloc\","
+	    "\"args\":{\"addr\":\"0x%" PRIx64 "\",\"size\":%" PRIu64 "}}",
+	    event->arg0, event->arg1);
+    break;
+  case TRACE_GC_BEGIN:
+    fprintf(out, "\"ph\":\"B\",\"name\":\"gc\","
+	    "\"args\":{\"gc\":%" PRIu64 ",\"heap\":%" PRIu64 "}}", event->arg0, event->arg1);
+    break;
+  case TRACE_GC_END:
+    fprintf(out, "\"ph\":\"E\",\"name\":\"gc\",\"args\":{\"freed\":%" PRIu64 "}}", event->arg1);
+    break;
+  case TRACE_PHASE_BEGIN:
+  case TRACE_PHASE_END:
+    fprintf(out, "\"ph\":\"%s\",\"name\":\"%s\"}",
+	    event->type == TRACE_PHASE_BEGIN ? "B" : "E", phase_name(event->arg0));
+    break;
+  case TRACE_HEAP_SIZE:
+    fprintf(out, "\"ph\":\"C\",\"name\":\"heap\","
+	    "\"args\":{\"extent\":%" PRIu64 ",\"live\":%" PRIu64 "}}",
+	    event->arg0, event->arg1);
+    break;
+  case TRACE_FINALIZE:
+  case TRACE_DROPPED:
+    fprintf(out, "\"ph\":\"i\",\"s\":\"p\",\"name\":\"%s\","
+	    "\"args\":{\"count\":%" PRIu64 "}}",
+	    type_names[event->type], event->arg0);
+    break;
+  }
+
+} // decode_chrome ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+int main (int argc, char** argv) {
+
+  bool        chrome = false;
+  const char* path   = NULL;
+  for (int i = 1; i < argc; i += 1) {
+    if (strcmp(argv[i], "--chrome") == 0) {
+      chrome = true;
+    } else if (path == NULL) {
+      path = argv[i];
+    } else {
+      path = NULL;
+      break;
+    }
+  }
+  if (path == NULL) {
+    fprintf(stderr, "usage: %s [--chrome] <trace file>\n", argv[0]);
+    return 1;
+  }
+
+  FILE* in = fopen(path, "rb");
+  if (in == NULL) {
+    perror(path);
+    return 1;
+  }
+  trace_file_header_s header;
+  if (fread(&header, sizeof(header), 1, in) != 1                ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+      header.version != TRACE_VERSION                          ||
+      header.event_size != sizeof(trace_event_s)) {
+    fprintf(stderr, "%s: not a version %d trace file\n", path, TRACE_VERSION);
+    fclose(in);
+    return 1;
+  }
+
+  if (chrome) {
+    fprintf(stdout, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  } else {
+    fprintf(stdout, "# trace started at %" PRIu64 ".%09" PRIu64 " (unix time)\n",
+	    header.start_time / 1000000000, header.start_time % 1000000000);
+  }
+
+  trace_event_s event;
+  bool          first = true;
+  while (fread(&event, sizeof(event), 1, in) == 1) {
+    if (event.type >= TRACE_NUM_TYPES) {
+      fprintf(stderr, "%s: unknown event type %" PRIu32 "\n", path, event.type);
+      continue;
+    }
+    if (chrome) {
+      decode_chrome(stdout, &event, first);
+    } else {
+      decode_text(stdout, &event);
+    }
+    first = false;
+  }
+  if (chrome) {
+    fprintf(stdout, "\n]}\n");
+  }
+
+  fclose(in);
+  return 0;
+
+} // main ()
+// ==============================================================================
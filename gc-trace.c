@@ -0,0 +1,399 @@
+// ==============================================================================
+/**
+ * gc-trace.c
+ *
+ * A low-overhead binary trace of the collector's events.  Events are fixed-size
+ * records, placed without locking into a bounded ring buffer by the threads on
+ * which they happen, and written to the trace file in large batches by a
+ * background thread, which is woken early when the buffer starts to fill.  The
+ * collector thus never waits on I/O to record an event; if the writer falls
+ * behind, events are dropped and the loss is recorded in the trace.  Allocation
+ * events, by far the most numerous, are dropped first, leaving room for the
+ * collection and phase events.  The `gctrace` tool decodes the resulting files.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gc.h"
+#include "gc-trace.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The number of events that the ring buffer holds; a power of two. */
+#define TRACE_RING_SIZE      65536
+#define TRACE_RING_MASK      (TRACE_RING_SIZE - 1)
+
+/** The most events written by a single `write()`. */
+#define TRACE_BATCH_SIZE     4096
+
+/** How long the writer sleeps when it finds the buffer empty, in nanoseconds. */
+#define TRACE_FLUSH_INTERVAL 10000000
+
+/** The number of pending events at which a sleeping writer is woken. */
+#define TRACE_WAKE_MARK      (TRACE_RING_SIZE / 4)
+
+/**
+ * The number of pending events beyond which allocation events are dropped,
+ * keeping the rest of the buffer for the rarer events.
+ */
+#define TRACE_ALLOC_LIMIT    (TRACE_RING_SIZE / 2)
+
+#define NS_PER_S             1000000000
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/**
+ * A slot in the ring buffer.  Its sequence number says whose turn it is:  a
+ * slot at position `p` may be filled when its sequence is `p`, and emptied
+ * when it is `p + 1`, after which it becomes `p + TRACE_RING_SIZE`.
+ */
+typedef struct trace_slot {
+
+  uint64_t      sequence;
+  trace_event_s event;
+
+} trace_slot_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+bool                trace_enabled = false;
+
+/** The ring buffer, and the positions at which to fill and empty it. */
+static trace_slot_s trace_ring[TRACE_RING_SIZE];
+static uint64_t     trace_tail    = 0;
+static uint64_t     trace_head    = 0;
+
+/** The number of events dropped, and of those already reported as such. */
+static uint64_t     trace_dropped  = 0;
+static uint64_t     trace_reported = 0;
+
+/** The monotonic time at which the trace began, in nanoseconds. */
+static uint64_t     trace_epoch   = 0;
+
+/** The source of thread numbers, and this thread's number. */
+static uint32_t     trace_threads = 0;
+static __thread uint32_t trace_thread = 0;
+
+/** The trace file, and the thread that writes to it. */
+static int          trace_fd      = -1;
+static pthread_t    trace_writer;
+static bool         trace_stopping = false;
+
+/** Whether the writer is asleep, and how to wake it. */
+static bool            trace_sleeping = false;
+static pthread_mutex_t trace_lock     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  trace_wake     = PTHREAD_COND_INITIALIZER;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read a clock, in nanoseconds.
+ *
+ * \param clock The clock to read.
+ * \return Its time.
+ */
+uint64_t trace_clock (clockid_t clock) {
+
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (uint64_t)now.tv_sec * NS_PER_S + now.tv_nsec;
+
+} // trace_clock ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Wake the writer, if it is asleep.
+ */
+void trace_wake_writer () {
+
+  if (__atomic_exchange_n(&trace_sleeping, false, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&trace_lock);
+    pthread_cond_signal(&trace_wake);
+    pthread_mutex_unlock(&trace_lock);
+  }
+
+} // trace_wake_writer ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Record an event in the trace buffer, to be written out by the flushing
+ * thread.  Safe to call from any thread without locking; if the buffer is
+ * full -- or, for an allocation event, more than `TRACE_ALLOC_LIMIT` full --
+ * the event is dropped and counted.
+ *
+ * \param type The kind of event.
+ * \param arg0 The event's first argument.
+ * \param arg1 The event's second argument.
+ */
+void trace_event (trace_type_t type, uint64_t arg0, uint64_t arg1) {
+
+  if (trace_thread == 0) {
+    trace_thread = __atomic_add_fetch(&trace_threads, 1, __ATOMIC_RELAXED);
+  }
+
+  // Claim the slot at the tail, unless the writer has yet to empty it, in which
+  // case the buffer is full.
+  uint64_t      position = __atomic_load_n(&trace_tail, __ATOMIC_RELAXED);
+  uint64_t      pending;
+  trace_slot_s* slot;
+  while (true) {
+    slot = &trace_ring[position & TRACE_RING_MASK];
+    uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    int64_t  lag      = (int64_t)(sequence - position);
+    pending = position - __atomic_load_n(&trace_head, __ATOMIC_RELAXED);
+    if (lag == 0 && type == TRACE_ALLOC && pending >= TRACE_ALLOC_LIMIT) {
+      __atomic_add_fetch(&trace_dropped, 1, __ATOMIC_RELAXED);
+      trace_wake_writer();
+      return;
+    } else if (lag == 0) {
+      if (__atomic_compare_exchange_n(&trace_tail, &position, position + 1, true,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	break;
+      }
+    } else if (lag < 0) {
+      __atomic_add_fetch(&trace_dropped, 1, __ATOMIC_RELAXED);
+      trace_wake_writer();
+      return;
+    } else {
+      position = __atomic_load_n(&trace_tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  // Fill it, and then hand it to the writer.
+  slot->event.time   = trace_clock(CLOCK_MONOTONIC) - trace_epoch;
+  slot->event.type   = type;
+  slot->event.thread = trace_thread;
+  slot->event.arg0   = arg0;
+  slot->event.arg1   = arg1;
+  __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+
+  if (pending >= TRACE_WAKE_MARK) {
+    trace_wake_writer();
+  }
+
+} // trace_event ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write a batch of events to the trace file, retrying partial writes.
+ *
+ * \param batch The events.
+ * \param count The number of events.
+ */
+void trace_write (const trace_event_s* batch, size_t count) {
+
+  const char* data      = (const char*)batch;
+  size_t      remaining = count * sizeof(trace_event_s);
+  while (remaining > 0) {
+    ssize_t written = write(trace_fd, data, remaining);
+    if (written <= 0) {
+      return;
+    }
+    data      += written;
+    remaining -= written;
+  }
+
+} // trace_write ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Empty the ring buffer of the events that are ready, writing them out in
+ * batches, along with a record of any events dropped since the last flush.
+ *
+ * \return The number of events written.
+ */
+size_t trace_flush () {
+
+  static trace_event_s batch[TRACE_BATCH_SIZE];
+  size_t               total = 0;
+  size_t               count;
+  do {
+
+    count = 0;
+    while (count < TRACE_BATCH_SIZE) {
+      trace_slot_s* slot     = &trace_ring[trace_head & TRACE_RING_MASK];
+      uint64_t      sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+      if (sequence != trace_head + 1) {
+	break;
+      }
+      batch[count++] = slot->event;
+      __atomic_store_n(&slot->sequence, trace_head + TRACE_RING_SIZE, __ATOMIC_RELEASE);
+      __atomic_store_n(&trace_head, trace_head + 1, __ATOMIC_RELAXED);
+    }
+
+    uint64_t dropped = __atomic_load_n(&trace_dropped, __ATOMIC_RELAXED);
+    if (dropped != trace_reported && count < TRACE_BATCH_SIZE) {
+      trace_event_s* event = &batch[count++];
+      event->time    = trace_clock(CLOCK_MONOTONIC) - trace_epoch;
+      event->type    = TRACE_DROPPED;
+      event->thread  = 0;
+      event->arg0    = dropped - trace_reported;
+      event->arg1    = 0;
+      trace_reported = dropped;
+    }
+
+    trace_write(batch, count);
+    total += count;
+
+  } while (count == TRACE_BATCH_SIZE);
+
+  return total;
+
+} // trace_flush ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The body of the writer thread:  flush the ring buffer, sleeping whenever it
+ * is empty -- until woken, or until `TRACE_FLUSH_INTERVAL` passes -- until the
+ * trace is stopped, and then flush it one last time.
+ *
+ * \param arg Unused.
+ * \return `NULL`.
+ */
+void* trace_writer_main (void* arg) {
+
+  (void)arg;
+  while (!__atomic_load_n(&trace_stopping, __ATOMIC_ACQUIRE)) {
+    if (trace_flush() > 0) {
+      continue;
+    }
+
+    // Announce the sleep before rechecking the buffer, so that an event that
+    // fills it past the wake mark either is seen here or wakes the writer.
+    uint64_t        wake_at  = trace_clock(CLOCK_REALTIME) + TRACE_FLUSH_INTERVAL;
+    struct timespec deadline = { wake_at / NS_PER_S, wake_at % NS_PER_S };
+    pthread_mutex_lock(&trace_lock);
+    __atomic_store_n(&trace_sleeping, true, __ATOMIC_SEQ_CST);
+    uint64_t pending = __atomic_load_n(&trace_tail, __ATOMIC_SEQ_CST) - trace_head;
+    if (pending < TRACE_WAKE_MARK && !__atomic_load_n(&trace_stopping, __ATOMIC_SEQ_CST)) {
+      pthread_cond_timedwait(&trace_wake, &trace_lock, &deadline);
+    }
+    __atomic_store_n(&trace_sleeping, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace_lock);
+  }
+  trace_flush();
+
+  return NULL;
+
+} // trace_writer_main ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Start tracing the collector's events to a file, replacing any trace already
+ * being written.
+ *
+ * \param path The file to write.
+ * \return `true` if tracing has started; `false` if the file could not be
+ *         created.
+ */
+bool gc_trace_start (const char* path) {
+
+  gc_trace_stop();
+
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (trace_fd < 0) {
+    return false;
+  }
+
+  trace_file_header_s header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header.version    = TRACE_VERSION;
+  header.event_size = sizeof(trace_event_s);
+  header.start_time = trace_clock(CLOCK_REALTIME);
+  trace_epoch       = trace_clock(CLOCK_MONOTONIC);
+  if (write(trace_fd, &header, sizeof(header)) != sizeof(header)) {
+    close(trace_fd);
+    trace_fd = -1;
+    return false;
+  }
+
+  // Every slot starts out ready to be filled at its own position.
+  for (uint64_t i = 0; i < TRACE_RING_SIZE; i += 1) {
+    trace_ring[i].sequence = i;
+  }
+  trace_head     = 0;
+  trace_tail     = 0;
+  trace_dropped  = 0;
+  trace_reported = 0;
+  trace_stopping = false;
+  if (pthread_create(&trace_writer, NULL, trace_writer_main, NULL) != 0) {
+    close(trace_fd);
+    trace_fd = -1;
+    return false;
+  }
+  trace_enabled = true;
+
+  // Route every allocation through `gc_new_slow()`, where it can be recorded.
+  gc_alloc_buffers_disable();
+
+  return true;
+
+} // gc_trace_start ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Stop tracing, writing out the events still buffered and closing the file.
+ */
+void gc_trace_stop () {
+
+  if (trace_fd < 0) {
+    return;
+  }
+
+  trace_enabled = false;
+  __atomic_store_n(&trace_stopping, true, __ATOMIC_SEQ_CST);
+  trace_wake_writer();
+  pthread_join(trace_writer, NULL);
+  close(trace_fd);
+  trace_fd = -1;
+
+} // gc_trace_stop ()
+// ==============================================================================
@@ -0,0 +1,163 @@
+// ==============================================================================
+/**
+ * gc-trace.h
+ *
+ * The collector's interface to the binary event trace, and the format of the
+ * trace files that it writes.  These are internal to the collector and to the
+ * `gctrace` decoder; programs use `gc_trace_*()` from `gc.h`.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// AVOID MULTIPLE INCLUSION
+
+#if !defined (_GC_TRACE_H)
+#define _GC_TRACE_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS
+
+/** The magic number at the start of every trace file. */
+#define TRACE_MAGIC   "GCTRACE"
+
+/** The version of the trace file format. */
+#define TRACE_VERSION 1
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** The kinds of events recorded in a trace. */
+typedef enum trace_type {
+
+  /** An object was allocated.  `arg0` is its address; `arg1` its size. */
+  TRACE_ALLOC,
+
+  /** A collection began.  `arg0` is its number; `arg1` the heap's. */
+  TRACE_GC_BEGIN,
+
+  /** A collection ended.  `arg0` is its number; `arg1` the bytes freed. */
+  TRACE_GC_END,
+
+  /** A phase of a collection began.  `arg0` is the phase; `arg1` the collection. */
+  TRACE_PHASE_BEGIN,
+
+  /** A phase of a collection ended.  `arg0` is the phase; `arg1` the collection. */
+  TRACE_PHASE_END,
+
+  /** The heap's size.  `arg0` is its extent, in bytes; `arg1` the bytes in use. */
+  TRACE_HEAP_SIZE,
+
+  /** A batch of objects was finalized.  `arg0` is the number of objects. */
+  TRACE_FINALIZE,
+
+  /** Events were lost because the buffer was full.  `arg0` is their number. */
+  TRACE_DROPPED,
+
+  TRACE_NUM_TYPES
+
+} trace_type_t;
+
+/** The phases of a collection, as reported by `TRACE_PHASE_*` events. */
+typedef enum trace_phase {
+
+  /** Marking from the root set and the finalization queue. */
+  TRACE_PHASE_MARK,
+
+  /** Tracing ephemerons and clearing weak references. */
+  TRACE_PHASE_WEAK,
+
+  /** Queueing unreachable objects for finalization. */
+  TRACE_PHASE_FINALIZERS,
+
+  /** Sweeping dead objects onto the free list. */
+  TRACE_PHASE_SWEEP,
+
+  TRACE_NUM_PHASES
+
+} trace_phase_t;
+
+/** A trace event, as stored in the buffer and written to the trace file. */
+typedef struct trace_event {
+
+  /** The time of the event, in nanoseconds since the trace was started. */
+  uint64_t time;
+
+  /** The kind of event, a `trace_type_t`. */
+  uint32_t type;
+
+  /** The number of the thread on which the event happened, from 1. */
+  uint32_t thread;
+
+  /** The event's arguments, whose meanings depend on its type. */
+  uint64_t arg0;
+  uint64_t arg1;
+
+} trace_event_s;
+
+/** The header at the start of a trace file, followed by its events. */
+typedef struct trace_file_header {
+
+  /** `TRACE_MAGIC`, terminated. */
+  char     magic[8];
+
+  /** `TRACE_VERSION`. */
+  uint32_t version;
+
+  /** The size of each event, in bytes. */
+  uint32_t event_size;
+
+  /** The wall-clock time at which the trace was started, in nanoseconds. */
+  uint64_t start_time;
+
+} trace_file_header_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** Whether events are being traced. */
+extern bool trace_enabled;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// FUNCTIONS
+
+/**
+ * Record an event in the trace buffer, to be written out by the flushing
+ * thread.  Safe to call from any thread without locking; if the buffer is
+ * full, the event is dropped and counted.  Callers should first check
+ * `trace_enabled`.
+ *
+ * \param type The kind of event.
+ * \param arg0 The event's first argument.
+ * \param arg1 The event's second argument.
+ */
+void trace_event (trace_type_t type, uint64_t arg0, uint64_t arg1);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _GC_TRACE_H
+// ==============================================================================
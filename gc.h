@@ -21,15 +21,159 @@
 // ==============================================================================
 // INCLUDES
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 // ==============================================================================
 
 
 
+// ==============================================================================
+// C++ LINKAGE
+
+#if defined (__cplusplus)
+extern "C" {
+#endif // defined (__cplusplus)
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS
+
+/** The default mean number of bytes allocated between profiler samples. */
+#define GC_PROFILE_DEFAULT_INTERVAL (512 * 1024)
+
+/**
+ * The number of bytes that an object of `size` bytes occupies, header
+ * included.  Spans are rounded to double words, so that consecutive objects
+ * remain aligned.
+ */
+#define GC_BLOCK_SPAN(size) ((sizeof(gc_header_s) + (size) + 15) & ~(size_t)15)
+
+/**
+ * The largest span of an object allocated from an allocation buffer; larger
+ * objects are always allocated by `gc_heap_new_slow()`.
+ */
+#define GC_BUFFER_MAX_SPAN 4096
+
+/**
+ * The flag, in a layout's pointer offset, marking the field at that offset as
+ * a compressed reference (a `gc_ref_t`) rather than a pointer.
+ */
+#define GC_COMPRESSED_REF ((size_t)1 << (sizeof(size_t) * 8 - 1))
+
+/** The pointer offset of a compressed reference field at `offset`. */
+#define GC_REF_OFFSET(offset) ((size_t)(offset) | GC_COMPRESSED_REF)
+
+/**
+ * The number of bits by which compressed references are scaled.  Objects are
+ * double-word aligned, so references can reach 64 GB into a heap.
+ */
+#define GC_REF_SHIFT 4
+// ==============================================================================
+
+
+
+// ==============================================================================
+// STATIC LAYOUT MACROS
+//
+//   Derive constant layouts from struct definitions, naming the pointer fields:
+//
+//     typedef struct node { struct node* next; int value; struct node* prev; } node_s;
+//     GC_DEFINE_LAYOUT(node_layout, node_s, next, prev);
+//     ...
+//     node_s* node = gc_new(&node_layout);
+//
+//   Fields may also be array elements with constant indices (e.g., `kids[2]`).
+//   Up to 16 pointer fields may be named.  For compressed references, use
+//   `GC_DEFINE_REF_LAYOUT()` instead, naming `gc_ref_t` fields.
+
+/** Count the (1 to 16) arguments given. */
+#define GC_NUM_ARGS(...) \
+  GC_NUM_ARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define GC_NUM_ARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, n, ...) n
+
+/** Paste two tokens, after expanding them. */
+#define GC_CAT(a, b)  GC_CAT_(a, b)
+#define GC_CAT_(a, b) a ## b
+
+/**
+ * Expand to the comma-separated offsets of the named fields of `type`, each
+ * found by `of(type, field)`.
+ */
+#define GC_OFFSETS(of, type, ...) \
+  GC_CAT(GC_OFFSETS_, GC_NUM_ARGS(__VA_ARGS__))(of, type, __VA_ARGS__)
+#define GC_OFFSETS_1(o, t, f)       o(t, f)
+#define GC_OFFSETS_2(o, t, f, ...)  o(t, f), GC_OFFSETS_1(o, t, __VA_ARGS__)
+#define GC_OFFSETS_3(o, t, f, ...)  o(t, f), GC_OFFSETS_2(o, t, __VA_ARGS__)
+#define GC_OFFSETS_4(o, t, f, ...)  o(t, f), GC_OFFSETS_3(o, t, __VA_ARGS__)
+#define GC_OFFSETS_5(o, t, f, ...)  o(t, f), GC_OFFSETS_4(o, t, __VA_ARGS__)
+#define GC_OFFSETS_6(o, t, f, ...)  o(t, f), GC_OFFSETS_5(o, t, __VA_ARGS__)
+#define GC_OFFSETS_7(o, t, f, ...)  o(t, f), GC_OFFSETS_6(o, t, __VA_ARGS__)
+#define GC_OFFSETS_8(o, t, f, ...)  o(t, f), GC_OFFSETS_7(o, t, __VA_ARGS__)
+#define GC_OFFSETS_9(o, t, f, ...)  o(t, f), GC_OFFSETS_8(o, t, __VA_ARGS__)
+#define GC_OFFSETS_10(o, t, f, ...) o(t, f), GC_OFFSETS_9(o, t, __VA_ARGS__)
+#define GC_OFFSETS_11(o, t, f, ...) o(t, f), GC_OFFSETS_10(o, t, __VA_ARGS__)
+#define GC_OFFSETS_12(o, t, f, ...) o(t, f), GC_OFFSETS_11(o, t, __VA_ARGS__)
+#define GC_OFFSETS_13(o, t, f, ...) o(t, f), GC_OFFSETS_12(o, t, __VA_ARGS__)
+#define GC_OFFSETS_14(o, t, f, ...) o(t, f), GC_OFFSETS_13(o, t, __VA_ARGS__)
+#define GC_OFFSETS_15(o, t, f, ...) o(t, f), GC_OFFSETS_14(o, t, __VA_ARGS__)
+#define GC_OFFSETS_16(o, t, f, ...) o(t, f), GC_OFFSETS_15(o, t, __VA_ARGS__)
+
+/** The pointer offset of the compressed reference `field` of `type`. */
+#define GC_REF_OFFSETOF(type, field) GC_REF_OFFSET(offsetof(type, field))
+
+/** Define `name`, a constant layout for `type` with the named pointer fields. */
+#define GC_DEFINE_LAYOUT(name, type, ...) \
+  GC_DEFINE_FINALIZED_LAYOUT(name, type, NULL, __VA_ARGS__)
+
+/** Define `name`, a constant layout for `type`, which has no pointer fields. */
+#define GC_DEFINE_LEAF_LAYOUT(name, type) \
+  GC_DEFINE_FINALIZED_LEAF_LAYOUT(name, type, NULL)
+
+/**
+ * Define `name`, a constant layout for `type`, whose named fields are
+ * compressed references.
+ */
+#define GC_DEFINE_REF_LAYOUT(name, type, ...)				\
+  static const size_t name ## _ptr_offsets[] = { GC_OFFSETS(GC_REF_OFFSETOF, type, __VA_ARGS__) }; \
+  static const gc_layout_s name = {					\
+    sizeof(type),							\
+    sizeof(name ## _ptr_offsets) / sizeof(size_t),			\
+    name ## _ptr_offsets,						\
+    NULL								\
+  }
+
+/** As `GC_DEFINE_LAYOUT()`, but with a finalizer. */
+#define GC_DEFINE_FINALIZED_LAYOUT(name, type, finalizer, ...)		\
+  static const size_t name ## _ptr_offsets[] = { GC_OFFSETS(offsetof, type, __VA_ARGS__) }; \
+  static const gc_layout_s name = {					\
+    sizeof(type),							\
+    sizeof(name ## _ptr_offsets) / sizeof(size_t),			\
+    name ## _ptr_offsets,						\
+    (finalizer)								\
+  }
+
+/** As `GC_DEFINE_LEAF_LAYOUT()`, but with a finalizer. */
+#define GC_DEFINE_FINALIZED_LEAF_LAYOUT(name, type, finalizer) \
+  static const gc_layout_s name = { sizeof(type), 0, NULL, (finalizer) }
+// ==============================================================================
+
+
+
 // ==============================================================================
 // TYPES AND STRUCTURES
 
+/**
+ * A finalizer, called on an object once it has become unreachable, so that it
+ * may release any external resources it holds.
+ *
+ * \param obj The object being finalized.
+ */
+typedef void (*gc_finalizer_t) (void* obj);
+
 /**
  * The description of a heap object, as needed by the GC to find the pointers.
  */
@@ -41,10 +185,192 @@ typedef struct gc_layout {
   /** The number of pointers in the object. */
   unsigned int num_ptrs;
 
-  /** The offsets into the object at which pointers reside. */
-  size_t* ptr_offsets;
+  /**
+   * The offsets into the object at which pointers reside.  An offset with
+   * `GC_COMPRESSED_REF` set (see `GC_REF_OFFSET()`) is of a compressed
+   * reference, a `gc_ref_t`, rather than a pointer.
+   */
+  const size_t* ptr_offsets;
+
+  /**
+   * The function to call on each object of this layout once it is found
+   * unreachable, or `NULL` if none.  Such objects, and all that they reach,
+   * survive the collection that finds them unreachable; they are queued and
+   * finalized later, by `gc_finalize()` or the finalizer thread, and collected
+   * once they are again unreachable.  Weak references to them are cleared
+   * before they are queued.
+   */
+  gc_finalizer_t finalizer;
   
 } gc_layout_s;
+
+/**
+ * A _compressed reference_ to a heap object:  its offset from the start of its
+ * heap, scaled down by `GC_REF_SHIFT`, or `0` for `NULL`.  It takes half the
+ * space of a pointer, but can refer only to objects in the same heap as the
+ * object holding it, and within the first 64 GB of that heap.  Fields holding
+ * them are listed in layouts with `GC_REF_OFFSET()`, and are read and written
+ * with `gc_ref_decode()` and `gc_ref_encode()`.
+ */
+typedef uint32_t gc_ref_t;
+
+/**
+ * A weak reference:  a heap object that refers to another without keeping it
+ * alive.  Once the target is collected, the reference reads as `NULL`.
+ */
+typedef struct gc_weak_ref gc_weak_ref_t;
+
+/**
+ * The header that precedes each object.  It is exposed only so that `gc_new()`
+ * can be inlined; programs should not use it.
+ */
+typedef struct gc_header {
+
+  /** Pointer to the next header in the list. */
+  struct gc_header*  next;
+
+  /** Pointer to the previous header in the list. */
+  struct gc_header*  prev;
+
+  /** The usable size of the block (exclusive of the header itself). */
+  size_t             size;
+
+  /** Is the block allocated or free? */
+  bool               allocated;
+
+  /**
+   * The _epoch_ (the number, modulo 255, from 1) of the last collection that
+   * found the block reachable; `0` if none has.
+   */
+  unsigned char      marked;
+
+  /** What kind of object the block holds; `0` for an ordinary object. */
+  unsigned char      kind;
+
+  /** Where the block was allocated. */
+  unsigned char      space;
+
+  /** Whether a traversal other than a collection's has visited the block. */
+  bool               visited;
+
+  /** Whether the block is in the open region's remembered set. */
+  bool               remembered;
+
+  /** A map of the layout of pointers in the object. */
+  const gc_layout_s* layout;
+
+} gc_header_s;
+
+/**
+ * An allocation buffer:  a run of free space into which `gc_heap_new()`
+ * allocates by pointer bumping, without calling into the collector.  Its
+ * objects are linked into the collector's lists when the buffer is retired.  It
+ * is exposed only so that `gc_heap_new()` can be inlined; programs should not
+ * use it.
+ */
+typedef struct gc_alloc_buffer {
+
+  /** Where the next object's header goes. */
+  intptr_t      cursor;
+
+  /** The end of the buffer, or `0` to send every allocation down the slow path. */
+  intptr_t      limit;
+
+  /** The space of the objects allocated in the buffer. */
+  unsigned char space;
+
+  /**
+   * The start of the heap, from which compressed references are measured; it
+   * is kept here so that `gc_heap_ref_decode()` can be inlined, too.
+   */
+  intptr_t      heap_base;
+
+  /**
+   * The addresses of the open region's chunks, or `0` and `0` if there is no
+   * region open; kept here so that `gc_store()` can tell, inline, when a
+   * pointer into the region is stored outside of it.
+   */
+  intptr_t      region_start;
+  intptr_t      region_end;
+
+} gc_alloc_buffer_s;
+
+/**
+ * A heap:  a contiguous region of memory with its own objects, root set and
+ * finalizers, collected independently of any other heap.  Objects in one heap
+ * may refer to objects in another, but such references are not traced, and so
+ * do not keep their targets alive.  A heap begins with its allocation buffer,
+ * a `gc_alloc_buffer_s`.
+ */
+typedef struct gc_heap gc_heap_t;
+
+/** The ways in which a heap can organize its objects. */
+typedef enum gc_heap_policy {
+
+  /**
+   * Objects are allocated from a best-fit free list, or by pointer bumping
+   * from the end of the heap, and freed individually by the sweep.  This is
+   * how the default heap is organized.
+   */
+  GC_HEAP_FREE_LIST,
+
+  /**
+   * _Immix_:  small objects are bump-allocated into _holes_, runs of free
+   * lines within fixed-size blocks, and a line is free once no object on it
+   * survives a collection.  Consecutive allocations are thus adjacent, and
+   * the sweep is per line rather than per object.  Large objects, and those
+   * with finalizers, are handled as by `GC_HEAP_FREE_LIST`.
+   */
+  GC_HEAP_IMMIX
+
+} gc_heap_policy_t;
+
+/**
+ * A hash table of _ephemerons_, keyed by heap object identity.  The table holds
+ * its keys weakly, and holds each value only while its key is reachable from
+ * elsewhere; entries whose keys are collected disappear from the table.
+ */
+typedef struct gc_ephemeron_table gc_ephemeron_table_t;
+
+/** The formats in which `gc_profile_dump()` can write a profile. */
+typedef enum gc_profile_format {
+
+  /** Human-readable text:  the census by layout, then the sampled call sites. */
+  GC_PROFILE_TEXT,
+
+  /** The legacy text format of heap profiles read by `pprof`. */
+  GC_PROFILE_PPROF
+
+} gc_profile_format_t;
+
+/** Statistics about a heap. */
+typedef struct gc_stats {
+
+  /** The number of collections performed. */
+  uint64_t collections;
+
+  /** The extent of the heap:  the bytes from its start to its bump frontier. */
+  size_t   extent;
+
+  /** The bytes, headers included, in use after the last collection. */
+  size_t   live_bytes;
+
+} gc_stats_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/**
+ * The heap on which the calling thread's `gc_*()` calls operate:  the default
+ * heap, unless changed with `gc_heap_switch()`.
+ */
+extern __thread gc_heap_t* gc_current_heap;
+
+/** Whether allocations and pointer stores are being recorded; see `gc_record_start()`. */
+extern bool gc_recording;
 // ==============================================================================
 
 
@@ -52,14 +378,215 @@ typedef struct gc_layout {
 // ==============================================================================
 // FUNCTIONS
 
+/**
+ * Allocate space in a heap for the structure defined by the given `layout`,
+ * when `gc_heap_new()` cannot do so from the allocation buffer.
+ *
+ * \param heap   The heap.
+ * \param layout A descriptor of the fields
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* gc_heap_new_slow (gc_heap_t* heap, const gc_layout_s* layout);
+
+/**
+ * Send every heap's subsequent allocations down the slow path, for as long as
+ * the profiler, tracer or recorder needs to see them.  Not for use by programs.
+ */
+void gc_alloc_buffers_disable ();
+
+/**
+ * Record the store of a pointer into one of an object's fields, while
+ * recording.  Not for use by programs, which use `gc_store()`.
+ *
+ * \param obj    The object.
+ * \param offset The field's offset, with `GC_COMPRESSED_REF` set for a
+ *               compressed reference.
+ * \param value  The pointer stored.
+ */
+void gc_record_store (void* obj, size_t offset, void* value);
+
+/**
+ * Note that an object outside the open region now points into it, so that
+ * `gc_region_end()` will promote what it points to.  Not for use by programs,
+ * which use `gc_store()`.
+ *
+ * \param obj The object.
+ */
+void gc_region_remember (void* obj);
+
+/**
+ * Allocate and return space in a heap for the structure defined by the given
+ * `layout`.  The common case -- an object without a finalizer that fits in the
+ * allocation buffer -- is a pointer bump, inlined here.
+ *
+ * \param heap   The heap.
+ * \param layout A descriptor of the fields
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+static inline void* gc_heap_new (gc_heap_t* heap, const gc_layout_s* layout) {
+
+  gc_alloc_buffer_s* buffer = (gc_alloc_buffer_s*)heap;
+  intptr_t           header = buffer->cursor;
+  size_t             span   = GC_BLOCK_SPAN(layout->size);
+  intptr_t           end    = header + span;
+  if (end > buffer->limit || span > GC_BUFFER_MAX_SPAN || layout->finalizer != NULL || layout->size == 0) {
+    return gc_heap_new_slow(heap, layout);
+  }
+  buffer->cursor = end;
+
+  gc_header_s* header_ptr = (gc_header_s*)header;
+  header_ptr->size        = end - header - sizeof(gc_header_s);
+  header_ptr->allocated   = true;
+  header_ptr->marked      = 0;
+  header_ptr->kind        = 0;
+  header_ptr->space       = buffer->space;
+  header_ptr->visited     = false;
+  header_ptr->remembered  = false;
+  header_ptr->layout      = layout;
+
+  return header_ptr + 1;
+
+} // gc_heap_new ()
+
 /**
  * Allocate and return heap space for the structure defined by the given
- * `layout`.
+ * `layout`, in the current heap.
  *
  * \param layout A descriptor of the fields
  * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
  */
-void* gc_new (gc_layout_s* layout);
+static inline void* gc_new (const gc_layout_s* layout) {
+
+  return gc_heap_new(gc_current_heap, layout);
+
+} // gc_new ()
+
+/**
+ * Compress a reference to an object in a heap.
+ *
+ * \param heap The heap.
+ * \param ptr  The object, which must be in `heap` (and within 64 GB of its
+ *             start); may be `NULL`.
+ * \return The compressed reference.
+ */
+static inline gc_ref_t gc_heap_ref_encode (gc_heap_t* heap, void* ptr) {
+
+  if (ptr == NULL) {
+    return 0;
+  }
+  return (gc_ref_t)(((intptr_t)ptr - ((gc_alloc_buffer_s*)heap)->heap_base) >> GC_REF_SHIFT);
+
+} // gc_heap_ref_encode ()
+
+/**
+ * Expand a compressed reference to an object in a heap.
+ *
+ * \param heap The heap.
+ * \param ref  The compressed reference.
+ * \return The object; `NULL` if `ref` is `0`.
+ */
+static inline void* gc_heap_ref_decode (gc_heap_t* heap, gc_ref_t ref) {
+
+  if (ref == 0) {
+    return NULL;
+  }
+  return (void*)(((gc_alloc_buffer_s*)heap)->heap_base + ((intptr_t)ref << GC_REF_SHIFT));
+
+} // gc_heap_ref_decode ()
+
+/**
+ * Compress a reference to an object in the current heap.
+ *
+ * \param ptr The object; may be `NULL`.
+ * \return The compressed reference.
+ */
+static inline gc_ref_t gc_ref_encode (void* ptr) {
+
+  return gc_heap_ref_encode(gc_current_heap, ptr);
+
+} // gc_ref_encode ()
+
+/**
+ * Expand a compressed reference to an object in the current heap.
+ *
+ * \param ref The compressed reference.
+ * \return The object; `NULL` if `ref` is `0`.
+ */
+static inline void* gc_ref_decode (gc_ref_t ref) {
+
+  return gc_heap_ref_decode(gc_current_heap, ref);
+
+} // gc_ref_decode ()
+
+/**
+ * Note the store of a pointer into an object, if the pointer is into the open
+ * region and the object is outside of it.
+ *
+ * \param obj   The object stored into.
+ * \param value The pointer stored.
+ */
+static inline void gc_region_barrier (void* obj, void* value) {
+
+  gc_alloc_buffer_s* buffer = (gc_alloc_buffer_s*)gc_current_heap;
+  if ((intptr_t)value >= buffer->region_start && (intptr_t)value < buffer->region_end &&
+      ((intptr_t)obj < buffer->region_start || (intptr_t)obj >= buffer->region_end)) {
+    gc_region_remember(obj);
+  }
+
+} // gc_region_barrier ()
+
+/**
+ * Store a pointer into one of an object's pointer fields.  A plain assignment
+ * does the same, but is not seen by `gc_record_start()`, nor, when it stores a
+ * pointer into an open region into an object outside of it, by
+ * `gc_region_end()`.
+ *
+ * \param obj   The object.
+ * \param field The field, within `obj`.
+ * \param value The pointer to store; may be `NULL`.
+ */
+static inline void gc_store (void* obj, void** field, void* value) {
+
+  *field = value;
+  gc_region_barrier(obj, value);
+  if (gc_recording) {
+    gc_record_store(obj, (char*)field - (char*)obj, value);
+  }
+
+} // gc_store ()
+
+/**
+ * Store a reference, compressed, into one of an object's compressed reference
+ * fields; see `gc_store()`.
+ *
+ * \param obj   The object, in the current heap.
+ * \param field The field, within `obj`.
+ * \param value The object to refer to, in the current heap; may be `NULL`.
+ */
+static inline void gc_store_ref (void* obj, gc_ref_t* field, void* value) {
+
+  *field = gc_ref_encode(value);
+  gc_region_barrier(obj, value);
+  if (gc_recording) {
+    gc_record_store(obj, GC_REF_OFFSET((char*)field - (char*)obj), value);
+  }
+
+} // gc_store_ref ()
+
+/**
+ * Resize an object to the structure defined by `new_layout`, as for a growable
+ * vector or string.  Its contents are kept up to the smaller of its old and new
+ * sizes, and any new bytes are zeroed.  The object is resized in place when
+ * possible:  when it shrinks, or when it is followed by free space or by the
+ * unused end of the heap.  Otherwise, it is moved to a new object, allocated as
+ * by `gc_new()`, and the old one must no longer be used.
+ *
+ * \param ptr        The object to resize; `NULL` to allocate a new one.
+ * \param new_layout The object's new layout.
+ * \return The resized object, if successful; `NULL` if unsuccessful, in which
+ *         case the old object is unchanged.
+ */
+void* gc_resize (void* ptr, const gc_layout_s* new_layout);
 
 /**
  * Garbage collect the heap.  Traverse and _mark_ live objects based on the
@@ -68,6 +595,34 @@ void* gc_new (gc_layout_s* layout);
  */
 void gc ();
 
+/**
+ * Garbage collect the heap, tracing only from the _root set_ and from objects
+ * that survived the last collection but lie on pages written since; those
+ * survivors are kept without being traced again.  Unless the heap's dirty
+ * pages are tracked (and a collection has since protected them), and unless
+ * the heap is an Immix heap, a region is open, or the profiler is running, this
+ * is a full collection, as by `gc()`.
+ */
+void gc_minor ();
+
+/**
+ * Start tracking which of the current heap's pages are written between
+ * collections, for `gc_minor()`, without any change to how programs store
+ * pointers:  each collection write-protects the heap, and a `SIGSEGV` handler
+ * notes (and then allows) the first write to each page.  Faults elsewhere go
+ * to whatever handler was installed before.  System calls that write into a
+ * protected page (e.g., `read()` into an object) fail with `EFAULT` instead,
+ * so a program should write into its objects itself.
+ *
+ * \return `true` if successful; `false` if the tracking could not be set up.
+ */
+bool gc_dirty_tracking_start ();
+
+/**
+ * Stop tracking the current heap's dirty pages, and unprotect them.
+ */
+void gc_dirty_tracking_stop ();
+
 /**
  * Add a pointer to the _root set_, which are the starting points of the garbage
  * collection heap traversal.  *Only add pointers to objects that will be live
@@ -76,6 +631,333 @@ void gc ();
  * \param ptr A pointer to be added to the _root set_ of pointers.
  */
 void gc_root_set_insert (void* ptr);
+
+/**
+ * Create a new, empty heap, organized by `GC_HEAP_FREE_LIST`.
+ *
+ * \param size The address space to reserve for the heap, in bytes; `0` for the
+ *             same amount as the default heap.
+ * \return The heap, if successful; `NULL` if unsuccessful.
+ */
+gc_heap_t* gc_heap_create (size_t size);
+
+/**
+ * Create a new, empty heap, organized by the given policy.
+ *
+ * \param size   The address space to reserve for the heap, in bytes; `0` for
+ *               the same amount as the default heap.
+ * \param policy How the heap's objects are organized.
+ * \return The heap, if successful; `NULL` if unsuccessful.
+ */
+gc_heap_t* gc_heap_create_with_policy (size_t size, gc_heap_policy_t policy);
+
+/**
+ * Destroy a heap, releasing all of its memory at once, without tracing or
+ * sweeping it.  Its finalizer thread, if any, is stopped, and its objects are
+ * not finalized.  The profiler ceases to count its objects as in use, and if it
+ * is being recorded, the recording is stopped.  Any thread whose current heap
+ * it is must switch away first; the calling thread is switched back to the
+ * default heap, which itself cannot be destroyed.
+ *
+ * \param heap The heap.
+ */
+void gc_heap_destroy (gc_heap_t* heap);
+
+/**
+ * Make a heap the calling thread's current heap, on which the rest of the
+ * `gc_*()` functions operate.  A heap should be current on only one thread at a
+ * time.
+ *
+ * \param heap The heap; `NULL` for the default heap.
+ * \return The thread's previously current heap.
+ */
+gc_heap_t* gc_heap_switch (gc_heap_t* heap);
+
+/**
+ * Add a pointer to a heap's _root set_; see `gc_root_set_insert()`.
+ *
+ * \param heap The heap.
+ * \param ptr  A pointer to be added to the heap's _root set_ of pointers.
+ */
+void gc_heap_root_set_insert (gc_heap_t* heap, void* ptr);
+
+/**
+ * Garbage collect a heap, from its _root set_; see `gc()`.  Other heaps are
+ * neither traced nor paused.
+ *
+ * \param heap The heap.
+ */
+void gc_heap_collect (gc_heap_t* heap);
+
+/**
+ * Gather statistics about a heap.
+ *
+ * \param heap  The heap.
+ * \param stats Where to store them.
+ */
+void gc_heap_stats (gc_heap_t* heap, gc_stats_s* stats);
+
+/**
+ * Allocate a weak reference to the given `target`.  The reference is itself a
+ * heap object, and so must be reachable to survive a collection.
+ *
+ * \param target The object to refer to weakly; may be `NULL`.
+ * \return The new weak reference, if successful; `NULL` if unsuccessful.
+ */
+gc_weak_ref_t* gc_weak_new (void* target);
+
+/**
+ * Obtain the target of a weak reference.
+ *
+ * \param weak The weak reference.
+ * \return The target, or `NULL` if it has been collected.
+ */
+void* gc_weak_get (gc_weak_ref_t* weak);
+
+/**
+ * Allocate an empty ephemeron table.  The table is itself a heap object, and so
+ * must be reachable to survive a collection.
+ *
+ * \param capacity The number of entries the table must be able to hold.
+ * \return The new table, if successful; `NULL` if unsuccessful.
+ */
+gc_ephemeron_table_t* gc_ephemeron_table_new (size_t capacity);
+
+/**
+ * Associate a value with a key in an ephemeron table.
+ *
+ * \param table The table to update.
+ * \param key   The key, which must be a heap object.
+ * \param value The value, which may be `NULL`.
+ * \return `true` if successful; `false` if the table is full.
+ */
+bool gc_ephemeron_table_put (gc_ephemeron_table_t* table, void* key, void* value);
+
+/**
+ * Look up the value associated with a key in an ephemeron table.
+ *
+ * \param table The table to search.
+ * \param key   The key being sought.
+ * \return The associated value, if present; `NULL`, otherwise.
+ */
+void* gc_ephemeron_table_get (gc_ephemeron_table_t* table, void* key);
+
+/**
+ * Remove a key, and its value, from an ephemeron table.
+ *
+ * \param table The table to update.
+ * \param key   The key to remove.
+ * \return `true` if the key was present; `false`, otherwise.
+ */
+bool gc_ephemeron_table_remove (gc_ephemeron_table_t* table, void* key);
+
+/**
+ * Count the entries of an ephemeron table.
+ *
+ * \param table The table.
+ * \return The number of entries whose keys have not been removed or collected.
+ */
+size_t gc_ephemeron_table_count (gc_ephemeron_table_t* table);
+
+/**
+ * Open a region.  Until it is closed, objects (other than those whose layouts
+ * have finalizers) are allocated by pointer bumping into dedicated chunks at
+ * the top of the heap, and are never individually swept.  Regions do not nest.
+ */
+void gc_region_begin ();
+
+/**
+ * Close the open region, releasing all of its objects at once.  A region
+ * object has _escaped_ if it can be reached, through region objects alone,
+ * from the root set, from an object outside the region into which a pointer
+ * into it was stored by `gc_store()` (or `gc_store_ref()`), or from an object
+ * that a collection during the region found pointing into it.  Escaped objects
+ * are first copied into the heap, with those pointers to them updated.  Other
+ * pointers into the region, such as one assigned directly into a heap object
+ * that no collection has since seen, become invalid.  The cost is proportional
+ * to those starting points and to the objects promoted, not to the heap.
+ *
+ * \return The number of objects promoted into the heap.
+ */
+size_t gc_region_end ();
+
+/**
+ * Start the sampling allocation profiler, discarding any previous profile.
+ * Allocations are sampled, with a backtrace of their call sites, on average
+ * once per `sample_interval` bytes; and each collection takes a census of the
+ * live objects by layout.  Allocations by every thread, in every heap, are
+ * sampled into the one profile; each thread counts its own bytes to its next
+ * sample.
+ *
+ * \param sample_interval The mean number of bytes allocated between samples;
+ *                        `0` for `GC_PROFILE_DEFAULT_INTERVAL`.
+ */
+void gc_profile_start (size_t sample_interval);
+
+/**
+ * Stop the sampling allocation profiler, keeping the profile gathered so far.
+ */
+void gc_profile_stop ();
+
+/**
+ * Discard the profile gathered so far.
+ */
+void gc_profile_reset ();
+
+/**
+ * Write the profile gathered so far to a file.
+ *
+ * \param path   The file to write.
+ * \param format The format in which to write it.
+ * \return `true` if successful; `false` if the file could not be written.
+ */
+bool gc_profile_dump (const char* path, gc_profile_format_t format);
+
+/**
+ * Start writing a binary trace of the collector's events (allocations,
+ * collections and their phases, heap sizes, finalizer batches) to a file,
+ * stopping any trace already being written.  Events are buffered in memory and
+ * written in batches by a background thread; the `gctrace` tool decodes them.
+ *
+ * \param path The file to write.
+ * \return `true` if tracing has started; `false` if it could not be.
+ */
+bool gc_trace_start (const char* path);
+
+/**
+ * Stop tracing, writing out any buffered events and closing the trace file.
+ */
+void gc_trace_stop ();
+
+/**
+ * Start recording the current heap's allocations (including those of weak
+ * references and ephemeron tables), resizes, pointer stores (those made with
+ * `gc_store()` and `gc_store_ref()`), ephemeron table puts and removals, root
+ * set insertions, regions and collections to a compact binary file, stopping
+ * any recording already being made.  The `gcreplay` tool re-executes such
+ * recordings, so that changes to the collector can be measured against a real
+ * program's workload.  Objects allocated before recording began are unknown to
+ * it:  stores into them are not recorded, and stores of them are recorded as
+ * `NULL`.  Recording slows every allocation, and is meant for one thread, and
+ * one heap, at a time.
+ *
+ * \param path The file to write.
+ * \return `true` if recording has started; `false` if the file could not be
+ *         created.
+ */
+bool gc_record_start (const char* path);
+
+/**
+ * Stop recording, writing out any buffered events and closing the file.
+ */
+void gc_record_stop ();
+
+/**
+ * Save the heap reachable from the given roots, along with the layouts of its
+ * objects, as a _heap image_ that `gc_image_load()` can later map back into a
+ * heap.  Weak references whose targets are not otherwise saved are cleared in
+ * the image; ephemeron tables are saved with all of their entries.  Objects
+ * whose layouts have finalizers cannot be saved, and nothing can be saved
+ * while a region is open.
+ *
+ * \param path      The file to write.
+ * \param roots     The roots of the objects to save.
+ * \param num_roots The number of roots.
+ * \return `true` if successful; `false`, otherwise.
+ */
+bool gc_image_save (const char* path, void** roots, size_t num_roots);
+
+/**
+ * Map a heap image into the heap.  An image loaded before anything has been
+ * allocated is mapped without relocation, and so its pages are shared with the
+ * file until written; otherwise, its pointers are relocated as it is loaded.
+ * Either way, the image is checked throughout, and a malformed one is refused.
+ * The loaded objects are described by copies of the saved layouts, which live
+ * in the heap; the layouts passed to `gc_image_save()` are not used.
+ *
+ * \param path      The file to read.
+ * \param roots     Where to store the image's roots, in the order saved.
+ * \param max_roots The number of roots there is room for.
+ * \param num_roots Where to store the number of roots; may be `NULL`.
+ * \return `true` if successful; `false`, otherwise.
+ */
+bool gc_image_load (const char* path, void** roots, size_t max_roots, size_t* num_roots);
+
+/**
+ * Run the finalizers of up to `max_count` objects queued by collections.  This
+ * is the on-demand alternative to `gc_finalizer_thread_start()`.
+ *
+ * \param max_count The most objects to finalize; `0` for no limit.
+ * \return The number of objects finalized.
+ */
+size_t gc_finalize (size_t max_count);
+
+/**
+ * Start a background thread that runs finalizers in batches as collections
+ * queue objects.  Finalizers run concurrently with the rest of the program, so
+ * they must not allocate from, or collect, the heap.
+ *
+ * \return `true` if the thread is running; `false` if it could not be started.
+ */
+bool gc_finalizer_thread_start ();
+
+/**
+ * Stop the background finalizer thread, waiting for its current batch to
+ * finish.  Objects still queued remain so, for `gc_finalize()`.
+ */
+void gc_finalizer_thread_stop ();
+// ==============================================================================
+
+
+
+// ==============================================================================
+// C++ LINKAGE AND TEMPLATES
+
+#if defined (__cplusplus)
+} // extern "C"
+
+/**
+ * A constant layout for the type `T`, whose pointer fields are at the given
+ * offsets (wrapped in `GC_REF_OFFSET()` for compressed references):
+ *
+ *     typedef gc_typed_layout<node_s, offsetof(node_s, next)> node_layout;
+ *     node_s* node = gc_new(&node_layout::layout);
+ */
+template <typename T, size_t... Offsets>
+struct gc_typed_layout {
+
+  /** The offsets, with a trailing sentinel so that the array is never empty. */
+  static const size_t      ptr_offsets[sizeof...(Offsets) + 1];
+
+  /** The layout itself. */
+  static const gc_layout_s layout;
+
+};
+
+template <typename T, size_t... Offsets>
+const size_t gc_typed_layout<T, Offsets...>::ptr_offsets[sizeof...(Offsets) + 1] = { Offsets..., 0 };
+
+template <typename T, size_t... Offsets>
+const gc_layout_s gc_typed_layout<T, Offsets...>::layout = {
+  sizeof(T),
+  sizeof...(Offsets),
+  sizeof...(Offsets) > 0 ? gc_typed_layout<T, Offsets...>::ptr_offsets : NULL,
+  NULL
+};
+
+/**
+ * Allocate an object of type `T`, whose pointer fields are at the given
+ * offsets:  `gc_new_typed<node_s, offsetof(node_s, next)>()`.
+ *
+ * \return A pointer to the allocated object, if successful; `NULL` if unsuccessful.
+ */
+template <typename T, size_t... Offsets>
+inline T* gc_new_typed () {
+
+  return static_cast<T*>(gc_new(&gc_typed_layout<T, Offsets...>::layout));
+
+} // gc_new_typed ()
+#endif // defined (__cplusplus)
 // ==============================================================================
 
 
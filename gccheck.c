@@ -0,0 +1,1997 @@
+// ==============================================================================
+/**
+ * gccheck.c
+ *
+ * Behaviour checks for the collector's features, checked by `assert()`.
+ *
+ *   gccheck [<check>...]
+ *
+ * With no arguments, every check is run; otherwise, only those named.  The
+ * image check runs a second `gccheck`, to load an image into a fresh process:
+ *
+ *   gccheck --image-load <image>
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <assert.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gc.h"
+#include "gc-record.h"
+#include "gc-trace.h"
+
+#if defined (NDEBUG)
+#error "gccheck checks by assert(), so it cannot be built with NDEBUG"
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS
+
+/** The address space reserved for each heap that a check creates. */
+#define CHECK_HEAP_SIZE ((size_t)1 << 28)
+
+/** The number of objects of each size that the allocation check allocates. */
+#define CHECK_ALLOCATED 200
+
+/** The length of the lists that the region check allocates. */
+#define CHECK_REGION_LIST 1000
+
+/** The number of objects that the profiler check allocates, and its interval. */
+#define CHECK_PROFILED          10000
+#define CHECK_PROFILE_INTERVAL  1024
+
+/** The length of the list that the image check saves, and its number of roots. */
+#define CHECK_IMAGE_LIST  1000
+#define CHECK_IMAGE_ROOTS 3
+
+/** Payloads by which the corrupt image check finds its nodes in the file. */
+#define CHECK_IMAGE_HEAD 0x5ca1ab1e0001
+#define CHECK_IMAGE_TAIL 0x5ca1ab1e0002
+
+/**
+ * The number of collections that the trace check traces, and the number of
+ * objects allocated before each:  enough to fill the trace's buffer.
+ */
+#define CHECK_TRACED_GCS    100
+#define CHECK_TRACED_ALLOCS 100000
+
+/** The longest vector that the resize check grows. */
+#define CHECK_VECTOR_MAX 1000
+
+/**
+ * The number of threads, each with a heap, that the heaps check runs, and the
+ * length of the lists that each allocates.
+ */
+#define CHECK_HEAP_THREADS     4
+#define CHECK_HEAP_THREAD_LIST 1000
+
+/**
+ * The number of collections that the Immix check runs -- more than there are
+ * mark epochs -- and the length of the list it keeps across each.
+ */
+#define CHECK_IMMIX_GCS  300
+#define CHECK_IMMIX_LIST 200
+
+/** The length of the lists that the compressed reference check allocates. */
+#define CHECK_REF_LIST 10000
+
+/**
+ * The most pointer fields of the wide objects that the scan check builds, and
+ * the number of candidate objects that their fields may refer to.
+ */
+#define CHECK_SCAN_MAX_PTRS   96
+#define CHECK_SCAN_CANDIDATES 64
+
+/** The number of old objects that the minor collection check keeps. */
+#define CHECK_MINOR_OLD 1000
+
+/** The number of finalized objects each finalizer check allocates. */
+#define CHECK_FINALIZED 100
+
+/** How long to wait for the finalizer thread, in milliseconds. */
+#define CHECK_FINALIZER_WAIT_MS 5000
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** A linked node, with a second pointer for graphs and a payload. */
+typedef struct node {
+
+  struct node* next;
+  void*        other;
+  long         value;
+
+} node_s;
+
+/** A structure whose pointers are not at its start, for the layout macros. */
+typedef struct pair {
+
+  long    tag;
+  node_s* first;
+  long    count;
+  node_s* second;
+
+} pair_s;
+
+/** A linked node whose links are compressed references. */
+typedef struct ref_node {
+
+  gc_ref_t next;
+  gc_ref_t other;
+  long     value;
+
+} ref_node_s;
+
+/** A named check. */
+typedef struct check {
+
+  const char* name;
+  void        (*run) ();
+
+} check_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// COLLECTOR INTERNALS
+//
+//   The scans of pointer fields among which `mark()` chooses, and the pop of
+//   the root set onto which they push, for the scan check to compare them.
+
+/** A scan of an object's pointer fields. */
+typedef void (*check_scan_f) (gc_heap_t* heap, void* obj, const size_t* offsets, unsigned int num_ptrs);
+
+void  mark_scan_scalar (gc_heap_t* heap, void* obj, const size_t* offsets, unsigned int num_ptrs);
+#if defined (__x86_64__)
+void  mark_scan_sse2   (gc_heap_t* heap, void* obj, const size_t* offsets, unsigned int num_ptrs);
+void  mark_scan_avx2   (gc_heap_t* heap, void* obj, const size_t* offsets, unsigned int num_ptrs);
+#endif
+void* rs_pop ();
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The number of objects finalized so far, and the sum of their payloads. */
+static long finalized_count = 0;
+static long finalized_sum   = 0;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Count a node's finalization, adding in the payload of the node it reaches,
+ * which must have survived along with it.
+ *
+ * \param obj The node.
+ */
+void check_finalize_node (void* obj) {
+
+  node_s* node = obj;
+  __atomic_add_fetch(&finalized_sum,   node->next->value, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&finalized_count, 1,                 __ATOMIC_RELEASE);
+
+} // check_finalize_node ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// LAYOUTS
+
+GC_DEFINE_LAYOUT(node_layout, node_s, next, other);
+GC_DEFINE_FINALIZED_LAYOUT(finalized_layout, node_s, check_finalize_node, next, other);
+GC_DEFINE_LAYOUT(pair_layout, pair_s, first, second);
+GC_DEFINE_REF_LAYOUT(ref_node_layout, ref_node_s, next, other);
+
+/**
+ * Leaf layouts of sizes on either side of the largest span that an allocation
+ * buffer serves.
+ */
+static const gc_layout_s sized_layouts[] = {
+  { 8,                                              0, NULL, NULL },
+  { 100,                                            0, NULL, NULL },
+  { GC_BUFFER_MAX_SPAN - sizeof(gc_header_s),      0, NULL, NULL },
+  { GC_BUFFER_MAX_SPAN - sizeof(gc_header_s) + 16, 0, NULL, NULL },
+  { 3 * GC_BUFFER_MAX_SPAN,                         0, NULL, NULL },
+};
+
+#define NUM_SIZED_LAYOUTS (sizeof(sized_layouts) / sizeof(sized_layouts[0]))
+
+/** Layouts for vectors of node pointers, by length, and their offsets. */
+static size_t      vector_offsets[CHECK_VECTOR_MAX];
+static gc_layout_s vector_layouts[CHECK_VECTOR_MAX + 1];
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Create a heap for a check, and make it current.
+ *
+ * \param policy How the heap's objects are organized.
+ * \return The heap.
+ */
+gc_heap_t* check_heap_begin (gc_heap_policy_t policy) {
+
+  gc_heap_t* heap = gc_heap_create_with_policy(CHECK_HEAP_SIZE, policy);
+  assert(heap != NULL);
+  gc_heap_switch(heap);
+
+  return heap;
+
+} // check_heap_begin ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Build the path of a scratch file for a check, unique to this process.
+ *
+ * \param path The buffer in which to build it.
+ * \param size The buffer's size.
+ * \param name The file's name.
+ */
+void check_path (char* path, size_t size, const char* name) {
+
+  int length = snprintf(path, size, "/tmp/gccheck-%d-%s", (int)getpid(), name);
+  assert(length > 0 && (size_t)length < size);
+
+} // check_path ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Run one of the programs built alongside this one, with its output discarded,
+ * and wait for it.
+ *
+ * \param program The program's name.
+ * \param argv    Its arguments, starting with its name and ending with `NULL`.
+ * \param quiet   Whether to discard its error messages, too.
+ * \return Its exit status; `-1` if it did not exit normally.
+ */
+int check_run (const char* program, char* const* argv, bool quiet) {
+
+  char    self[4096];
+  char    path[4096 + 64];
+  ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  assert(length > 0);
+  self[length] = '\0';
+  snprintf(path, sizeof(path), "%s/%s", dirname(self), program);
+
+  fflush(stdout);
+  pid_t child = fork();
+  assert(child >= 0);
+  if (child == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+      dup2(null, STDOUT_FILENO);
+      if (quiet) {
+	dup2(null, STDERR_FILENO);
+      }
+    }
+    execv(path, argv);
+    _exit(127);
+  }
+  int status;
+  assert(waitpid(child, &status, 0) == child);
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+} // check_run ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read the whole of a file.
+ *
+ * \param path The file.
+ * \return The contents, terminated by a null byte, which the caller must free.
+ */
+char* check_read_file (const char* path) {
+
+  FILE* in = fopen(path, "r");
+  assert(in != NULL);
+  size_t size     = 0;
+  size_t capacity = 4096;
+  char*  contents = malloc(capacity);
+  assert(contents != NULL);
+  size_t count;
+  while ((count = fread(contents + size, 1, capacity - size - 1, in)) > 0) {
+    size += count;
+    if (size == capacity - 1) {
+      capacity *= 2;
+      contents  = realloc(contents, capacity);
+      assert(contents != NULL);
+    }
+  }
+  fclose(in);
+  contents[size] = '\0';
+
+  return contents;
+
+} // check_read_file ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a node.
+ *
+ * \param next  The node's successor; may be `NULL`.
+ * \param value The node's payload.
+ * \return The node.
+ */
+node_s* check_node (node_s* next, long value) {
+
+  node_s* node = gc_new(&node_layout);
+  assert(node != NULL);
+  node->next  = next;
+  node->other = NULL;
+  node->value = value;
+
+  return node;
+
+} // check_node ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a weak reference in the current heap.
+ *
+ * \param target The object to refer to; may be `NULL`.
+ * \return The weak reference.
+ */
+gc_weak_ref_t* check_weak_new (void* target) {
+
+  gc_weak_ref_t* weak = gc_weak_new(target);
+  assert(weak != NULL);
+
+  return weak;
+
+} // check_weak_new ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that a collection clears weak references to unreachable objects, and
+ * only those.
+ */
+void check_weak () {
+
+  node_s*        live      = check_node(NULL, 1);
+  gc_weak_ref_t* weak_live = check_weak_new(live);
+  gc_weak_ref_t* weak_dead = check_weak_new(check_node(NULL, 2));
+  gc_weak_ref_t* weak_null = check_weak_new(NULL);
+
+  // A weak reference reachable only through a live object works the same way.
+  live->other = check_weak_new(check_node(NULL, 3));
+
+  gc_root_set_insert(live);
+  gc_root_set_insert(weak_live);
+  gc_root_set_insert(weak_dead);
+  gc_root_set_insert(weak_null);
+  gc();
+  assert(gc_weak_get(weak_live) == live);
+  assert(gc_weak_get(weak_dead) == NULL);
+  assert(gc_weak_get(weak_null) == NULL);
+  assert(gc_weak_get(live->other) == NULL);
+  assert(live->value == 1);
+
+  // Once its target is unreachable, so is a weak reference's value.
+  gc_root_set_insert(weak_live);
+  gc();
+  assert(gc_weak_get(weak_live) == NULL);
+
+} // check_weak ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that an ephemeron table's entries live exactly as long as their keys,
+ * including keys reachable only through other entries' values, and that a
+ * value referring to its own key does not keep the entry alive.
+ */
+void check_ephemeron () {
+
+  gc_ephemeron_table_t* table = gc_ephemeron_table_new(16);
+  assert(table != NULL);
+
+  // A rooted key, and one that is not.
+  node_s* key_live = check_node(NULL, 1);
+  node_s* key_dead = check_node(NULL, 2);
+  node_s* val_live = check_node(NULL, 10);
+  assert(gc_ephemeron_table_put(table, key_live, val_live));
+  assert(gc_ephemeron_table_put(table, key_dead, check_node(NULL, 20)));
+  gc_weak_ref_t* weak_dead = check_weak_new(gc_ephemeron_table_get(table, key_dead));
+
+  // A chain:  a rooted key whose value is the key of a second entry.
+  node_s* chain_head = check_node(NULL, 3);
+  node_s* chain_key  = check_node(NULL, 4);
+  node_s* chain_val  = check_node(NULL, 40);
+  assert(gc_ephemeron_table_put(table, chain_head, chain_key));
+  assert(gc_ephemeron_table_put(table, chain_key,  chain_val));
+  gc_weak_ref_t* weak_chain = check_weak_new(chain_val);
+
+  // A cycle:  an unrooted key whose value refers back to it.
+  node_s* cycle_key = check_node(NULL, 5);
+  assert(gc_ephemeron_table_put(table, cycle_key, check_node(cycle_key, 50)));
+  gc_weak_ref_t* weak_cycle = check_weak_new(cycle_key);
+  assert(gc_ephemeron_table_count(table) == 5);
+
+  gc_root_set_insert(table);
+  gc_root_set_insert(key_live);
+  gc_root_set_insert(chain_head);
+  gc_root_set_insert(weak_dead);
+  gc_root_set_insert(weak_chain);
+  gc_root_set_insert(weak_cycle);
+  gc();
+  assert(gc_ephemeron_table_count(table) == 3);
+  assert(gc_ephemeron_table_get(table, key_live) == val_live);
+  assert(val_live->value == 10);
+  assert(gc_ephemeron_table_get(table, chain_head) == chain_key);
+  assert(gc_ephemeron_table_get(table, chain_key) == chain_val);
+  assert(chain_val->value == 40);
+  assert(gc_weak_get(weak_dead) == NULL);
+  assert(gc_weak_get(weak_cycle) == NULL);
+  assert(gc_weak_get(weak_chain) == chain_val);
+
+  // Dropping the head of the chain drops the whole of it.
+  gc_root_set_insert(table);
+  gc_root_set_insert(key_live);
+  gc_root_set_insert(weak_chain);
+  gc();
+  assert(gc_ephemeron_table_count(table) == 1);
+  assert(gc_weak_get(weak_chain) == NULL);
+
+  // Removal drops an entry at once.
+  assert(gc_ephemeron_table_remove(table, key_live));
+  assert(gc_ephemeron_table_get(table, key_live) == NULL);
+  assert(gc_ephemeron_table_count(table) == 0);
+
+} // check_ephemeron ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `CHECK_FINALIZED` unreachable, finalized nodes, each reaching an
+ * ordinary node whose payload is its index.
+ *
+ * \param lowest  Where to store the lowest address of the nodes allocated.
+ * \param highest Where to store the highest.
+ */
+void check_finalized_garbage (char** lowest, char** highest) {
+
+  *lowest  = NULL;
+  *highest = NULL;
+  for (long i = 0; i < CHECK_FINALIZED; i += 1) {
+    node_s* node = gc_new(&finalized_layout);
+    assert(node != NULL);
+    node->next  = check_node(NULL, i);
+    node->other = NULL;
+    node->value = i;
+    char* ends[] = { (char*)node, (char*)node->next };
+    for (int j = 0; j < 2; j += 1) {
+      if (*lowest == NULL || ends[j] < *lowest) {
+	*lowest = ends[j];
+      }
+      if (ends[j] > *highest) {
+	*highest = ends[j];
+      }
+    }
+  }
+
+} // check_finalized_garbage ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that finalizers run, once each, on objects found unreachable -- by
+ * `gc_finalize()` on demand, and by the finalizer thread -- with the objects
+ * they reach intact, and that the objects are collected afterwards.
+ */
+void check_finalize () {
+
+  long    index_sum = (long)CHECK_FINALIZED * (CHECK_FINALIZED - 1) / 2;
+  node_s* keep      = gc_new(&finalized_layout);
+  char*   lowest;
+  char*   highest;
+  assert(keep != NULL);
+  keep->next  = check_node(NULL, -1);
+  keep->other = NULL;
+  check_finalized_garbage(&lowest, &highest);
+
+  // One more, whose payload adds nothing, watched by a weak reference.
+  node_s* doomed = gc_new(&finalized_layout);
+  assert(doomed != NULL);
+  doomed->next        = check_node(NULL, 0);
+  doomed->other       = NULL;
+  gc_weak_ref_t* weak = check_weak_new(doomed);
+  finalized_count = 0;
+  finalized_sum   = 0;
+
+  // A collection only queues the objects, clearing weak references to them.
+  gc_root_set_insert(keep);
+  gc_root_set_insert(weak);
+  gc();
+  assert(finalized_count == 0);
+  assert(gc_weak_get(weak) == NULL);
+
+  // On demand, in batches, and then no more.
+  assert(gc_finalize(10) == 10);
+  assert(gc_finalize(0) == CHECK_FINALIZED + 1 - 10);
+  assert(gc_finalize(0) == 0);
+  assert(finalized_count == CHECK_FINALIZED + 1);
+  assert(finalized_sum == index_sum);
+
+  // Once finalized, they are collected, and their space is reused; the rooted
+  // object never is.
+  gc_root_set_insert(keep);
+  gc();
+  assert(gc_finalize(0) == 0);
+  assert(keep->next->value == -1);
+  bool reused = false;
+  for (long i = 0; i < 2 * CHECK_FINALIZED && !reused; i += 1) {
+    char* node = (char*)check_node(NULL, i);
+    reused     = node >= lowest && node <= highest;
+  }
+  assert(reused);
+
+  // By the finalizer thread, without being asked.
+  finalized_count = 0;
+  finalized_sum   = 0;
+  assert(gc_finalizer_thread_start());
+  check_finalized_garbage(&lowest, &highest);
+  gc_root_set_insert(keep);
+  gc();
+  struct timespec pause = { 0, 1000000 };
+  for (int waited = 0;
+       __atomic_load_n(&finalized_count, __ATOMIC_ACQUIRE) < CHECK_FINALIZED && waited < CHECK_FINALIZER_WAIT_MS;
+       waited += 1) {
+    nanosleep(&pause, NULL);
+  }
+  gc_finalizer_thread_stop();
+  assert(finalized_count == CHECK_FINALIZED);
+  assert(finalized_sum == index_sum);
+  assert(gc_finalize(0) == 0);
+
+  // Once dropped, the rooted object is finalized, too, and then collected.
+  finalized_count = 0;
+  gc();
+  assert(gc_finalize(0) == 1);
+  assert(finalized_count == 1);
+  gc();
+
+} // check_finalize ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a list of nodes, whose payloads count down to `0` from the head.
+ *
+ * \param length The number of nodes.
+ * \return The head of the list.
+ */
+node_s* check_list (long length) {
+
+  node_s* head = NULL;
+  for (long i = 0; i < length; i += 1) {
+    head = check_node(head, i);
+  }
+
+  return head;
+
+} // check_list ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that a list's payloads count down to `0` from the head.
+ *
+ * \param head   The head of the list.
+ * \param length The list's expected length.
+ */
+void check_list_intact (node_s* head, long length) {
+
+  for (long i = length - 1; i >= 0; i -= 1) {
+    assert(head != NULL);
+    assert(head->value == i);
+    head = head->next;
+  }
+  assert(head == NULL);
+
+} // check_list_intact ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that closing a region promotes exactly the objects that escaped it --
+ * through the root set, through `gc_store()`, and through a heap object that a
+ * collection during the region found pointing into it -- and that the promoted
+ * copies outlive the region's chunks being reused.
+ */
+void check_region () {
+
+  node_s* stored = check_node(NULL, -1);
+  node_s* seen   = check_node(NULL, -2);
+
+  // Objects that do not escape are not promoted.
+  gc_region_begin();
+  check_list(CHECK_REGION_LIST);
+  assert(gc_region_end() == 0);
+
+  // Escape by a store into a heap object.
+  gc_region_begin();
+  node_s* list = check_list(CHECK_REGION_LIST);
+  check_list(CHECK_REGION_LIST);
+  gc_store(stored, (void**)&stored->next, list);
+  assert(gc_region_end() == CHECK_REGION_LIST);
+  assert(stored->next != list);
+  check_list_intact(stored->next, CHECK_REGION_LIST);
+
+  // Escape by a plain assignment, seen by a collection during the region.
+  gc_region_begin();
+  seen->next = check_list(CHECK_REGION_LIST);
+  gc_root_set_insert(stored);
+  gc_root_set_insert(seen);
+  gc();
+  check_list(CHECK_REGION_LIST);
+  assert(gc_region_end() == CHECK_REGION_LIST);
+  check_list_intact(seen->next, CHECK_REGION_LIST);
+
+  // Escape through the root set.
+  gc_region_begin();
+  gc_root_set_insert(check_list(CHECK_REGION_LIST / 2));
+  assert(gc_region_end() == CHECK_REGION_LIST / 2);
+
+  // The promoted lists survive later regions and collections.
+  gc_region_begin();
+  for (long i = 0; i < 4 * CHECK_REGION_LIST; i += 1) {
+    check_node(NULL, -3);
+  }
+  assert(gc_region_end() == 0);
+  gc_root_set_insert(stored);
+  gc_root_set_insert(seen);
+  gc();
+  check_list_intact(stored->next, CHECK_REGION_LIST);
+  check_list_intact(seen->next, CHECK_REGION_LIST);
+
+} // check_region ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a node, as the call site that the profiler should attribute it to.
+ *
+ * \param next The node's successor.
+ * \return The node.
+ */
+__attribute__((noinline)) node_s* check_profile_site (node_s* next) {
+
+  node_s* node = gc_new(&node_layout);
+  assert(node != NULL);
+  node->next  = next;
+  node->other = NULL;
+
+  return node;
+
+} // check_profile_site ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that the profiler's census counts the live objects by layout, and that
+ * its samples are attributed to their call sites rather than to the
+ * allocator's own frames, in both output formats.
+ */
+void check_profile () {
+
+  char path[64];
+  char expected[128];
+  check_path(path, sizeof(path), "profile");
+
+  gc_profile_start(CHECK_PROFILE_INTERVAL);
+  node_s* list = NULL;
+  for (int i = 0; i < CHECK_PROFILED; i += 1) {
+    list = check_profile_site(list);
+    check_node(NULL, i);
+  }
+  gc_root_set_insert(list);
+  gc();
+  gc_profile_stop();
+
+  // The census sees only the live nodes; every node is the same layout.
+  assert(gc_profile_dump(path, GC_PROFILE_TEXT));
+  char* text = check_read_file(path);
+  snprintf(expected, sizeof(expected), "%-18p %10zu %6u %12d",
+	   (void*)&node_layout, sizeof(node_s), 2, CHECK_PROFILED);
+  assert(strstr(text, expected) != NULL);
+  snprintf(expected, sizeof(expected), "layout %p: ", (void*)&node_layout);
+  assert(strstr(text, expected) != NULL);
+  assert(strstr(text, "(check_profile_site+") != NULL);
+  assert(strstr(text, "(gc_heap_new_slow+") == NULL);
+  assert(strstr(text, "(gc_new_slow+") == NULL);
+  assert(strstr(text, "(profile_sample+") == NULL);
+  free(text);
+
+  assert(gc_profile_dump(path, GC_PROFILE_PPROF));
+  text = check_read_file(path);
+  snprintf(expected, sizeof(expected), "@ heap_v2/%d\n", CHECK_PROFILE_INTERVAL);
+  assert(strncmp(text, "heap profile: ", strlen("heap profile: ")) == 0);
+  assert(strstr(text, expected) != NULL);
+  assert(strstr(text, "\nMAPPED_LIBRARIES:\n") != NULL);
+  free(text);
+
+  unlink(path);
+  gc_profile_reset();
+
+} // check_profile ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check the roots of a loaded image:  a list, a weak reference to its head, and
+ * an ephemeron table mapping its head to its tail.  Then collect the heap, and
+ * check them again.
+ *
+ * \param roots The roots.
+ */
+void check_image_roots (void** roots) {
+
+  for (int pass = 0; pass < 2; pass += 1) {
+    node_s* head = roots[0];
+    check_list_intact(head, CHECK_IMAGE_LIST);
+    node_s* tail = head;
+    while (tail->next != NULL) {
+      tail = tail->next;
+    }
+    assert(gc_weak_get(roots[1]) == head);
+    assert(gc_ephemeron_table_count(roots[2]) == 1);
+    assert(gc_ephemeron_table_get(roots[2], head) == tail);
+
+    // The loaded objects belong to the heap, and are collected like any other.
+    for (int i = 0; i < CHECK_IMAGE_ROOTS; i += 1) {
+      gc_root_set_insert(roots[i]);
+    }
+    gc();
+    check_list(CHECK_IMAGE_LIST);
+  }
+
+} // check_image_roots ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the first aligned word of a buffer with a given value.
+ *
+ * \param data  The buffer.
+ * \param size  Its size.
+ * \param value The value.
+ * \return The word's offset.
+ */
+size_t check_find_word (const char* data, size_t size, uint64_t value) {
+
+  for (size_t at = 0; at + sizeof(uint64_t) <= size; at += sizeof(uint64_t)) {
+    if (*(const uint64_t*)(data + at) == value) {
+      return at;
+    }
+  }
+  assert(false);
+
+  return 0;
+
+} // check_find_word ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Load an image, as the fresh process run by the image check, and check that
+ * it was mapped where it was laid out, without relocation:  each root lies at
+ * one of the offsets, from the base address, that the file records.
+ *
+ * \param path The image.
+ * \return The process's exit status.
+ */
+int check_image_load (const char* path) {
+
+  void*     roots[CHECK_IMAGE_ROOTS];
+  size_t    num_roots;
+  size_t    page   = sysconf(_SC_PAGESIZE);
+  uint64_t* prefix = malloc(page);
+  FILE*     in     = fopen(path, "rb");
+  assert(prefix != NULL && in != NULL);
+  assert(fread(prefix, 1, page, in) == page);
+  fclose(in);
+
+  // The base follows the magic number and two 32-bit sizes; the roots' offsets
+  // follow the rest of the header.
+  assert(gc_image_load(path, roots, CHECK_IMAGE_ROOTS, &num_roots));
+  assert(num_roots == CHECK_IMAGE_ROOTS);
+  for (int i = 0; i < CHECK_IMAGE_ROOTS; i += 1) {
+    check_find_word((const char*)prefix, page, (uintptr_t)roots[i] - prefix[2]);
+  }
+  free(prefix);
+  check_image_roots(roots);
+
+  return 0;
+
+} // check_image_load ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write a copy of an image with a word overwritten, and check that loading the
+ * copy is refused.
+ *
+ * \param path   The file to write the copy to.
+ * \param data   The image.
+ * \param size   Its size.
+ * \param offset The offset of the word to overwrite.
+ * \param value  The word's new value.
+ */
+void check_image_refused (const char* path, const char* data, size_t size, size_t offset, uint64_t value) {
+
+  void*  roots[1];
+  size_t num_roots;
+  FILE*  out = fopen(path, "wb");
+  assert(out != NULL);
+  assert(fwrite(data, 1, offset, out) == offset);
+  assert(fwrite(&value, sizeof(value), 1, out) == 1);
+  assert(fwrite(data + offset + sizeof(value), 1, size - offset - sizeof(value), out) ==
+	 size - offset - sizeof(value));
+  fclose(out);
+  assert(!gc_image_load(path, roots, 1, &num_roots));
+
+} // check_image_refused ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that an image corrupted in any of the places that loading relies on --
+ * a header, a layout, a pointer or a root -- is refused, leaving the heap as it
+ * was, while the image as saved still loads.
+ *
+ * \param path The file to use.
+ */
+void check_image_corrupt (const char* path) {
+
+  node_s* tail     = check_node(NULL, CHECK_IMAGE_TAIL);
+  node_s* head     = check_node(tail, CHECK_IMAGE_HEAD);
+  void*   roots[1] = { head };
+  size_t  num_roots;
+  assert(gc_image_save(path, roots, 1));
+
+  struct stat file;
+  assert(stat(path, &file) == 0);
+  size_t size = file.st_size;
+  char*  data = malloc(size);
+  FILE*  in   = fopen(path, "rb");
+  assert(data != NULL && in != NULL);
+  assert(fread(data, 1, size, in) == size);
+  fclose(in);
+
+  // Find the nodes, their headers, the root, and the nodes' layout:  the only
+  // word of the nodes' size followed by one holding their number of pointers.
+  size_t page      = sysconf(_SC_PAGESIZE);
+  size_t head_at   = check_find_word(data, size, CHECK_IMAGE_HEAD) - offsetof(node_s, value);
+  size_t tail_at   = check_find_word(data, size, CHECK_IMAGE_TAIL) - offsetof(node_s, value);
+  size_t head_hdr  = head_at - sizeof(gc_header_s);
+  size_t tail_hdr  = tail_at - sizeof(gc_header_s);
+  size_t root_at   = check_find_word(data, page, head_at - page);
+  size_t layout_at = page;
+  while (*(uint64_t*)(data + layout_at) != sizeof(node_s) ||
+	 (uint32_t)*(uint64_t*)(data + layout_at + 8) != node_layout.num_ptrs) {
+    layout_at += sizeof(uint64_t);
+    assert(layout_at < head_hdr);
+  }
+  uint64_t tail_addr = *(uint64_t*)(data + head_at + offsetof(node_s, next));
+  uint64_t kind_word = *(uint64_t*)(data + head_hdr + offsetof(gc_header_s, allocated));
+
+  char bad_path[64];
+  check_path(bad_path, sizeof(bad_path), "image-bad");
+  check_list(CHECK_IMAGE_LIST);
+
+  // Headers.
+  check_image_refused(bad_path, data, size, tail_hdr + offsetof(gc_header_s, size), (uint64_t)1 << 40);
+  check_image_refused(bad_path, data, size, head_hdr + offsetof(gc_header_s, layout),
+		      *(uint64_t*)(data + head_hdr + offsetof(gc_header_s, layout)) + 8);
+  check_image_refused(bad_path, data, size, head_hdr + offsetof(gc_header_s, allocated),
+		      kind_word | (uint64_t)0x7f << (8 * (offsetof(gc_header_s, kind) -
+							   offsetof(gc_header_s, allocated))));
+  check_image_refused(bad_path, data, size, head_hdr + offsetof(gc_header_s, prev),
+		      tail_addr - sizeof(gc_header_s));
+  check_image_refused(bad_path, data, size, tail_hdr + offsetof(gc_header_s, next),
+		      tail_addr - (tail_at - head_at) - sizeof(gc_header_s));
+
+  // Layouts.
+  check_image_refused(bad_path, data, size, layout_at + 8, 1000000);
+  check_image_refused(bad_path, data, size, layout_at + 16, 0x10);
+  check_image_refused(bad_path, data, size, layout_at + 24, (uint64_t)(uintptr_t)check_finalize_node);
+
+  // Pointers, to the middle of an object and outside the image.
+  check_image_refused(bad_path, data, size, head_at + offsetof(node_s, next), tail_addr + 8);
+  check_image_refused(bad_path, data, size, head_at + offsetof(node_s, other), 0x10);
+
+  // Roots.
+  check_image_refused(bad_path, data, size, root_at, head_at - page + 8);
+  check_image_refused(bad_path, data, size, root_at, layout_at - page);
+
+  // The heap is untouched, and the image as saved loads into it.
+  unlink(bad_path);
+  free(data);
+  assert(gc_image_load(path, roots, 1, &num_roots));
+  assert(num_roots == 1);
+  node_s* loaded = roots[0];
+  assert(loaded->value == CHECK_IMAGE_HEAD && loaded->next->value == CHECK_IMAGE_TAIL);
+  assert(loaded->next->next == NULL);
+  gc_root_set_insert(loaded);
+  gc();
+  check_list(CHECK_IMAGE_LIST);
+  assert(loaded->next->value == CHECK_IMAGE_TAIL);
+
+} // check_image_corrupt ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that an image round-trips:  loaded into a fresh process, it is mapped
+ * in place; loaded into a heap already in use, it is relocated.  Either way,
+ * its objects, weak references and ephemeron tables are intact.  Check, too,
+ * that truncated, foreign or corrupt files, and images with too many roots, are
+ * refused, as is saving while a region is open.
+ */
+void check_image () {
+
+  char path[64];
+  check_path(path, sizeof(path), "image");
+
+  // The heap is at the same address in every process, and so a fresh process
+  // can load the image in place.
+  node_s*               head  = check_list(CHECK_IMAGE_LIST);
+  node_s*               tail  = head;
+  gc_ephemeron_table_t* table = gc_ephemeron_table_new(4);
+  assert(table != NULL);
+  while (tail->next != NULL) {
+    tail = tail->next;
+  }
+  assert(gc_ephemeron_table_put(table, head, tail));
+  void* saved[CHECK_IMAGE_ROOTS] = { head, check_weak_new(head), table };
+  assert(gc_image_save(path, saved, CHECK_IMAGE_ROOTS));
+
+  // Without relocation, in a fresh process.
+  char* const load[] = { "gccheck", "--image-load", path, NULL };
+  assert(check_run("gccheck", load, false) == 0);
+
+  // With relocation, into this heap, which is in use.
+  void*  roots[CHECK_IMAGE_ROOTS];
+  size_t num_roots;
+  check_list(CHECK_IMAGE_LIST);
+  assert(gc_image_load(path, roots, CHECK_IMAGE_ROOTS, &num_roots));
+  assert(num_roots == CHECK_IMAGE_ROOTS);
+  assert(roots[0] != head);
+  check_image_roots(roots);
+
+  // Nothing is saved while a region is open, and the objects that the region
+  // remembered stay remembered, to be promoted when it closes.  (A loaded
+  // image's file must be left alone, and so this one has a file of its own.)
+  char    region_path[64];
+  node_s* holder = check_node(NULL, -1);
+  check_path(region_path, sizeof(region_path), "image-region");
+  gc_region_begin();
+  gc_store(holder, (void**)&holder->next, check_list(CHECK_IMAGE_LIST));
+  saved[0] = holder;
+  assert(!gc_image_save(region_path, saved, 1));
+  assert(gc_region_end() == CHECK_IMAGE_LIST);
+  check_list_intact(holder->next, CHECK_IMAGE_LIST);
+  assert(gc_image_save(region_path, saved, 1));
+  assert(gc_image_load(region_path, roots, 1, &num_roots));
+  check_list_intact(((node_s*)roots[0])->next, CHECK_IMAGE_LIST);
+
+  // Refusals, of a truncated copy and the like, in a file of their own.
+  char   refused_path[64];
+  size_t truncated = 2 * sysconf(_SC_PAGESIZE);
+  char*  data      = malloc(truncated);
+  FILE*  in        = fopen(path, "rb");
+  assert(!gc_image_load(path, roots, CHECK_IMAGE_ROOTS - 1, &num_roots));
+  assert(data != NULL && in != NULL);
+  assert(fread(data, 1, truncated, in) == truncated);
+  fclose(in);
+  check_path(refused_path, sizeof(refused_path), "image-refused");
+  FILE* out = fopen(refused_path, "wb");
+  assert(out != NULL);
+  assert(fwrite(data, 1, truncated, out) == truncated);
+  fclose(out);
+  free(data);
+  assert(!gc_image_load(refused_path, roots, CHECK_IMAGE_ROOTS, &num_roots));
+  out = fopen(refused_path, "w");
+  assert(out != NULL);
+  fprintf(out, "not a heap image\n");
+  fclose(out);
+  assert(!gc_image_load(refused_path, roots, CHECK_IMAGE_ROOTS, &num_roots));
+  assert(!gc_image_load("/nonexistent/gccheck-image", roots, CHECK_IMAGE_ROOTS, &num_roots));
+
+  unlink(path);
+  unlink(region_path);
+
+  check_image_corrupt(refused_path);
+  unlink(refused_path);
+
+} // check_image ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check, on a heap of the given policy, that the layout macros find a
+ * structure's pointers wherever they lie, and that objects of every size,
+ * whether bump-allocated from a buffer or not, are disjoint and survive
+ * collections intact.
+ *
+ * \param policy How the heap's objects are organized.
+ */
+void check_alloc_policy (gc_heap_policy_t policy) {
+
+  gc_heap_t* heap = check_heap_begin(policy);
+  pair_s*    pair = gc_new(&pair_layout);
+  assert(pair != NULL);
+  pair->first  = check_list(10);
+  pair->second = check_list(20);
+
+  // Fill every object with a byte of its own, with garbage between them.
+  size_t         count = NUM_SIZED_LAYOUTS * CHECK_ALLOCATED;
+  unsigned char* objects[NUM_SIZED_LAYOUTS * CHECK_ALLOCATED];
+  for (size_t i = 0; i < count; i += 1) {
+    const gc_layout_s* layout = &sized_layouts[i % NUM_SIZED_LAYOUTS];
+    objects[i] = gc_new(layout);
+    assert(objects[i] != NULL);
+    memset(objects[i], (int)(i % 251) + 1, layout->size);
+    assert(gc_new(&sized_layouts[(i + 1) % NUM_SIZED_LAYOUTS]) != NULL);
+  }
+
+  for (int pass = 0; pass < 2; pass += 1) {
+    for (size_t i = 0; i < count; i += 1) {
+      size_t size = sized_layouts[i % NUM_SIZED_LAYOUTS].size;
+      for (size_t j = 0; j < size; j += 1) {
+	assert(objects[i][j] == (unsigned char)(i % 251 + 1));
+      }
+      gc_root_set_insert(objects[i]);
+    }
+    gc_root_set_insert(pair);
+    gc();
+    check_list_intact(pair->first, 10);
+    check_list_intact(pair->second, 20);
+
+    // Reuse the garbage's space before checking again.
+    for (size_t i = 0; i < count; i += 1) {
+      const gc_layout_s* layout = &sized_layouts[i % NUM_SIZED_LAYOUTS];
+      void*              reuse  = gc_new(layout);
+      assert(reuse != NULL);
+      memset(reuse, 0, layout->size);
+    }
+  }
+
+  gc_heap_destroy(heap);
+
+} // check_alloc_policy ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check the layout macros and allocation of every size, on heaps of both
+ * policies.
+ */
+void check_alloc () {
+
+  assert(pair_layout.size == sizeof(pair_s));
+  assert(pair_layout.num_ptrs == 2);
+  assert(pair_layout.ptr_offsets[0] == offsetof(pair_s, first));
+  assert(pair_layout.ptr_offsets[1] == offsetof(pair_s, second));
+
+  check_alloc_policy(GC_HEAP_FREE_LIST);
+  check_alloc_policy(GC_HEAP_IMMIX);
+
+} // check_alloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that a trace of a busy allocator keeps every collection's events, in
+ * order, even when allocation events must be dropped to keep up.
+ */
+void check_trace () {
+
+  char path[64];
+  check_path(path, sizeof(path), "trace");
+
+  assert(gc_trace_start(path));
+  for (int i = 0; i < CHECK_TRACED_GCS; i += 1) {
+    for (int j = 0; j < CHECK_TRACED_ALLOCS; j += 1) {
+      check_node(NULL, j);
+    }
+    gc();
+  }
+  gc_trace_stop();
+
+  FILE* in = fopen(path, "rb");
+  assert(in != NULL);
+  trace_file_header_s header;
+  assert(fread(&header, sizeof(header), 1, in) == 1);
+  assert(memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0);
+  assert(header.version == TRACE_VERSION);
+  assert(header.event_size == sizeof(trace_event_s));
+
+  // Each collection begins, runs its phases in order, and ends.
+  trace_event_s event;
+  uint64_t      time       = 0;
+  size_t        allocs     = 0;
+  size_t        begun      = 0;
+  size_t        ended      = 0;
+  size_t        phases     = 0;
+  bool          collecting = false;
+  uint64_t      collection = 0;
+  while (fread(&event, sizeof(event), 1, in) == 1) {
+    assert(event.type < TRACE_NUM_TYPES);
+    assert(event.time >= time || event.type == TRACE_ALLOC);
+    if (event.type != TRACE_ALLOC) {
+      time = event.time;
+    }
+    switch (event.type) {
+    case TRACE_ALLOC:
+      allocs += 1;
+      break;
+    case TRACE_GC_BEGIN:
+      assert(!collecting);
+      collecting  = true;
+      collection  = event.arg0;
+      begun      += 1;
+      break;
+    case TRACE_GC_END:
+      assert(collecting && event.arg0 == collection);
+      collecting  = false;
+      ended      += 1;
+      break;
+    case TRACE_PHASE_BEGIN:
+    case TRACE_PHASE_END:
+      assert(collecting && event.arg0 < TRACE_NUM_PHASES && event.arg1 == collection);
+      phases += 1;
+      break;
+    default:
+      break;
+    }
+  }
+  fclose(in);
+  assert(begun == CHECK_TRACED_GCS && ended == CHECK_TRACED_GCS);
+  assert(phases >= 2 * CHECK_TRACED_GCS);
+  assert(allocs > 0);
+
+  unlink(path);
+
+} // check_trace ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Obtain the layout of a vector of node pointers.
+ *
+ * \param length The vector's length.
+ * \return Its layout.
+ */
+const gc_layout_s* check_vector_layout (size_t length) {
+
+  assert(length <= CHECK_VECTOR_MAX);
+  for (size_t i = 0; i < length; i += 1) {
+    vector_offsets[i] = i * sizeof(node_s*);
+  }
+  gc_layout_s* layout = &vector_layouts[length];
+  layout->size        = length * sizeof(node_s*);
+  layout->num_ptrs    = length;
+  layout->ptr_offsets = vector_offsets;
+  layout->finalizer   = NULL;
+
+  return layout;
+
+} // check_vector_layout ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that `gc_resize()` keeps a vector's contents as it grows one element at
+ * a time, among other allocations and collections; that it zeroes what it
+ * adds; that it shrinks in place, letting go of what it cut off; and that it
+ * moves a vector that cannot grow where it is.
+ */
+void check_resize () {
+
+  node_s** vector = gc_resize(NULL, check_vector_layout(1));
+  assert(vector != NULL);
+  assert(vector[0] == NULL);
+  vector[0] = check_node(NULL, 0);
+
+  // Grow, with garbage in between and an occasional collection.
+  for (size_t length = 2; length <= CHECK_VECTOR_MAX; length += 1) {
+    vector = gc_resize(vector, check_vector_layout(length));
+    assert(vector != NULL);
+    assert(vector[length - 1] == NULL);
+    vector[length - 1] = check_node(NULL, length - 1);
+    check_node(NULL, -1);
+    if (length % 100 == 0) {
+      gc_root_set_insert(vector);
+      gc();
+    }
+  }
+  for (size_t i = 0; i < CHECK_VECTOR_MAX; i += 1) {
+    assert(vector[i]->value == (long)i);
+  }
+
+  // Shrink, in place; what was cut off is no longer reachable.
+  gc_weak_ref_t* weak   = check_weak_new(vector[CHECK_VECTOR_MAX - 1]);
+  node_s**       shrunk = gc_resize(vector, check_vector_layout(10));
+  assert(shrunk == vector);
+  gc_root_set_insert(vector);
+  gc_root_set_insert(weak);
+  gc();
+  assert(gc_weak_get(weak) == NULL);
+  for (size_t i = 0; i < 10; i += 1) {
+    assert(vector[i]->value == (long)i);
+  }
+
+  // Grow a vector followed by a live object, which forces a move.
+  node_s** small = gc_resize(NULL, check_vector_layout(2));
+  assert(small != NULL);
+  node_s* blocker = check_node(NULL, -2);
+  small[0] = vector[0];
+  small[1] = vector[1];
+  node_s** moved = gc_resize(small, check_vector_layout(100));
+  assert(moved != NULL && moved != small);
+  for (size_t i = 0; i < 100; i += 1) {
+    assert(i < 2 ? moved[i] == vector[i] : moved[i] == NULL);
+  }
+  gc_root_set_insert(moved);
+  gc_root_set_insert(blocker);
+  gc();
+  assert(blocker->value == -2);
+  assert(moved[0]->value == 0 && moved[1]->value == 1);
+
+} // check_resize ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and collect lists on a heap of the thread's own, concurrently with
+ * the other threads doing the same.
+ *
+ * \param arg Unused.
+ * \return `NULL`.
+ */
+void* check_heap_thread (void* arg) {
+
+  (void)arg;
+  gc_heap_t* heap = check_heap_begin(GC_HEAP_FREE_LIST);
+  node_s*    keep = check_list(CHECK_HEAP_THREAD_LIST);
+  for (int i = 0; i < 20; i += 1) {
+    check_list(CHECK_HEAP_THREAD_LIST);
+    gc_root_set_insert(keep);
+    gc();
+    check_list_intact(keep, CHECK_HEAP_THREAD_LIST);
+  }
+  gc_heap_destroy(heap);
+
+  return NULL;
+
+} // check_heap_thread ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that heaps are collected independently -- from other threads, and
+ * from threads whose current heap they are not -- and that a heap's weak
+ * references and ephemeron tables treat other heaps' objects as live.  Check,
+ * too, that the profiler samples allocations in many threads' heaps at once,
+ * and forgets the objects of the heaps destroyed.
+ */
+void check_heaps () {
+
+  gc_heap_t*     other   = check_heap_begin(GC_HEAP_FREE_LIST);
+  node_s*        foreign = check_list(10);
+  gc_weak_ref_t* lost    = check_weak_new(check_list(10));
+  gc_heap_t*     heap    = check_heap_begin(GC_HEAP_FREE_LIST);
+  node_s*        local   = check_list(10);
+
+  // Collecting one heap neither frees, nor disturbs, another's objects.
+  gc_root_set_insert(local);
+  gc();
+  assert(gc_weak_get(lost) != NULL);
+  check_list_intact(foreign, 10);
+  gc_heap_root_set_insert(other, foreign);
+  gc_heap_root_set_insert(other, lost);
+  gc_heap_collect(other);
+  assert(gc_weak_get(lost) == NULL);
+  check_list_intact(foreign, 10);
+  check_list_intact(local, 10);
+
+  // Weak references and ephemerons to another heap's objects are left alone.
+  gc_weak_ref_t*        weak  = check_weak_new(foreign);
+  gc_ephemeron_table_t* table = gc_ephemeron_table_new(8);
+  assert(table != NULL);
+  assert(gc_ephemeron_table_put(table, local, foreign));
+  assert(gc_ephemeron_table_put(table, foreign, local->next));
+  gc_root_set_insert(local);
+  gc_root_set_insert(weak);
+  gc_root_set_insert(table);
+  gc();
+  assert(gc_weak_get(weak) == foreign);
+  assert(gc_ephemeron_table_count(table) == 2);
+  assert(gc_ephemeron_table_get(table, local) == foreign);
+  assert(gc_ephemeron_table_get(table, foreign) == local->next);
+  gc_heap_destroy(heap);
+  gc_heap_destroy(other);
+
+  // Threads, each with a heap of its own, with and without the profiler, whose
+  // profile is shared.  Once their heaps are destroyed, none of the objects
+  // sampled is in use.
+  char   path[64];
+  size_t inuse_count, inuse_bytes, alloc_count, alloc_bytes;
+  check_path(path, sizeof(path), "heaps-profile");
+  for (int profiled = 0; profiled < 2; profiled += 1) {
+    if (profiled) {
+      gc_profile_start(CHECK_PROFILE_INTERVAL);
+    }
+    pthread_t threads[CHECK_HEAP_THREADS];
+    for (int i = 0; i < CHECK_HEAP_THREADS; i += 1) {
+      assert(pthread_create(&threads[i], NULL, check_heap_thread, NULL) == 0);
+    }
+    for (int i = 0; i < CHECK_HEAP_THREADS; i += 1) {
+      assert(pthread_join(threads[i], NULL) == 0);
+    }
+  }
+  gc_profile_stop();
+  assert(gc_profile_dump(path, GC_PROFILE_PPROF));
+  char* text = check_read_file(path);
+  assert(sscanf(text, "heap profile: %zu: %zu [%zu: %zu]",
+		&inuse_count, &inuse_bytes, &alloc_count, &alloc_bytes) == 4);
+  assert(inuse_count == 0 && inuse_bytes == 0);
+  assert(alloc_count > 0);
+  free(text);
+  unlink(path);
+  gc_profile_reset();
+
+} // check_heaps ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that an Immix heap keeps what is reachable intact across more
+ * collections than there are mark epochs, with objects of every size and
+ * regions (collected during, and promoted into, the heap) mixed in; and that
+ * it reuses the holes that garbage leaves, rather than growing.
+ */
+void check_immix () {
+
+  gc_heap_t* heap    = check_heap_begin(GC_HEAP_IMMIX);
+  node_s*    keep    = NULL;
+  uintptr_t  lowest  = UINTPTR_MAX;
+  uintptr_t  highest = 0;
+  uintptr_t  extent  = 0;
+
+  for (int i = 0; i < CHECK_IMMIX_GCS; i += 1) {
+
+    // Replace the kept list, with garbage of every size in between.  The span
+    // of the nodes' addresses measures how far the heap has grown.
+    node_s* list = NULL;
+    for (long j = 0; j < CHECK_IMMIX_LIST; j += 1) {
+      list    = check_node(list, j);
+      lowest  = (uintptr_t)list < lowest  ? (uintptr_t)list : lowest;
+      highest = (uintptr_t)list > highest ? (uintptr_t)list : highest;
+      assert(gc_new(&sized_layouts[j % NUM_SIZED_LAYOUTS]) != NULL);
+    }
+    if (i % 10 == 0) {
+      gc_region_begin();
+      gc_store(list, (void**)&list->other, check_list(CHECK_IMMIX_LIST));
+      check_list(CHECK_IMMIX_LIST);
+      gc_root_set_insert(list);
+      gc();
+      assert(gc_region_end() == CHECK_IMMIX_LIST);
+    }
+    keep = list;
+
+    gc_root_set_insert(keep);
+    gc();
+    check_list_intact(keep, CHECK_IMMIX_LIST);
+    if (keep->other != NULL) {
+      check_list_intact(keep->other, CHECK_IMMIX_LIST);
+    }
+
+    if (i == CHECK_IMMIX_GCS / 10) {
+      extent = highest - lowest;
+    }
+  }
+  assert(highest - lowest <= 2 * extent);
+
+  gc_heap_destroy(heap);
+
+} // check_immix ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that a list linked by compressed references counts down to `0` from
+ * the head, and that each node's other reference is to a node holding the
+ * negation of its payload.
+ *
+ * \param head   The head of the list.
+ * \param length The list's expected length.
+ */
+void check_ref_list_intact (ref_node_s* head, long length) {
+
+  for (long i = length - 1; i >= 0; i -= 1) {
+    assert(head != NULL);
+    assert(head->value == i);
+    ref_node_s* other = gc_ref_decode(head->other);
+    assert(other != NULL && other->value == -i);
+    head = gc_ref_decode(head->next);
+  }
+  assert(head == NULL);
+
+} // check_ref_list_intact ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check, on a heap of the given policy, that objects reachable only through
+ * compressed references survive collections, and are promoted out of a
+ * region when stored into a heap object by `gc_store_ref()`.
+ *
+ * \param policy How the heap's objects are organized.
+ */
+void check_refs_policy (gc_heap_policy_t policy) {
+
+  gc_heap_t*  heap = check_heap_begin(policy);
+  ref_node_s* head = NULL;
+  for (long i = 0; i < CHECK_REF_LIST; i += 1) {
+    ref_node_s* node  = gc_new(&ref_node_layout);
+    ref_node_s* other = gc_new(&ref_node_layout);
+    assert(node != NULL && other != NULL);
+    other->next  = 0;
+    other->other = 0;
+    other->value = -i;
+    node->next   = gc_ref_encode(head);
+    node->other  = gc_ref_encode(other);
+    node->value  = i;
+    head         = node;
+    check_node(NULL, i);
+    if (i % 1000 == 0) {
+      gc_root_set_insert(head);
+      gc();
+    }
+  }
+  gc_root_set_insert(head);
+  gc();
+  check_ref_list_intact(head, CHECK_REF_LIST);
+
+  // A region node, reachable only through a compressed reference.
+  gc_region_begin();
+  ref_node_s* escaped = gc_new(&ref_node_layout);
+  assert(escaped != NULL);
+  escaped->next  = 0;
+  escaped->other = 0;
+  escaped->value = 7;
+  gc_store_ref(head, &head->other, escaped);
+  assert(gc_region_end() == 1);
+  ref_node_s* promoted = gc_ref_decode(head->other);
+  assert(promoted != escaped && promoted->value == 7);
+
+  // It now stands in for the node that the head's other reference replaced.
+  promoted->value = -(CHECK_REF_LIST - 1);
+  gc_root_set_insert(head);
+  gc();
+  check_ref_list_intact(head, CHECK_REF_LIST);
+
+  gc_heap_destroy(heap);
+
+} // check_refs_policy ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check compressed references, on heaps of both policies.
+ */
+void check_refs () {
+
+  assert(sizeof(gc_ref_t) == 4);
+  assert(ref_node_layout.ptr_offsets[0] == GC_REF_OFFSET(offsetof(ref_node_s, next)));
+  assert(ref_node_layout.ptr_offsets[1] == GC_REF_OFFSET(offsetof(ref_node_s, other)));
+
+  check_refs_policy(GC_HEAP_FREE_LIST);
+  check_refs_policy(GC_HEAP_IMMIX);
+
+} // check_refs ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check, on a heap of the given policy, that a recording of a program using
+ * every recorded operation -- stores, resizes, weak references, ephemeron
+ * tables, and regions that are collected while open and then promote objects
+ * -- replays cleanly on both heap policies, and that destroying the heap being
+ * recorded stops the recording.
+ *
+ * \param policy How the recorded heap's objects are organized.
+ * \param path   The file to record to.
+ */
+void check_record_policy (gc_heap_policy_t policy, const char* path) {
+
+  gc_heap_t* heap = check_heap_begin(policy);
+
+  assert(gc_record_start(path));
+  gc_ephemeron_table_t* table  = gc_ephemeron_table_new(256);
+  node_s*               holder = check_node(NULL, 0);
+  assert(table != NULL);
+  for (int i = 0; i < 100; i += 1) {
+
+    // Grow a vector, which may move it, and store into what it grew by.
+    node_s** vector = gc_resize(NULL, check_vector_layout(1));
+    assert(vector != NULL);
+    gc_store(vector, (void**)&vector[0], check_node(NULL, i));
+    check_node(NULL, -1);
+    vector = gc_resize(vector, check_vector_layout(8));
+    assert(vector != NULL);
+    gc_store(vector, (void**)&vector[7], vector[0]);
+    gc_store(holder, &holder->other, vector);
+
+    gc_weak_ref_t* weak = check_weak_new(vector[0]);
+    assert(gc_ephemeron_table_put(table, vector[0], weak));
+    if (i % 3 == 0) {
+      assert(gc_ephemeron_table_remove(table, vector[0]));
+    }
+
+    // A region, sometimes collected while open, whose list may escape.
+    gc_region_begin();
+    node_s* list = check_list(20);
+    if (i % 2 == 0) {
+      gc_store(holder, (void**)&holder->next, list);
+    }
+    if (i % 5 == 0) {
+      gc_root_set_insert(holder);
+      gc_root_set_insert(table);
+      gc();
+    }
+    gc_region_end();
+    if (i % 2 == 0) {
+      gc_store(holder->next, (void**)&holder->next->next, NULL);
+    }
+
+    if (i % 10 == 0) {
+      gc_root_set_insert(holder);
+      gc_root_set_insert(table);
+      gc();
+    }
+  }
+  gc_heap_destroy(heap);
+  assert(!gc_recording);
+
+  char* const replay[]       = { "gcreplay", (char*)path, NULL };
+  char* const replay_immix[] = { "gcreplay", "--immix", (char*)path, NULL };
+  assert(check_run("gcreplay", replay, false) == 0);
+  assert(check_run("gcreplay", replay_immix, false) == 0);
+
+} // check_record_policy ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check recordings made on heaps of both policies, and that a recording storing
+ * outside of an object is refused.
+ */
+void check_record () {
+
+  char path[64];
+  check_path(path, sizeof(path), "record");
+  check_record_policy(GC_HEAP_FREE_LIST, path);
+  check_record_policy(GC_HEAP_IMMIX, path);
+
+  // A layout of 16 bytes, and a store 4096 bytes into an object of it.
+  static const unsigned char bad_events[] = {
+    RECORD_LAYOUT, 16, 1, 0, 0,
+    RECORD_NEW,    1,
+    RECORD_STORE,  1, 0x80, 0x40, 0,
+  };
+  record_file_header_s header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+  header.version = RECORD_VERSION;
+  FILE* out = fopen(path, "wb");
+  assert(out != NULL);
+  assert(fwrite(&header, sizeof(header), 1, out) == 1);
+  assert(fwrite(bad_events, sizeof(bad_events), 1, out) == 1);
+  fclose(out);
+  char* const replay[] = { "gcreplay", path, NULL };
+  assert(check_run("gcreplay", replay, true) == 1);
+
+  unlink(path);
+
+} // check_record ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Compare two pointers, for `qsort()`.
+ *
+ * \param a The first pointer.
+ * \param b The second pointer.
+ * \return Less than, equal to, or greater than `0`, as `a` is to `b`.
+ */
+int check_compare_ptrs (const void* a, const void* b) {
+
+  uintptr_t x = (uintptr_t)*(void* const*)a;
+  uintptr_t y = (uintptr_t)*(void* const*)b;
+
+  return (x > y) - (x < y);
+
+} // check_compare_ptrs ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Scan an object's pointer fields, and gather what the scan pushed onto the
+ * root set, which must be empty beforehand.
+ *
+ * \param scan   The scan.
+ * \param heap   The current heap.
+ * \param obj    The object.
+ * \param layout Its layout.
+ * \param found  Where to store what was pushed, sorted; room for every field.
+ * \return The number of pointers pushed.
+ */
+size_t check_scan_found (check_scan_f scan, gc_heap_t* heap, void* obj, const gc_layout_s* layout, void** found) {
+
+  scan(heap, obj, layout->ptr_offsets, layout->num_ptrs);
+  size_t count = 0;
+  void*  ptr;
+  while ((ptr = rs_pop()) != NULL) {
+    assert(count < layout->num_ptrs);
+    found[count++] = ptr;
+  }
+  qsort(found, count, sizeof(void*), check_compare_ptrs);
+
+  return count;
+
+} // check_scan_found ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that the bulk scans of pointer fields push exactly what the scalar
+ * scan does, and that marking through objects with enough fields to be scanned
+ * in bulk finds every object that a field refers to -- whether the field is one
+ * of a run of adjacent pointers, out of order, or a compressed reference --
+ * and nothing for `NULL`s, for pointers outside the heap, or twice for objects
+ * already marked.
+ */
+void check_scan () {
+
+  gc_heap_t*  heap    = check_heap_begin(GC_HEAP_FREE_LIST);
+  gc_heap_t*  other   = gc_heap_create(CHECK_HEAP_SIZE);
+  assert(other != NULL);
+  gc_heap_switch(other);
+  node_s*     foreign = check_node(NULL, -1);
+  gc_heap_switch(heap);
+  static long outside = 0;
+  size_t      offsets[CHECK_SCAN_MAX_PTRS + 2];
+  gc_layout_s layout;
+  srand(1);
+
+  for (unsigned int num_ptrs = 16; num_ptrs <= CHECK_SCAN_MAX_PTRS; num_ptrs += 5) {
+
+    // Adjacent pointers, with a swapped pair every so often, and two
+    // compressed references in the middle.
+    unsigned int num_fields = 0;
+    for (unsigned int i = 0; i < num_ptrs; i += 1) {
+      if (i == num_ptrs / 2) {
+	offsets[num_fields++] = GC_REF_OFFSET(num_ptrs * sizeof(void*));
+	offsets[num_fields++] = GC_REF_OFFSET(num_ptrs * sizeof(void*) + sizeof(gc_ref_t));
+      }
+      offsets[num_fields++] = i * sizeof(void*);
+    }
+    for (unsigned int i = 3; i + 1 < num_fields; i += 7) {
+      size_t swap    = offsets[i];
+      offsets[i]     = offsets[i + 1];
+      offsets[i + 1] = swap;
+    }
+    layout.size        = num_ptrs * sizeof(void*) + 2 * sizeof(gc_ref_t);
+    layout.num_ptrs    = num_fields;
+    layout.ptr_offsets = offsets;
+    layout.finalizer   = NULL;
+
+    // Fill the fields with a random mix of candidates, repeats and the rest.
+    node_s*        candidates[CHECK_SCAN_CANDIDATES];
+    gc_weak_ref_t* weaks[CHECK_SCAN_CANDIDATES];
+    bool           referred[CHECK_SCAN_CANDIDATES];
+    for (int i = 0; i < CHECK_SCAN_CANDIDATES; i += 1) {
+      candidates[i] = check_node(NULL, i);
+      weaks[i]      = check_weak_new(candidates[i]);
+      referred[i]   = false;
+    }
+    void** wide = gc_new(&layout);
+    assert(wide != NULL);
+    for (unsigned int i = 0; i < num_ptrs; i += 1) {
+      int choice = rand() % (CHECK_SCAN_CANDIDATES + 3);
+      wide[i]    = NULL;
+      if (choice < CHECK_SCAN_CANDIDATES) {
+	wide[i]          = candidates[choice];
+	referred[choice] = true;
+      } else if (choice == CHECK_SCAN_CANDIDATES) {
+	wide[i] = foreign;
+      } else if (choice == CHECK_SCAN_CANDIDATES + 1) {
+	wide[i] = &outside;
+      }
+    }
+    gc_ref_t* refs   = (gc_ref_t*)&wide[num_ptrs];
+    int       choice = rand() % CHECK_SCAN_CANDIDATES;
+    refs[0]          = gc_ref_encode(candidates[choice]);
+    refs[1]          = 0;
+    referred[choice] = true;
+
+    // Every scan pushes the same pointers as the scalar scan.
+    void*  expected[CHECK_SCAN_MAX_PTRS + 2];
+    void*  found[CHECK_SCAN_MAX_PTRS + 2];
+    size_t count = check_scan_found(mark_scan_scalar, heap, wide, &layout, expected);
+#if defined (__x86_64__)
+    assert(check_scan_found(mark_scan_sse2, heap, wide, &layout, found) == count);
+    assert(memcmp(found, expected, count * sizeof(void*)) == 0);
+    if (__builtin_cpu_supports("avx2")) {
+      assert(check_scan_found(mark_scan_avx2, heap, wide, &layout, found) == count);
+      assert(memcmp(found, expected, count * sizeof(void*)) == 0);
+    }
+#endif
+
+    // Some candidates are marked, from the root set, before the wide object.
+    gc_root_set_insert(wide);
+    for (int i = 0; i < CHECK_SCAN_CANDIDATES; i += 1) {
+      gc_root_set_insert(weaks[i]);
+      if (i % 9 == 0) {
+	gc_root_set_insert(candidates[i]);
+	referred[i] = true;
+      }
+    }
+    gc();
+    for (int i = 0; i < CHECK_SCAN_CANDIDATES; i += 1) {
+      assert(gc_weak_get(weaks[i]) == (referred[i] ? candidates[i] : NULL));
+    }
+    assert(foreign->value == -1);
+  }
+
+  gc_heap_destroy(heap);
+  gc_heap_destroy(other);
+
+} // check_scan ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check that, with dirty pages tracked, a minor collection keeps young objects
+ * that old ones refer to only through plain assignments since the last
+ * collection -- directly, and through other young objects -- while freeing the
+ * young objects that nothing refers to, and that a full collection still
+ * frees old objects.
+ */
+void check_minor () {
+
+  gc_heap_t* heap = check_heap_begin(GC_HEAP_FREE_LIST);
+  assert(gc_dirty_tracking_start());
+
+  // The old objects, survivors of a full collection.
+  node_s** old = gc_resize(NULL, check_vector_layout(CHECK_MINOR_OLD));
+  assert(old != NULL);
+  for (long i = 0; i < CHECK_MINOR_OLD; i += 1) {
+    old[i] = check_node(NULL, i);
+  }
+  gc_root_set_insert(old);
+  gc();
+
+  for (int round = 0; round < 10; round += 1) {
+
+    // Young objects, with a young chain hung off every tenth old object, and
+    // garbage watched by a weak reference.
+    gc_weak_ref_t* weak = check_weak_new(check_node(NULL, -1));
+    for (long i = round; i < CHECK_MINOR_OLD; i += 10) {
+      old[i]->other = check_node(check_node(NULL, -i), i);
+      check_list(5);
+    }
+
+    gc_root_set_insert(weak);
+    gc_minor();
+    assert(gc_weak_get(weak) == NULL);
+
+    // Reuse what was freed before checking what was kept.
+    check_list(10 * CHECK_MINOR_OLD);
+    for (long i = round; i < CHECK_MINOR_OLD; i += 10) {
+      node_s* young = old[i]->other;
+      assert(young->value == i && young->next->value == -i);
+      old[i]->other = NULL;
+    }
+  }
+
+  // A full collection frees old objects no longer reachable.
+  gc_weak_ref_t* weak = check_weak_new(old[0]);
+  old[0] = NULL;
+  gc_root_set_insert(old);
+  gc_root_set_insert(weak);
+  gc();
+  assert(gc_weak_get(weak) == NULL);
+  for (long i = 1; i < CHECK_MINOR_OLD; i += 1) {
+    assert(old[i]->value == i);
+  }
+
+  gc_dirty_tracking_stop();
+  gc_heap_destroy(heap);
+
+} // check_minor ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// THE CHECKS
+
+static const check_s checks[] = {
+  { "weak",      check_weak      },
+  { "ephemeron", check_ephemeron },
+  { "finalize",  check_finalize  },
+  { "region",    check_region    },
+  { "profile",   check_profile   },
+  { "image",     check_image     },
+  { "alloc",     check_alloc     },
+  { "trace",     check_trace     },
+  { "resize",    check_resize    },
+  { "heaps",     check_heaps     },
+  { "immix",     check_immix     },
+  { "refs",      check_refs      },
+  { "record",    check_record    },
+  { "scan",      check_scan      },
+  { "minor",     check_minor     },
+};
+
+#define NUM_CHECKS (sizeof(checks) / sizeof(checks[0]))
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Run the named checks, or all of them.
+ */
+int main (int argc, char** argv) {
+
+  if (argc == 3 && strcmp(argv[1], "--image-load") == 0) {
+    return check_image_load(argv[2]);
+  }
+
+  // Check that every check named exists before running any.
+  for (int i = 1; i < argc; i += 1) {
+    size_t j = 0;
+    while (j < NUM_CHECKS && strcmp(checks[j].name, argv[i]) != 0) {
+      j += 1;
+    }
+    if (j == NUM_CHECKS) {
+      fprintf(stderr, "USAGE: %s [<check>...]\n", argv[0]);
+      fprintf(stderr, "Checks:");
+      for (size_t k = 0; k < NUM_CHECKS; k += 1) {
+	fprintf(stderr, " %s", checks[k].name);
+      }
+      fprintf(stderr, "\n");
+      return 1;
+    }
+  }
+
+  for (size_t j = 0; j < NUM_CHECKS; j += 1) {
+    bool selected = argc == 1;
+    for (int i = 1; i < argc && !selected; i += 1) {
+      selected = strcmp(checks[j].name, argv[i]) == 0;
+    }
+    if (selected) {
+      checks[j].run();
+      printf("%-12s ok\n", checks[j].name);
+    }
+  }
+
+  return 0;
+
+} // main ()
+// ==============================================================================
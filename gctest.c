@@ -3,6 +3,9 @@
 #include <stdlib.h>
 #include "gc.h"
 
+// Define what an int object looks like to the GC.
+GC_DEFINE_LEAF_LAYOUT(int_layout, int);
+
 int main (int argc, char** argv) {
 
   // Check usage and extract the command line argument(s).
@@ -12,28 +15,23 @@ int main (int argc, char** argv) {
   }
   int num_objs = atoi(argv[1]);
 
-  // Define what an int object looks like to the GC.
-  gc_layout_s* int_layout = malloc(sizeof(gc_layout_s));
-  assert(int_layout != NULL);
-  int_layout->size        = sizeof(int);
-  int_layout->num_ptrs    = 0;
-  int_layout->ptr_offsets = NULL;
-
   // Make an array of pointers to int objects.  Define the array.
   gc_layout_s* array_layout = malloc(sizeof(gc_layout_s));
   assert(array_layout != NULL);
   array_layout->size        = sizeof(int*) * num_objs;
   array_layout->num_ptrs    = num_objs;
-  array_layout->ptr_offsets = malloc(sizeof(size_t) * num_objs);
-  assert(array_layout->ptr_offsets != NULL);
+  array_layout->finalizer   = NULL;
+  size_t* ptr_offsets       = malloc(sizeof(size_t) * num_objs);
+  assert(ptr_offsets != NULL);
   for (int i = 0; i < num_objs; i += 1) {
-    array_layout->ptr_offsets[i] = i * sizeof(int*);
+    ptr_offsets[i] = i * sizeof(int*);
   }
+  array_layout->ptr_offsets = ptr_offsets;
   
   int** x = gc_new(array_layout);
   assert(x != NULL);
   for (int i = 0; i < num_objs; i += 1) {
-    x[i]  = gc_new(int_layout);
+    x[i]  = gc_new(&int_layout);
     *x[i] = i; // Make each int hold a value.
   }
 
@@ -39,6 +39,9 @@
 /** The maximum length of debugging/error messages. */
 #define MAX_MESSAGE_LENGTH 256
 
+/** The maximum length of a whole line of output, before its newline. */
+#define MAX_OUTPUT_LENGTH  (4 * MAX_MESSAGE_LENGTH)
+
 #define TAB_STRING "\t"
 #define TAB_LENGTH 1
 
@@ -79,7 +82,33 @@ int_to_hex (char* buffer, uint64_t value) {
 
 // ==============================================================================
 /**
- * Print a message.
+ * Append a string to a message being built, truncating it if there is not
+ * room.
+ *
+ * \param buffer The message.
+ * \param length The length of the message so far, updated.
+ * \param string The string to append.
+ */
+void
+append (char* buffer, size_t* length, const char* string) {
+
+  size_t string_length = strnlen(string, MAX_MESSAGE_LENGTH);
+  if (string_length > MAX_OUTPUT_LENGTH - *length) {
+    string_length = MAX_OUTPUT_LENGTH - *length;
+  }
+  memcpy(buffer + *length, string, string_length);
+  *length += string_length;
+
+} // append ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Print a message.  The whole line is built on the stack and then emitted with
+ * a single `write()`, so that messages are cheap, and those from different
+ * threads do not interleave.
  *
  * \param prefix The string to emit as a prefix.
  * \param msg    The string to emit as a message.
@@ -88,23 +117,26 @@ int_to_hex (char* buffer, uint64_t value) {
  */
 void
 emit (const char* prefix, const char* msg, int argc, va_list argp) {
-  
-  // Emit the prefix and message.
-  write(OUTPUT_FD, prefix, strnlen(prefix, MAX_MESSAGE_LENGTH));
-  write(OUTPUT_FD, msg,    strnlen(msg,    MAX_MESSAGE_LENGTH));
 
-  // Emit each given integer with a tab prefix.
+  char   output[MAX_OUTPUT_LENGTH + NEWLINE_LENGTH];
+  size_t length = 0;
+
+  // Append the prefix and message.
+  append(output, &length, prefix);
+  append(output, &length, msg);
+
+  // Append each given integer with a tab prefix.
   for (int i = 0; i < argc; ++i) {
     uint64_t value = va_arg(argp, uint64_t);
     char     buffer[MAX_MESSAGE_LENGTH];
     int_to_hex(buffer, value);
-    write(OUTPUT_FD, TAB_STRING, TAB_LENGTH);
-    write(OUTPUT_FD, buffer,     strnlen(buffer, MAX_MESSAGE_LENGTH));
+    append(output, &length, TAB_STRING);
+    append(output, &length, buffer);
   }
 
-  // Emit a newline and flush the output.
-  write(OUTPUT_FD, NEWLINE_STRING, NEWLINE_LENGTH);
-  fsync(OUTPUT_FD);
+  // Append a newline, and emit the line.
+  memcpy(output + length, NEWLINE_STRING, NEWLINE_LENGTH);
+  write(OUTPUT_FD, output, length + NEWLINE_LENGTH);
 
 }
 // ==============================================================================